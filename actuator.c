@@ -46,20 +46,13 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "dlog.h"
+#include "netmux.h"
+#include "handshake.h"
+#include "counters.h"
+#include "params.h"
 
-static int flag = 0;
-static int check = 0;
-static int schedule_flag = 0;
 static int nr_neighbors = 0;
-/* This is the structure of broadcast messages. */
-struct broadcast_message {
-  uint8_t seqno;
-};
-
-/* This is the structure of unicast ping messages. */
-struct unicast_message {
-  uint8_t type;
-};
 
 /* This structure holds information about neighbors. */
 struct neighbor {
@@ -70,285 +63,350 @@ struct neighbor {
   /* The ->addr field holds the Rime address of the neighbor. */
   linkaddr_t addr;
 
-  /* The ->last_rssi and ->last_lqi fields hold the Received Signal
-     Strength Indicator (RSSI) and CC2420 Link Quality Indicator (LQI)
-     values that are received for the incoming broadcast packets. */
-  uint16_t last_rssi, last_lqi;
-
-  /* Each broadcast packet contains a sequence number (seqno). The
-     ->last_seqno field holds the last sequenuce number we saw from
-     this neighbor. */
-  uint8_t last_seqno;
-
-  /* The ->avg_gap contains the average seqno gap that we have seen
-     from this neighbor. */
-  uint32_t avg_seqno_gap;
+  /* The ->slot field holds the slot the neighbor was given when it
+     joined; a repeated join gets the same one. */
+  uint8_t slot;
 
+  /* The ->confirmed field holds the schedule version the neighbor
+     confirmed last. */
+  uint8_t confirmed;
 };
 
-/* This #define defines the maximum amount of neighbors we can remember. */
-#define MAX_NEIGHBORS 16
-
 /* This MEMB() definition defines a memory pool from which we allocate
-   neighbor entries. */
+   neighbor entries; MAX_NEIGHBORS is in params.h. */
 MEMB(neighbors_memb, struct neighbor, MAX_NEIGHBORS);
 
 /* The neighbors_list is a Contiki list that holds the neighbors we
    have seen thus far. */
 LIST(neighbors_list);
 
-/* These hold the broadcast and unicast structures, respectively. */
-static struct broadcast_conn broadcast;
+/* Empty rounds in a row after which the join phase is over. */
+#define JOIN_QUIET_ROUNDS 3
+
+/* A request goes out this often once nobody is joining any more. */
+#define JOIN_IDLE_INTERVAL (CLOCK_SECOND * 60)
+
+/* The round in progress, and the joins heard in it. */
+static uint8_t round;
+static uint8_t minislots = HANDSHAKE_MINISLOTS_MAX;
+static uint8_t accepting;
+static uint8_t collided;
+static struct handshake_slot acks[HANDSHAKE_MINISLOTS_MAX];
+static uint8_t ack_count;
+
+/* Seconds per TDMA frame announced in the schedule. */
+#define SCHEDULE_INTERVAL 60
+
+/* Times the schedule is repeated for sensors that did not confirm. */
+#define SCHEDULE_ATTEMPTS 4
 
-#define MAX_RETRANSMISSIONS 4
-#define NUM_HISTORY_ENTRIES 4
+/* Bumped whenever the set of neighbors, and with it the schedule, changes. */
+static uint8_t schedule_version;
+
+/* Set when a neighbor is added, or the schedule is due for a refresh. */
+static uint8_t changed;
 /*---------------------------------------------------------------------------*/
 PROCESS(initialization_process, "initialization");
 PROCESS(schedule_process, "schedule");
 AUTOSTART_PROCESSES(&initialization_process, &schedule_process);
 /*---------------------------------------------------------------------------*/
-/*static void
-broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
+/* Returns the lowest slot no neighbor holds, so freed slots are reused. */
+static uint8_t
+free_slot(void)
 {
-	  char * rcv_bfr;
-	  char * address = "address";
-
-	  struct neighbor *n;
-	  struct broadcast_message *m;
-	  uint8_t seqno_gap;
-}*/
-/* This function is called for every incoming unicast packet. */
-struct history_entry {
-  struct history_entry *next;
-  linkaddr_t addr;
-  uint8_t seq;
-};
-LIST(history_table);
-MEMB(history_mem, struct history_entry, NUM_HISTORY_ENTRIES);
+  struct neighbor *n;
+  uint8_t slot;
+
+  for(slot = 0; ; slot++) {
+    for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+      if(n->slot == slot) {
+        break;
+      }
+    }
+    if(n == NULL) {
+      return slot;
+    }
+  }
+}
 /*---------------------------------------------------------------------------*/
-static void
-recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+/* Slots a frame is split into: up to the highest one held. */
+static uint8_t
+frame_slots(void)
 {
-  /* OPTIONAL: Sender history */
-  struct history_entry *e = NULL;
-  char * receive_msg = "null";
-  char * address = "address";
+  struct neighbor *n;
+  uint8_t slots = 0;
 
+  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+    if(n->slot >= slots) {
+      slots = n->slot + 1;
+    }
+  }
+  return slots;
+}
+/*---------------------------------------------------------------------------*/
+/* Frees the neighbors that did not confirm the schedule in force. */
+static void
+drop_unconfirmed(void)
+{
+  struct neighbor *n, *next;
+
+  for(n = list_head(neighbors_list); n != NULL; n = next) {
+    next = list_item_next(n);
+    if(n->confirmed != schedule_version) {
+      DLOG_INFO("unresponsive neighbor %d.%d deleted, slot %d\n",
+                n->addr.u8[0], n->addr.u8[1], n->slot);
+      list_remove(neighbors_list, n);
+      memb_free(&neighbors_memb, n);
+      nr_neighbors--;
+    }
+  }
+}
+/*---------------------------------------------------------------------------*/
+/* This function is called for every join heard in the window. */
+static void
+recv_join(const linkaddr_t *from, const void *fields)
+{
+  const struct handshake_join *join = fields;
   struct neighbor *n;
-  struct broadcast_message *m;
+  uint8_t i;
 
-  for(e = list_head(history_table); e != NULL; e = e->next) {
-    if(linkaddr_cmp(&e->addr, from)) {
+  if(!accepting || join->round != round ||
+     join->actuator[0] != linkaddr_node_addr.u8[0] ||
+     join->actuator[1] != linkaddr_node_addr.u8[1]) {
+    return;
+  }
+  if(join->attempts > 0) {
+    collided = 1;
+  }
+
+  /* Check if we already know this neighbor. */
+  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+    if(linkaddr_cmp(&n->addr, from)) {
       break;
     }
   }
-  if(e == NULL) {
-    /* Create new history entry */
-    e = memb_alloc(&history_mem);
-    if(e == NULL) {
-      e = list_chop(history_table); /* Remove oldest at full history */
-    }
-    linkaddr_copy(&e->addr, from);
-    e->seq = seqno;
-    list_push(history_table, e);
-  } else {
-    /* Detect duplicate callback */
-    if(e->seq == seqno) {
-      printf("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
-	     from->u8[0], from->u8[1], seqno);
+
+  /* If n is NULL, this neighbor was not found in our list, and we
+     allocate a new struct neighbor from the neighbors_memb memory
+     pool. */
+  if(n == NULL) {
+    n = nr_neighbors < PARAM(PARAM_MAX_NEIGHBORS) ? memb_alloc(&neighbors_memb) : NULL;
+
+    /* If we could not allocate a new neighbor entry, the sensor is not
+       acknowledged and tries again later. */
+    if(n == NULL) {
+      COUNTERS_INC(COUNTERS_NEIGHBORS, COUNTER_POOL_FULL);
+      DLOG_WARN("no room for %d.%d\n", from->u8[0], from->u8[1]);
       return;
     }
-    /* Update existing history entry */
-    e->seq = seqno;
+    linkaddr_copy(&n->addr, from);
+    n->slot = free_slot();
+    n->confirmed = schedule_version;
+    list_add(neighbors_list, n);
+    nr_neighbors++;
+    changed = 1;
+    DLOG_INFO("neighbor added, slot %d\n", n->slot);
   }
 
-  /* Grab the pointer to the incoming data. */
-  receive_msg = packetbuf_dataptr();
-  printf("runicast received with message %s\n",receive_msg);
-  if ((flag == 1) && (strcmp(receive_msg,address)==0)){
-	  /* The packetbuf_dataptr() returns a pointer to the first data byte
-	     in the received packet. */
-	  m = packetbuf_dataptr();
-
-	  /* Check if we already know this neighbor. */
-	  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
-
-	    /* We break out of the loop if the address of the neighbor matches
-	       the address of the neighbor from which we received this
-	       broadcast message. */
-	    if(linkaddr_cmp(&n->addr, from)) {
-	      break;
-	    }
-	  }
-
-	  /* If n is NULL, this neighbor was not found in our list, and we
-	     allocate a new struct neighbor from the neighbors_memb memory
-	     pool. */
-	  if(n == NULL) {
-	    n = memb_alloc(&neighbors_memb);
-
-	    /* If we could not allocate a new neighbor entry, we give up. We
-	       could have reused an old neighbor entry, but we do not do this
-	       for now. */
-	    if(n == NULL) {
-	      return;
-	    }
-	    /* Initialize the fields. */
-	    linkaddr_copy(&n->addr, from);
-
-	    /* Place the neighbor on the neighbor list. */
-	    list_add(neighbors_list, n);
-	    nr_neighbors = nr_neighbors + 1;
-	    printf("neighbor added\n");
-	  }
+  for(i = 0; i < ack_count; i++) {
+    if(acks[i].addr[0] == from->u8[0] && acks[i].addr[1] == from->u8[1]) {
+      return;
+    }
+  }
+  if(ack_count < HANDSHAKE_MINISLOTS_MAX) {
+    acks[ack_count].addr[0] = from->u8[0];
+    acks[ack_count].addr[1] = from->u8[1];
+    acks[ack_count].slot = n->slot;
+    ack_count++;
   }
-  receive_msg = "null";
 }
-static const struct broadcast_callbacks broadcast_call = {};
-static struct broadcast_conn broadcast;
+/*---------------------------------------------------------------------------*/
 static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+recv_confirm(const linkaddr_t *from, const void *fields)
 {
-  printf("runicast message sent to %d.%d, retransmissions %d\n",
-	 to->u8[0], to->u8[1], retransmissions);
-  check = 0;
+  const struct handshake_confirm *confirm = fields;
+  struct neighbor *n;
+
+  if(confirm->actuator[0] != linkaddr_node_addr.u8[0] ||
+     confirm->actuator[1] != linkaddr_node_addr.u8[1]) {
+    return;
+  }
+  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+    if(linkaddr_cmp(&n->addr, from)) {
+      n->confirmed = confirm->version;
+      break;
+    }
+  }
 }
+/*---------------------------------------------------------------------------*/
+static const struct handshake_op handshake_ops[HANDSHAKE_OPS] = {
+  [HANDSHAKE_OP_JOIN] = {recv_join},
+  [HANDSHAKE_OP_CONFIRM] = {recv_confirm},
+};
+
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+recv_handshake(const linkaddr_t *from)
 {
-  printf("runicast message timed out when sending to %d.%d, retransmissions %d\n",
-	 to->u8[0], to->u8[1], retransmissions);
-  check = 1;
+  handshake_dispatch(handshake_ops, from);
 }
-static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
-							     sent_runicast,
-							     timedout_runicast};
-static struct runicast_conn runicast;
+
+static const struct netmux_handler handshake_handler = {recv_handshake,
+							   NULL,
+							   NULL,
+							   NULL};
 
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(initialization_process, ev, data)
 {
-  static struct etimer et,dt;
-  char * msg;
-  struct neighbor *n;
-  int randneighbor, i, j, x;
-  static int k;
-  PROCESS_EXITHANDLER(runicast_close(&runicast);)
+  static struct etimer et;
+  static uint8_t quiet, idle;
+  struct handshake_request request;
+  struct handshake_ack ack;
+
+  PROCESS_EXITHANDLER(netmux_close();)
 
   PROCESS_BEGIN();
 
-  broadcast_open(&broadcast, 129, &broadcast_call);
+  params_open(1);
+  netmux_open();
+  netmux_register(NETMUX_TYPE_HANDSHAKE, &handshake_handler);
+  counters_open(NULL);
 
   while(1) {
-	if(check == 1)
-	{
-		printf("unresponsive neighbor deleted\n");
-		list_remove(neighbors_list, n);
-		nr_neighbors--;
-		check = 0;
-	}
-    /* Delay 2-4 seconds */
-	if (flag == 3)
-	{
-		etimer_set(&et, CLOCK_SECOND * 60);
-		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&dt));
-	}
-	else if(flag == 1)
-	{
-    	etimer_set(&dt, CLOCK_SECOND * 20);
-    	PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&dt));
-	}
-	else
-	{
-		etimer_set(&et, CLOCK_SECOND * 1);
-	    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-	}
-
-    switch (flag){
-    case 0:
-    	broadcast_open(&broadcast, 129, &broadcast_call);
-        packetbuf_copyfrom("req", 4);
-        broadcast_send(&broadcast);
-        flag = 1;
-        printf("broadcast message sent\n");
-        runicast_open(&runicast, 146, &runicast_callbacks);
-        broadcast_close(&broadcast);
-    break;
-    case 1:
-    	printf("actuator: waited for addresses\n");
-    	if(schedule_flag != 1)
-    	{
-    		flag = 2;
-    	}
-    	else
-    	{
-    		flag = 3;
-    	}
-    break;
-    case 2:
-		if(list_length(neighbors_list) > 0)
-		{
-			  if(k >= nr_neighbors)
-			  {
-				  k = 0;
-			  }
-			  n = list_head(neighbors_list);
-			  for(j = 0; j < k; j=j+1){
-				  n = list_item_next(n);
-			  }
-			  k++;
-			  msg = "schedule";
-			  printf("sending runicast to %d.%d with message %s\n", n->addr.u8[0], n->addr.u8[1], msg);
-
-			  packetbuf_copyfrom(msg, (strlen(msg)+1));
-			  runicast_send(&runicast, &n->addr, MAX_RETRANSMISSIONS);
-		}
-		if(k == nr_neighbors)
-		{
-			flag = 3;
-			schedule_flag = 1;
-			printf("schedule sent\n");
-		}
-
-			//printf("%d, %d\n",k,nr_neighbors);
-    break;
-    case 3:
-  	    flag = 0;
-  	    printf("Rerun initialization broadcast \n");
-    break;
-    default:
-    break;
+    /* Offer a window of mini-slots and collect the joins sent in it. */
+    round++;
+    ack_count = 0;
+    collided = 0;
+    accepting = 1;
+    request.round = round;
+    request.minislots = minislots;
+    request.version = schedule_version;
+    handshake_copy(HANDSHAKE_OP_REQUEST, &request, NULL);
+    netmux_broadcast(NETMUX_TYPE_HANDSHAKE);
+    DLOG_DBG("round %d, %d mini-slots\n", round, minislots);
+
+    etimer_set(&et, (minislots + 1) * HANDSHAKE_MINISLOT_TIME);
+    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+    accepting = 0;
+
+    /* One acknowledgement for everybody heard; the rest try again. */
+    if(ack_count > 0) {
+      ack.round = round;
+      ack.count = ack_count;
+      handshake_copy(HANDSHAKE_OP_JOIN_ACK, &ack, acks);
+      netmux_broadcast(NETMUX_TYPE_HANDSHAKE);
+      DLOG_INFO("round %d: %d joined, %d neighbors\n", round, ack_count, nr_neighbors);
+    }
+
+    /* Joins that collided before, or a window mostly used, mean there are
+       more joiners than slots; an empty window shrinks. */
+    if(collided || ack_count * 2 > minislots) {
+      minislots = HANDSHAKE_MINISLOTS_MAX;
+    } else if(ack_count == 0 && minislots / 2 >= HANDSHAKE_MINISLOTS_MIN) {
+      minislots /= 2;
+    }
+
+    /* Sensors backing off show up in later rounds, so the next one follows
+       right away until a few have stayed empty. The next join phase may
+       bring a crowd again and starts with the whole window. */
+    quiet = ack_count > 0 ? 0 : quiet + 1;
+    if(quiet >= JOIN_QUIET_ROUNDS) {
+      quiet = JOIN_QUIET_ROUNDS;
+      minislots = HANDSHAKE_MINISLOTS_MAX;
+      /* Now and then every sensor has to confirm again, which finds the
+         ones that are gone. */
+      if(++idle >= HANDSHAKE_REFRESH_REQUESTS) {
+        changed = 1;
+      }
+      if(changed) {
+        changed = 0;
+        idle = 0;
+        schedule_version++;
+        DLOG_INFO("schedule %d for %d neighbors\n", schedule_version, nr_neighbors);
+        process_poll(&schedule_process);
+      }
+      etimer_set(&et, JOIN_IDLE_INTERVAL);
+    } else {
+      etimer_set(&et, HANDSHAKE_MINISLOT_TIME);
     }
+    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
   }
   PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
 
-PROCESS_THREAD(schedule_process, ev, data)
+/* Puts the next sensors after *n that have not confirmed into a schedule
+   frame, and leaves *n after the last one taken. Returns how many. */
+static uint8_t
+fill_schedule(struct neighbor **n, struct handshake_slot *slots)
 {
-	static struct etimer et;
-	PROCESS_EXITHANDLER(broadcast_close(&broadcast);)
-
-	PROCESS_BEGIN();
-
-	while(1)
-    {
-		etimer_set(&et, CLOCK_SECOND * 1);
-	    PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-	    switch(schedule_flag){
-	    case 1:
-	    	//printf("")
-	    break;
-	    case 2:
-		break;
-	    default:
-	    break;
-	    }
+  uint8_t count = 0;
+
+  for(; *n != NULL && count < HANDSHAKE_MINISLOTS_MAX; *n = list_item_next(*n)) {
+    if((*n)->confirmed != schedule_version) {
+      slots[count].addr[0] = (*n)->addr.u8[0];
+      slots[count].addr[1] = (*n)->addr.u8[1];
+      slots[count].slot = (*n)->slot;
+      count++;
     }
+  }
+  return count;
+}
+/*---------------------------------------------------------------------------*/
+static uint8_t
+unconfirmed(void)
+{
+  struct neighbor *n;
+  uint8_t count = 0;
 
-
-	PROCESS_END();
+  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+    count += n->confirmed != schedule_version;
+  }
+  return count;
 }
+/*---------------------------------------------------------------------------*/
+/* Sends the schedule to all sensors that do not have its current version,
+   a frame at a time, each followed by the mini-slots they confirm in. */
+PROCESS_THREAD(schedule_process, ev, data)
+{
+  static struct etimer et;
+  static struct neighbor *n;
+  static struct handshake_slot slots[HANDSHAKE_MINISLOTS_MAX];
+  static uint8_t attempt, sent;
+  struct handshake_schedule schedule;
 
+  PROCESS_BEGIN();
 
+  while(1) {
+    PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+
+    for(attempt = 0; attempt < SCHEDULE_ATTEMPTS && unconfirmed() > 0; attempt++) {
+      sent = 0;
+      n = list_head(neighbors_list);
+      while(n != NULL) {
+        schedule.version = schedule_version;
+        schedule.interval = SCHEDULE_INTERVAL;
+        schedule.slots = frame_slots();
+        schedule.count = fill_schedule(&n, slots);
+        if(schedule.count == 0) {
+          break;
+        }
+        handshake_copy(HANDSHAKE_OP_SCHEDULE, &schedule, slots);
+        netmux_broadcast(NETMUX_TYPE_HANDSHAKE);
+        sent += schedule.count;
+
+        etimer_set(&et, (schedule.count + 1) * HANDSHAKE_MINISLOT_TIME);
+        PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+      }
+      DLOG_INFO("schedule %d, attempt %d: sent to %d\n", schedule_version, attempt + 1, sent);
+    }
+    sent = unconfirmed();
+    if(sent > 0) {
+      DLOG_WARN("schedule %d not confirmed by %d neighbors\n", schedule_version, sent);
+      drop_unconfirmed();
+    }
+  }
+
+  PROCESS_END();
+}
 /*---------------------------------------------------------------------------*/
@@ -12,9 +12,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "contiki.h"
 #include "net/rime/rime.h"
+#include "net/rime/trickle.h"
 
 #include "lib/list.h"
 #include "lib/memb.h"
@@ -24,7 +26,20 @@
 #include "dev/light-sensor.h"
 #include "dev/leds.h"
 
+#include "cfs/cfs.h"
+
 #include "../mycommon.h"
+#include "../rules.h"
+#include "../bulk.h"
+#include "../logbuf.h"
+#include "../dlog.h"
+#include "../topology.h"
+#include "../fwdqueue.h"
+#include "../channel.h"
+#include "../netmux.h"
+#include "../counters.h"
+#include "../params.h"
+#include "../warmstart.h"
 #include "actuator.h"
 
 /*---------------------------------------------------------------------------*/
@@ -40,130 +55,620 @@ MEMB(neighbors_memb, struct neighbor, MAX_NEIGHBORS);
    have seen thus far. */
 LIST(neighbors_list);
 
+/* Zone a sensor belongs to. */
+#define SENSOR_ZONE(addr) ((addr)->u8[0] % RULES_ZONES)
+
+/* The local control rules, evaluated on every reading. */
+static const struct rule rule_table[] = {
+	/* zone, type, source, op, threshold, hysteresis, outputs */
+	{0, RUNICAST_TYPE_TEMP, RULE_SOURCE_READING, RULE_ABOVE, 8, 1, RULE_OUT_RED},
+	{0, RUNICAST_TYPE_TEMP, RULE_SOURCE_ZONE, RULE_BELOW, 3, 1, RULE_OUT_GREEN | RULE_OUT_EXT(0)},
+	{1, RUNICAST_TYPE_TEMP, RULE_SOURCE_ZONE, RULE_ABOVE, 6, 1, RULE_OUT_YELLOW | RULE_OUT_EXT(1)},
+	{1, RUNICAST_TYPE_HUMID, RULE_SOURCE_ZONE, RULE_ABOVE, 7, 2, RULE_OUT_EXT(2)},
+};
+
+/* The rule set in use: the table above until a rule set artifact is installed. */
+static struct rule rule_set[RULES_MAX];
+static uint8_t rule_set_count;
+
+/* Slot table and calibration table, installed as bulk artifacts. */
+#define CALIBRATION_MAX 16
+
+static struct bulk_slot slots[MAX_NEIGHBORS];
+static uint8_t slot_count;
+static struct bulk_calibration calibration[CALIBRATION_MAX];
+static uint8_t calibration_count;
+
+static struct trickle_conn trickle;
+
+/* Configuration version carried by the schedule reply in flight. */
+static uint8_t config_in_flight;
+
+/* A schedule reply waiting for the radio. */
+struct schedule_job
+{
+	linkaddr_t to;
+	uint8_t slot;
+	uint8_t channel;	/* the sensor listens for the reply on the channel it sent on */
+};
+
+static struct fwdqueue replies;
+
+/* Moves the radio between the control channel and our data channel. */
+static struct ctimer channel_timer;
+
+/* Loads the rule set with the thresholds overridden by the current configuration. */
+static int
+load_rules(void)
+{
+	static struct rule rules[RULES_MAX];
+	int i;
+
+	memcpy(rules, rule_set, rule_set_count * sizeof(struct rule));
+	for(i = 0; i < netconfig.rule_count && i < rule_set_count; i++) {
+		rules[i].threshold = netconfig.rules[i].threshold;
+		rules[i].hysteresis = netconfig.rules[i].hysteresis;
+	}
+	return rules_load(rules, rule_set_count);
+}
 
 static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+default_rules(void)
 {
+	rule_set_count = sizeof(rule_table) / sizeof(rule_table[0]);
+	memcpy(rule_set, rule_table, sizeof(rule_table));
+	load_rules();
+}
 
-	printf("Runicast message sent to %d, attempts: %d\n",
-			to->u16, retransmissions);
+/* Reads up to max bytes of a table artifact, returns the number of whole entries. */
+static uint8_t
+read_table(int fd, void *table, uint16_t max, uint16_t length, uint16_t entry)
+{
+	int n;
+
+	n = cfs_read(fd, table, length < max ? length : max);
+	return n < 0 ? 0 : n / entry;
 }
 
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+bulk_installed(uint8_t kind, uint8_t version, int fd, uint16_t length)
 {
-	printf("Runicast message timed out when sending to %d, attempts: %d\n",
-			to->u16, retransmissions);
+	switch(kind) {
+	case BULK_KIND_SLOTS:
+		slot_count = read_table(fd, slots, sizeof(slots), length, sizeof(slots[0]));
+		DLOG_INFO("Slot table version %d: %d slots\n", version, slot_count);
+		break;
+	case BULK_KIND_RULES:
+		rule_set_count = read_table(fd, rule_set, sizeof(rule_set), length, sizeof(rule_set[0]));
+		if(load_rules()) {
+			DLOG_INFO("Rule set version %d: %d rules\n", version, rule_set_count);
+		} else {
+			DLOG_WARN("Rule set version %d rejected, using the built-in rules\n", version);
+			default_rules();
+		}
+		break;
+	case BULK_KIND_CALIBRATION:
+		calibration_count = read_table(fd, calibration, sizeof(calibration), length, sizeof(calibration[0]));
+		DLOG_INFO("Calibration table version %d: %d entries\n", version, calibration_count);
+		break;
+	case BULK_KIND_CHANNELS: {
+		struct bulk_channel entry;
+
+		// a plan that leaves us out puts our cluster back on the control channel
+		DLOG_INFO("Channel plan version %d\n", version);
+		channel_set_data(CHANNEL_CONTROL);
+		while(length >= sizeof(entry) && cfs_read(fd, &entry, sizeof(entry)) == sizeof(entry)) {
+			if(linkaddr_cmp(&entry.addr, &linkaddr_node_addr)) {
+				channel_set_data(entry.channel);
+				break;
+			}
+			length -= sizeof(entry);
+		}
+		break;
+	}
+	default:
+		break;
+	}
 }
 
+static const struct bulk_callbacks bulk_callbacks = {bulk_installed};
+
+/* Slot of a sensor from the slot table, or -1 if it has none. */
+static int
+slot_of(const linkaddr_t *addr)
+{
+	int i;
+
+	for(i = 0; i < slot_count; i++) {
+		if(linkaddr_cmp(&slots[i].addr, addr)) {
+			return slots[i].slot;
+		}
+	}
+	return -1;
+}
+
+static int16_t
+calibrate(const linkaddr_t *addr, int16_t raw)
+{
+	int i;
+
+	for(i = 0; i < calibration_count; i++) {
+		if(linkaddr_cmp(&calibration[i].addr, addr)) {
+			return (int16_t)(((int32_t)raw * calibration[i].gain) / 256 + calibration[i].offset);
+		}
+	}
+	return raw;
+}
 
 static void
-recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+recv_trickle_config(struct trickle_conn *c)
 {
-	printf("Receiving data from sensor %d\n", from->u16);
-	struct neighbor *n;
-	struct runicast_message *m;
+	struct netconfig config;
 
-	m = packetbuf_dataptr();
+	if(packetbuf_datalen() != sizeof(config)) {
+		DLOG_WARN("Ignoring configuration of unexpected size %d\n", packetbuf_datalen());
+		return;
+	}
+	memcpy(&config, packetbuf_dataptr(), sizeof(config));
+	topology_heard(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+
+	if(netconfig_apply(&config)) {
+		DLOG_INFO("Configuration version %d applied: interval %u, dead-band %d\n",
+				netconfig.version, netconfig.time_interval, netconfig.deadband);
+		load_rules();
+		warmstart_touch();
+	}
+}
+
+
+static struct neighbor *
+find_neighbor(const linkaddr_t *addr)
+{
+	struct neighbor *n;
 
-	int node_id = 0;
-	/* Check if we already know this neighbor. */
 	for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
-		/* We break out of the loop if the address of the neighbor matches
-		   the address of the neighbor from which we received this
-		   broadcast message. */
-		if(linkaddr_cmp(&n->addr, from)) {
-		  break;
+		if(linkaddr_cmp(&n->addr, addr)) {
+			break;
 		}
-		node_id++;
+	}
+	return n;
+}
 
+/* How far into the current frame we are, in milliseconds. */
+static int32_t
+frame_ms(int interval)
+{
+	return (int32_t)(clock_seconds() % interval) * 1000 +
+			(int32_t)(clock_time() % CLOCK_SECOND) * 1000 / CLOCK_SECOND;
+}
+
+// The time to the slot is worked out when the reply actually goes out, so
+// the time it spent in the queue does not shift the sensor off its slot.
+static void
+send_next_reply(void)
+{
+	struct fwdqueue_entry *e;
+	struct schedule_job *job;
+	struct neighbor *n;
+
+	e = fwdqueue_head(&replies);
+	if(e == NULL || netmux_is_transmitting()) {
+		return;
 	}
+	job = (struct schedule_job *)e->data;
+	n = find_neighbor(&job->to);
 
-	// i-th neighbor should transmit at clock_time() + k * INTERVAL + i * (INTERVAL / MAX_SENSORS)
+	int interval = netconfig.time_interval;
+	int32_t frame = (int32_t)interval * 1000;
 
-	// received = clock_seconds();
-	// expected = k * TIME_INTERVAL + node_id * TIME_INTERVAL / MAX_NEIGHBORS; // for some k
-	// late = received - expected;
-	// early = expected - received;
-	// next = TIME_INTERVAL + early;
-	//
-	int next_time = TIME_INTERVAL - (clock_seconds() % TIME_INTERVAL - node_id * TIME_INTERVAL / MAX_NEIGHBORS);
+	// the sensor is told to wake up early by as much as its reports are late
+	int32_t next_ms = (int32_t)TDMA_SLOT_OFFSET(job->slot, interval) * 1000 - frame_ms(interval) -
+			(n != NULL ? n->bias : 0);
 
 	// if the next transmission time is too soon, delay it by 1 TIME_INTERVAL.
+	while(next_ms < frame / 2) next_ms += frame;
+
+	DLOG_INFO("Sensor %d should send again in %ld ms\n", job->to.u16, (long)next_ms);
+
+	// The schedule reply carries the configuration if the sensor is behind.
+	struct {
+		struct runicast_message msg;
+		struct netconfig config;
+	} reply;
+
+	DLOG_INFO("Sending back to %d the time it should wait before transmitting again.\n", job->to.u16);
+
+	memset(&reply.msg, 0, sizeof(reply.msg));
+	reply.msg.type = RUNICAST_TYPE_SCHEDULE;
+	reply.msg.priority = PRIORITY_CONTROL;
+	reply.msg.data = next_ms / 1000;
+	reply.msg.data_ms = next_ms % 1000;
+	reply.msg.drift = n != NULL ? n->drift : 0;
+	reply.msg.slot = job->slot;
+	reply.msg.channel = channel_data;
+
+	if(n != NULL && n->config_version != netconfig.version) {
+		memcpy(&reply.config, &netconfig, sizeof(netconfig));
+		packetbuf_copyfrom(&reply, sizeof(reply));
+	} else {
+		packetbuf_copyfrom(&reply.msg, sizeof(reply.msg));
+	}
+	config_in_flight = netconfig.version;
+	channel_select(job->channel);
+	netmux_unicast(NETMUX_TYPE_DATA, &job->to,
+			topology_budget(&job->to, PRIORITY_CONTROL, PARAM(PARAM_MAX_RETRANSMISSIONS)));
+}
+
+/*
+ * 1 if now is within a second of the start of slot, or with narrow set,
+ * in the second before it or the one it starts in.
+ */
+static int
+near_slot(int now, uint8_t slot, int interval, int narrow)
+{
+	int d = (now - TDMA_SLOT_OFFSET(slot, interval) + interval) % interval;
+
+	return d == 0 || d == interval - 1 || (d == 1 && !narrow);
+}
 
-	if(next_time < TIME_INTERVAL / 2) next_time += TIME_INTERVAL;
+// Outside the urgent slot and the slots of our sensors the radio listens on
+// the control channel, where discovery, dissemination and the mesh run.
+static void
+channel_tick(void *ptr)
+{
+	struct neighbor *n;
+	int interval = netconfig.time_interval;
+	int now = clock_seconds() % interval;
+	uint8_t due;
 
-	printf("Sensor %d should send again in %d seconds\n", from->u16, next_time);
+	ctimer_set(&channel_timer, CLOCK_SECOND, channel_tick, NULL);
 
+	// a reply keeps the channel it went out on until it is acknowledged
+	if(netmux_is_transmitting()) {
+		return;
+	}
+
+	due = near_slot(now, 0, interval, 0);
+	for(n = list_head(neighbors_list); n != NULL && !due; n = list_item_next(n)) {
+		due = near_slot(now, n->slot, interval, n->drift_samples >= DRIFT_SETTLED);
+	}
+	channel_select(due ? channel_data : CHANNEL_CONTROL);
+}
+
+static void
+sent_runicast(const linkaddr_t *to, uint8_t retransmissions)
+{
+	struct neighbor *n;
+
+	DLOG_DBG("Runicast message sent to %d, attempts: %d\n",
+			to->u16, retransmissions);
+	topology_sent(to, retransmissions + 1, 1);
+
+	// The sensor now runs the configuration that went out with its schedule.
+	n = find_neighbor(to);
+	if(n != NULL && n->config_version != config_in_flight) {
+		n->config_version = config_in_flight;
+		warmstart_touch();
+	}
+
+	// A retransmitted reply reached the sensor at an unknown time, later
+	// than the reply says, so the next report cannot be trusted.
+	if(n != NULL) {
+		n->synced = retransmissions == 0 ? clock_seconds() : 0;
+	}
+
+	fwdqueue_pop(&replies);
+	send_next_reply();
+}
+
+static void
+timedout_runicast(const linkaddr_t *to, uint8_t retransmissions)
+{
+	DLOG_WARN("Runicast message timed out when sending to %d, attempts: %d\n",
+			to->u16, retransmissions);
+	topology_sent(to, retransmissions + 1, 0);
+	fwdqueue_pop(&replies);
+	send_next_reply();
+}
+
+
+// Lowest slot after the urgent ones that no neighbor holds.
+static uint8_t
+free_slot(void)
+{
+	struct neighbor *n;
+	uint8_t slot;
+
+	for(slot = TDMA_URGENT_SLOTS; slot < TDMA_SLOTS - 1; slot++) {
+		for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+			if(n->slot == slot) {
+				break;
+			}
+		}
+		if(n == NULL) {
+			break;
+		}
+	}
+	return slot;
+}
+
+// A sensor that stays quiet past its heartbeat has left or died; its entry
+// and slot go back to the pool for the next sensor that shows up.
+static void
+lease_tick(void *ptr)
+{
+	struct neighbor *n = ptr;
+
+	if(++n->missed <= netconfig.max_silence + NEIGHBOR_LEASE_MISSES) {
+		ctimer_restart(&n->lease);
+		return;
+	}
+
+	DLOG_INFO("Sensor %d silent for %d intervals, freeing slot %d\n",
+			n->addr.u16, n->missed, n->slot);
+	if(n->track.valid) {
+		rules_forget(n->zone, n->type, n->track.value);
+	}
+	list_remove(neighbors_list, n);
+	memb_free(&neighbors_memb, n);
+	warmstart_touch();
+}
+
+// A report is due at the start of the slot of its sensor. In the frame
+// right after a schedule reply, how late it arrives is the delay of the
+// radio and the sensor, which the next reply takes off; after frames in
+// dead-band without a reply, what is left is the drift of the sensor clock
+// since, which the next reply tells the sensor to correct.
+static void
+track_drift(struct neighbor *n)
+{
+	int interval = netconfig.time_interval;
+	int32_t frame = (int32_t)interval * 1000;
+	int32_t err, elapsed, drift;
+
+	if(n->synced == 0) {
+		return;
+	}
+	elapsed = clock_seconds() - n->synced;
+	n->synced = 0;
+
+	err = (frame_ms(interval) - (int32_t)TDMA_SLOT_OFFSET(n->slot, interval) * 1000 +
+			frame + frame / 2) % frame - frame / 2;
+	if(err > DRIFT_WINDOW_MS || err < -DRIFT_WINDOW_MS) {
+		return;
+	}
+
+	if(elapsed < 2 * interval) {
+		// halfway there, rounded away from zero so it does not stall
+		n->bias += (err + (err > 0) - (err < 0)) / 2;
+		return;
+	}
+	// late means slow, and a slow clock has to cut its sleeps short
+	drift = n->drift - err * DRIFT_DAY / elapsed / 2;
+	n->drift = drift > INT16_MAX ? INT16_MAX : drift < INT16_MIN ? INT16_MIN : drift;
+	if(n->drift_samples < 255) {
+		n->drift_samples++;
+	}
+	DLOG_DBG("Sensor %d: %ld ms late after %ld s, drift %d ms a day\n",
+			n->addr.u16, (long)err, (long)elapsed, n->drift);
+}
+
+static void
+recv_runicast_data(const linkaddr_t *from)
+{
+	DLOG_INFO("Receiving data from sensor %d\n", from->u16);
+	struct neighbor *n;
+	struct runicast_message *m;
+
+	m = packetbuf_dataptr();
+	topology_heard(from);
+
+	n = find_neighbor(from);
 
 	/* If n is NULL, this neighbor was not found in our list, and we
 	 allocate a new struct neighbor from the neighbors_memb memory
 	 pool. */
 	if(n == NULL) {
-		n = memb_alloc(&neighbors_memb);
+		n = list_length(neighbors_list) < PARAM(PARAM_MAX_NEIGHBORS) ? memb_alloc(&neighbors_memb) : NULL;
 
 		// If we could not allocate a new neighbor entry, we give up.
 		if(n == NULL) {
+		  COUNTERS_INC(COUNTERS_NEIGHBORS, COUNTER_POOL_FULL);
+		  DLOG_WARN("No room for sensor %d, %d neighbors\n", from->u16, list_length(neighbors_list));
 		  return;
 		}
 
 		/* Initialize the fields. */
 		linkaddr_copy(&n->addr, from);
+		deadband_track_init(&n->track);
+		n->synced = 0;
+		n->bias = 0;
+		n->drift = 0;
+		n->drift_samples = 0;
+		n->type = m->type;
+		n->zone = SENSOR_ZONE(from);
+		n->config_version = 0;
+
+		// a slot assigned by the slot table takes precedence over a free one
+		int slot = slot_of(from);
+		n->slot = slot >= 0 ? TDMA_URGENT_SLOTS + slot : free_slot();
 
 		/* Place the neighbor on the neighbor list. */
 		list_add(neighbors_list, n);
+		warmstart_touch();
+	}
+
+	// every report renews the lease
+	n->missed = 0;
+	ctimer_set(&n->lease, CLOCK_SECOND * netconfig.time_interval, lease_tick, n);
+
+	int16_t value = calibrate(from, m->data);
+
+	if(m->type == RUNICAST_TYPE_TEMP || m->type == RUNICAST_TYPE_HUMID) {
+		if(n->track.valid && n->type != m->type) {
+			rules_forget(n->zone, n->type, n->track.value);
+			n->track.valid = 0;
+		}
+		n->type = m->type;
+		rules_reading(n->zone, n->type, value, n->track.valid ? &n->track.value : NULL);
 	}
 
-	struct runicast_message msg;
+	deadband_track_update(&n->track, value);
+
+	struct log_record record;
+	record.time = clock_seconds();
+	linkaddr_copy(&record.source, from);
+	record.type = m->type;
+	record.value = value;
+	logbuf_append(&record);
 
-	printf("Sending back to %d the time it should wait before transmitting again.\n", from->u16);
+	// An alarm arrives in the urgent slot, outside the schedule of the sensor,
+	// which keeps its own slot and needs no reply.
+	if(m->priority == PRIORITY_ALARM) {
+		DLOG_WARN("Alarm from sensor %d: %d\n", from->u16, value);
+		return;
+	}
 
-	msg.type = RUNICAST_TYPE_SCHEDULE;
-	msg.data = next_time;
+	track_drift(n);
 
-	packetbuf_copyfrom(&msg, sizeof(msg));
-	runicast_send(&runicast, from, MAX_RETRANSMISSIONS);
+	// sensors get the slots after the ones reserved for alarms
+	struct schedule_job job;
+	linkaddr_copy(&job.to, from);
+	job.slot = n->slot;
+	job.channel = channel_current();
+	if(fwdqueue_put(&replies, from->u16, PRIORITY_CONTROL, &job, sizeof(job)) == FWDQUEUE_DROPPED) {
+		DLOG_WARN("Reply queue full, no schedule for sensor %d\n", from->u16);
+	}
+	send_next_reply();
 }
 
 
+/* A neighbor as it is checkpointed, see warmstart.h. */
+struct neighbor_checkpoint
+{
+	uint8_t addr[2];
+	uint8_t slot;
+	uint8_t type;
+	uint8_t zone;
+	uint8_t config_version;
+};
+
+/* Checkpoint: configuration | count (1) | count neighbors */
+#define CHECKPOINT_HEADER (sizeof(struct netconfig) + 1)
+
+static int
+checkpoint_save(uint8_t *buf, int max)
+{
+	struct neighbor_checkpoint cp;
+	struct neighbor *n;
+	uint8_t count = 0;
+
+	memcpy(buf, &netconfig, sizeof(netconfig));
+	for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+		if(CHECKPOINT_HEADER + (count + 1) * sizeof(cp) > max) {
+			break;
+		}
+		cp.addr[0] = n->addr.u8[0];
+		cp.addr[1] = n->addr.u8[1];
+		cp.slot = n->slot;
+		cp.type = n->type;
+		cp.zone = n->zone;
+		cp.config_version = n->config_version;
+		memcpy(buf + CHECKPOINT_HEADER + count * sizeof(cp), &cp, sizeof(cp));
+		count++;
+	}
+	buf[sizeof(netconfig)] = count;
+	return CHECKPOINT_HEADER + count * sizeof(cp);
+}
+
+// The neighbors come back with a fresh lease, so the ones that are gone
+// are freed again after their heartbeat; their readings start over.
 static void
-recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
+checkpoint_load(const uint8_t *buf, int len)
 {
-	printf("IGNORE BROADCAST\n");
+	struct netconfig config;
+	struct neighbor_checkpoint cp;
+	struct neighbor *n;
+	uint8_t i;
+
+	if(len < CHECKPOINT_HEADER || len != CHECKPOINT_HEADER + buf[sizeof(config)] * sizeof(cp)) {
+		return;
+	}
+	memcpy(&config, buf, sizeof(config));
+	if(netconfig_apply(&config)) {
+		load_rules();
+	}
+
+	for(i = 0; i < buf[sizeof(config)]; i++) {
+		n = memb_alloc(&neighbors_memb);
+		if(n == NULL) {
+			break;
+		}
+		memcpy(&cp, buf + CHECKPOINT_HEADER + i * sizeof(cp), sizeof(cp));
+		n->addr.u8[0] = cp.addr[0];
+		n->addr.u8[1] = cp.addr[1];
+		deadband_track_init(&n->track);
+		n->synced = 0;
+		n->bias = 0;
+		n->drift = 0;
+		n->drift_samples = 0;
+		n->slot = cp.slot;
+		n->type = cp.type;
+		n->zone = cp.zone;
+		n->config_version = cp.config_version;
+		n->missed = 0;
+		ctimer_set(&n->lease, CLOCK_SECOND * netconfig.time_interval, lease_tick, n);
+		list_add(neighbors_list, n);
+	}
 }
 
+static const struct warmstart_callbacks warmstart_callbacks = {checkpoint_save, checkpoint_load};
 
 PROCESS(actuator_node_setup_process, "sensor cast");
-AUTOSTART_PROCESSES(&actuator_node_setup_process);
+PROCESS(series_process, "series");
+AUTOSTART_PROCESSES(&actuator_node_setup_process, &series_process);
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(actuator_node_setup_process, ev, data)
 {
 
-	PROCESS_EXITHANDLER()
+	PROCESS_EXITHANDLER(netmux_close();)
 	PROCESS_BEGIN();
 
 	SENSORS_ACTIVATE(button_sensor);
 	SENSORS_ACTIVATE(light_sensor); // activate sensor
 
+	default_rules();
+	fwdqueue_init(&replies);
+	ctimer_set(&channel_timer, CLOCK_SECOND, channel_tick, NULL);
+	bulk_open(&bulk_callbacks);
+	params_open(1);
+	netconfig_init();
+	logbuf_open(NULL);
+	topology_open(NULL);
+	counters_open(NULL);
+	trickle_open(&trickle, CLOCK_SECOND, NETCONFIG_CHANNEL, &trickle_config_callbacks);
+	netmux_open();
+
+	// after a reset the sensors we had keep reporting, no need to advertise
+	if(warmstart_open(&warmstart_callbacks)) {
+		DLOG_INFO("Resuming with %d sensors\n", list_length(neighbors_list));
+		netmux_register(NETMUX_TYPE_DATA, &data_handler);
+	}
 
 	while(1) {
-		printf("Press the button in order to broadcast an actuator advertisement.");
+		DLOG_INFO("Press the button in order to broadcast an actuator advertisement.");
 
 		PROCESS_WAIT_EVENT_UNTIL(ev == sensors_event && data == &button_sensor); // wait for button press event
-		printf("Button pressed.\n");
+		DLOG_INFO("Button pressed.\n");
 
 		//process_exit(&data_sender_process);
 
-		broadcast_open(&broadcast, 129, &broadcast_callbacks);
-
 		// Broadcast an actuator advertisement.
-		printf("Broadcasting an actuator advertisement.\n");
+		DLOG_INFO("Broadcasting an actuator advertisement.\n");
 	    packetbuf_copyfrom("Hello", 6);
-		broadcast_send(&broadcast);
-		broadcast_close(&broadcast);
+		netmux_broadcast(NETMUX_TYPE_ADVERTISEMENT);
 
-		runicast_close(&runicast);
-		runicast_open(&runicast, 130, &runicast_data_callbacks);
+		netmux_register(NETMUX_TYPE_DATA, &data_handler);
 	}
 
 	PROCESS_END();
@@ -171,3 +676,42 @@ PROCESS_THREAD(actuator_node_setup_process, ev, data)
 
 
 // Wait for unicasts with data. If we get something from a new node, put it in the next available time slot and tell it when it should send data next.
+
+/*---------------------------------------------------------------------------*/
+// Rebuild the series of every sensor once per interval. Sensors in dead-band
+// mode only report changes, so a missing report means the value is held.
+PROCESS_THREAD(series_process, ev, data)
+{
+	static struct etimer et;
+	struct neighbor *n;
+	int16_t value;
+	int state;
+
+	PROCESS_BEGIN();
+
+	while(1) {
+		etimer_set(&et, CLOCK_SECOND * netconfig.time_interval);
+		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
+
+		for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+			state = deadband_track_get(&n->track, &value);
+
+			if(state == DEADBAND_FRESH) {
+				DLOG_INFO("Sensor %d: %d\n", n->addr.u16, value);
+			} else if(state == DEADBAND_HELD) {
+				DLOG_INFO("Sensor %d: %d (held)\n", n->addr.u16, value);
+			} else if(state == DEADBAND_STALE) {
+				DLOG_INFO("Sensor %d: no report for too long\n", n->addr.u16);
+
+				// a silent sensor no longer counts towards its zone
+				rules_forget(n->zone, n->type, value);
+				deadband_track_init(&n->track);
+			}
+		}
+
+		DLOG_INFO("Rules: outputs 0x%02x, last %u ticks, worst case %u ticks\n",
+				rules_outputs(), rules_last, rules_wcet);
+	}
+
+	PROCESS_END();
+}
@@ -10,20 +10,25 @@
 
 
 static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
+sent_runicast(const linkaddr_t *to, uint8_t retransmissions);
 
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
+timedout_runicast(const linkaddr_t *to, uint8_t retransmissions);
 
 
 static void
-recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno);
+recv_runicast_data(const linkaddr_t *from);
 
 
-static const struct runicast_callbacks runicast_data_callbacks = {recv_runicast_data,
+static const struct netmux_handler data_handler = {NULL, recv_runicast_data,
 							     	 	 	 	 	 	 	 sent_runicast,
 															 timedout_runicast};
 
+static void
+recv_trickle_config(struct trickle_conn *c);
+
+static const struct trickle_callbacks trickle_config_callbacks = {recv_trickle_config};
+
 
 
 
@@ -45,6 +45,9 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "../dlog.h"
+#include "../topology.h"
+#include "../netmux.h"
 #include <string.h>
 
 static struct mesh_conn mesh;
@@ -70,29 +73,28 @@ enum
 };
 
 
-static struct broadcast_conn broadcast;
 uint16_t time_delay;
 uint8_t address_base=0;
 //int address_base[2] = {rimeaddr_node_addr.u8[1], rimeaddr_node_addr.u8[0]};
 
 static void
-recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
+recv_discovery(const linkaddr_t *from)
 {
 	struct broadcast *received_msg;
 	received_msg = packetbuf_dataptr();
 	struct broadcast br_msg;
+	topology_heard(from);
 	if(received_msg->type == BROADCAST_TYPE_DISCOVERY)
 	{
 		if(received_msg->data != address_base)
 		{
 			address_base = received_msg->data;
-			printf("base station addr: %d\n",address_base);
-			printf("actuator: broadcast to neighbors\n");
+			DLOG_INFO("base station addr: %d\n",address_base);
+			DLOG_INFO("actuator: broadcast to neighbors\n");
 			br_msg.type = BROADCAST_TYPE_DISCOVERY;
 			br_msg.data = address_base;
 			packetbuf_copyfrom(&br_msg, sizeof(br_msg));
-			broadcast_send(&broadcast);
-			broadcast_close(&broadcast);
+			netmux_broadcast(NETMUX_TYPE_DISCOVERY);
 		}
 	}
 }
@@ -100,13 +102,13 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 static void
 sent(struct mesh_conn *c)
 {
-  printf("packet sent\n");
+  DLOG_DBG("packet sent\n");
 }
 
 static void
 timedout(struct mesh_conn *c)
 {
-  printf("packet timedout\n");
+  DLOG_WARN("packet timedout\n");
 }
 
 static void
@@ -114,7 +116,7 @@ recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
 {
 
 }
-static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
+static const struct netmux_handler discovery_handler = {recv_discovery, NULL, NULL, NULL};
 const static struct mesh_callbacks callbacks = {recv, sent, timedout};
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(basestation_process, ev, data)
@@ -122,7 +124,8 @@ PROCESS_THREAD(basestation_process, ev, data)
 	PROCESS_EXITHANDLER(mesh_close(&mesh);)
 	PROCESS_BEGIN();
 
-	broadcast_open(&broadcast, 55, &broadcast_callbacks);
+	netmux_open();
+	netmux_register(NETMUX_TYPE_DISCOVERY, &discovery_handler);
 	static struct etimer et, dt;
 	struct mesh_message msg;
 
@@ -132,6 +135,7 @@ PROCESS_THREAD(basestation_process, ev, data)
 		PROCESS_WAIT_UNTIL(etimer_expired(&et));
 	}
 	mesh_open(&mesh, 132, &callbacks);
+	topology_open(NULL);
 
   	while(1)
   	{
@@ -41,17 +41,39 @@
 #include "net/rime/rime.h"
 #include "net/rime/mesh.h"
 #include "net/rime/collect.h"
+#include "net/rime/trickle.h"
 #include "dev/button-sensor.h"
+#include "dev/serial-line.h"
 
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "../netconfig.h"
+#include "../bulk.h"
+#include "../logbuf.h"
+#include "../serialframe.h"
+#include "../topology.h"
+#include "../netmap.h"
+#include "../netmux.h"
+#include "../counters.h"
+#include "../params.h"
+#include "../dlog.h"
+
+/* Readings go out as binary frames (see frame.h) instead of text. */
+#ifndef BASESTATION_EXPORT_BINARY
+#define BASESTATION_EXPORT_BINARY 1
+#endif
+
+static uint8_t export_binary = BASESTATION_EXPORT_BINARY;
+
 static struct mesh_conn mesh;
 /*---------------------------------------------------------------------------*/
 PROCESS(basestation_process, "base station");
-AUTOSTART_PROCESSES(&basestation_process);
+PROCESS(config_process, "config");
+AUTOSTART_PROCESSES(&basestation_process, &config_process);
 /*---------------------------------------------------------------------------*/
 struct broadcast
 {
@@ -70,26 +92,19 @@ enum
 	MESH_TYPE_HUMID
 };
 
-static struct broadcast_conn broadcast;
 uint16_t time_delay;
 //int address_base[2] = {rimeaddr_node_addr.u8[1], rimeaddr_node_addr.u8[0]};
 
-static void
-recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
-{
-	// do nothing for now
-}
-
 static void
 sent(struct mesh_conn *c)
 {
-  printf("packet sent\n");
+  DLOG_DBG("packet sent\n");
 }
 
 static void
 timedout(struct mesh_conn *c)
 {
-  printf("packet timedout\n");
+  DLOG_WARN("packet timedout\n");
 }
 
 static void
@@ -98,6 +113,13 @@ recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
   struct mesh_message * received_message;
 
   received_message = packetbuf_dataptr();
+  topology_heard(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+
+  if(export_binary) {
+    serialframe_reading(from, received_message->type, received_message->data);
+    return;
+  }
+
   //uint8_t data = **received_message->type;
   printf("Type == %d\n",received_message->type);
   printf("Data received from %d.%d: %d (%d)\n",
@@ -106,7 +128,6 @@ recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
   //packetbuf_copyfrom(received_message, sizeof(received_message));
   //mesh_send(&mesh, from);
 }
-static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
 const static struct mesh_callbacks callbacks = {recv, sent, timedout};
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(basestation_process, ev, data)
@@ -114,7 +135,8 @@ PROCESS_THREAD(basestation_process, ev, data)
 	PROCESS_EXITHANDLER(mesh_close(&mesh);)
 	PROCESS_BEGIN();
 
-	broadcast_open(&broadcast, 55, &broadcast_callbacks);
+	// the discovery flood only goes out, nothing is registered to receive
+	netmux_open();
 
 	static struct etimer et, dt;
 	struct broadcast br_msg;
@@ -122,11 +144,11 @@ PROCESS_THREAD(basestation_process, ev, data)
 	etimer_set(&et, CLOCK_SECOND * 1);
 
 	PROCESS_WAIT_UNTIL(etimer_expired(&et));
-	printf("basestation: broadcast to neighbors\n");
+	DLOG_INFO("basestation: broadcast to neighbors\n");
 	br_msg.type = BROADCAST_TYPE_DISCOVERY;
 	br_msg.data = linkaddr_node_addr.u8[0];
 	packetbuf_copyfrom(&br_msg, sizeof(br_msg));
-	broadcast_send(&broadcast);
+	netmux_broadcast(NETMUX_TYPE_DISCOVERY);
 
 	mesh_open(&mesh, 132, &callbacks);
 
@@ -138,3 +160,343 @@ PROCESS_THREAD(basestation_process, ev, data)
   	PROCESS_END();
 }
 /*---------------------------------------------------------------------------*/
+static struct trickle_conn trickle;
+
+static void
+recv_trickle(struct trickle_conn *c)
+{
+	// we are the only source of configurations
+}
+const static struct trickle_callbacks trickle_callbacks = {recv_trickle};
+
+/*
+ * Parses "config <interval> <deadband> <max_silence> [<threshold> <hysteresis>]..."
+ * into c. Returns 1 on success.
+ */
+static int
+parse_config(const char *line, struct netconfig *c)
+{
+	char *end;
+	long v[3 + 2 * NETCONFIG_RULES];
+	int n = 0;
+
+	if(strncmp(line, "config ", 7) != 0) {
+		return 0;
+	}
+	line += 7;
+
+	while(n < sizeof(v) / sizeof(v[0])) {
+		v[n] = strtol(line, &end, 10);
+		if(end == line) {
+			break;
+		}
+		line = end;
+		n++;
+	}
+
+	if(n < 3 || (n - 3) % 2 != 0) {
+		return 0;
+	}
+
+	c->time_interval = v[0];
+	c->deadband = v[1];
+	c->max_silence = v[2];
+	c->rule_count = (n - 3) / 2;
+	for(n = 0; n < c->rule_count; n++) {
+		c->rules[n].threshold = v[3 + 2 * n];
+		c->rules[n].hysteresis = v[4 + 2 * n];
+	}
+	return 1;
+}
+
+/*
+ * "param net <name> <value>" floods a parameter to every node with a new
+ * configuration version. Fills c and returns 1 on success.
+ */
+static int
+parse_param(const char *line, struct netconfig *c)
+{
+	char *end;
+	const char *value;
+	char name[16];
+	long v;
+	int id;
+
+	line += 10;
+	value = strchr(line, ' ');
+	if(value == NULL || value - line >= sizeof(name)) {
+		return 0;
+	}
+	memcpy(name, line, value - line);
+	name[value - line] = '\0';
+
+	id = params_find(name);
+	v = strtol(value, &end, 10);
+	if(id < 0 || end == value || v <= 0 || !params_valid(id, v)) {
+		return 0;
+	}
+	// the rest of the configuration stays as it is
+	memcpy(c, &netconfig, sizeof(*c));
+	memset(c->params, 0, sizeof(c->params));
+	c->params[id] = v;
+	// the default interval is also the one in force
+	if(id == PARAM_TIME_INTERVAL) {
+		c->time_interval = v;
+	}
+	return 1;
+}
+
+/*
+ * Artifacts are uploaded as
+ *   bulk begin <kind> <version> <length>
+ *   bulk data <hex bytes>       (up to 32 bytes, repeated)
+ *   bulk end
+ * and disseminated to all actuators on "bulk end".
+ */
+static void
+handle_bulk(const char *line)
+{
+	char *end;
+	long kind, version, length;
+	uint8_t buf[32];
+	int n;
+
+	if(strncmp(line, "bulk begin ", 11) == 0) {
+		kind = strtol(line + 11, &end, 10);
+		version = strtol(end, &end, 10);
+		length = strtol(end, &end, 10);
+		if(!bulk_begin(kind, version, length)) {
+			printf("bulk: cannot start kind %ld version %ld, %ld bytes\n", kind, version, length);
+		}
+	} else if(strncmp(line, "bulk data ", 10) == 0) {
+		line += 10;
+		for(n = 0; n < sizeof(buf) && line[0] != '\0' && line[1] != '\0'; n++, line += 2) {
+			char hex[3] = {line[0], line[1], '\0'};
+			buf[n] = strtol(hex, NULL, 16);
+		}
+		if(!bulk_append(buf, n)) {
+			printf("bulk: data does not fit\n");
+		}
+	} else if(strcmp(line, "bulk end") == 0) {
+		if(!bulk_commit()) {
+			printf("bulk: artifact incomplete\n");
+		}
+	} else {
+		printf("usage: bulk begin <kind> <version> <length> | bulk data <hex> | bulk end\n");
+	}
+}
+
+static void
+log_received(const linkaddr_t *from, uint32_t offset, const uint8_t *data, int len)
+{
+	uint8_t frame[FRAME_MAX_SIZE - 3];
+	int i;
+
+	if(export_binary && len <= sizeof(frame) - FRAME_LOG_HEADER) {
+		frame[0] = from->u8[0];
+		frame[1] = from->u8[1];
+		for(i = 0; i < 4; i++) {
+			frame[2 + i] = (offset >> (8 * i)) & 0xff;
+		}
+		memcpy(frame + FRAME_LOG_HEADER, data, len);
+		serialframe_send(FRAME_TYPE_LOG, frame, FRAME_LOG_HEADER + len);
+		return;
+	}
+
+	printf("log %d.%d %lu ", from->u8[0], from->u8[1], (unsigned long)offset);
+	for(i = 0; i < len; i++) {
+		printf("%02x", data[i]);
+	}
+	printf("\n");
+}
+
+static void
+log_done(const linkaddr_t *from, uint32_t end, int complete)
+{
+	printf("log %d.%d %s at %lu\n", from->u8[0], from->u8[1],
+			complete ? "complete" : "incomplete", (unsigned long)end);
+}
+
+static const struct logbuf_callbacks logbuf_callbacks = {log_received, log_done};
+
+static void
+topology_report(const linkaddr_t *from, uint8_t hops,
+		const struct topology_link *links, uint8_t count)
+{
+	DLOG_DBG("topology report from %d.%d, %d links\n", from->u8[0], from->u8[1], count);
+	netmap_report(from, hops, links, count);
+}
+
+static const struct topology_callbacks topology_callbacks = {topology_report};
+
+static void
+counters_report(const linkaddr_t *from, uint8_t hops,
+		const uint8_t *values, uint8_t modules, uint8_t kinds)
+{
+	uint8_t frame[FRAME_MAX_SIZE - 3];
+	int m, k, len = modules * kinds * 2;
+
+	if(export_binary && len <= sizeof(frame) - FRAME_COUNTERS_HEADER) {
+		frame[0] = from->u8[0];
+		frame[1] = from->u8[1];
+		frame[2] = hops;
+		frame[3] = modules;
+		frame[4] = kinds;
+		memcpy(frame + FRAME_COUNTERS_HEADER, values, len);
+		serialframe_send(FRAME_TYPE_COUNTERS, frame, FRAME_COUNTERS_HEADER + len);
+		return;
+	}
+
+	for(m = 0; m < modules; m++) {
+		printf("counters %d.%d module %d:", from->u8[0], from->u8[1], m);
+		for(k = 0; k < kinds; k++, values += 2) {
+			printf(" %u", values[0] | values[1] << 8);
+		}
+		printf("\n");
+	}
+}
+
+static const struct counters_callbacks counters_callbacks = {counters_report};
+
+static struct ctimer map_timer;
+
+/* Exports the network map, with our own links as seen right now. */
+static void
+export_map(void *ptr)
+{
+	struct topology_link links[TOPOLOGY_LINKS];
+
+	ctimer_set(&map_timer, TOPOLOGY_INTERVAL, export_map, NULL);
+
+	netmap_report(&linkaddr_node_addr, 0, links, topology_snapshot(links, TOPOLOGY_LINKS));
+	netmap_update();
+	serialframe_flush();
+	netmap_export(export_binary);
+}
+
+/*
+ * "channels <version>" allocates a data channel to every node on the map
+ * and disseminates the plan as a BULK_KIND_CHANNELS artifact.
+ */
+static void
+handle_channels(const char *line)
+{
+	struct bulk_channel plan[NETMAP_NODES];
+	struct topology_link links[TOPOLOGY_LINKS];
+	char *end;
+	long version;
+	int i, n;
+
+	version = strtol(line + 9, &end, 10);
+	if(end == line + 9 || version <= 0 || version > 255) {
+		printf("usage: channels <version>\n");
+		return;
+	}
+
+	netmap_report(&linkaddr_node_addr, 0, links, topology_snapshot(links, TOPOLOGY_LINKS));
+	netmap_update();
+	n = netmap_channels(plan, NETMAP_NODES);
+
+	for(i = 0; i < n; i++) {
+		printf("channel %d.%d %d\n", plan[i].addr.u8[0], plan[i].addr.u8[1], plan[i].channel);
+	}
+	if(!bulk_begin(BULK_KIND_CHANNELS, version, n * sizeof(plan[0])) ||
+			!bulk_append((uint8_t *)plan, n * sizeof(plan[0])) || !bulk_commit()) {
+		printf("channels: cannot send the plan\n");
+	}
+}
+
+/* "log <a>.<b> <offset>" fetches the log of a neighbor from offset on. */
+static void
+handle_log(const char *line)
+{
+	linkaddr_t addr;
+	char *end;
+	unsigned long offset;
+
+	addr.u8[0] = strtol(line + 4, &end, 10);
+	if(*end != '.') {
+		printf("usage: log <a>.<b> <offset>\n");
+		return;
+	}
+	addr.u8[1] = strtol(end + 1, &end, 10);
+	offset = strtoul(end, NULL, 10);
+
+	if(!logbuf_fetch(&addr, offset)) {
+		printf("log: an upload is already running\n");
+	}
+}
+
+PROCESS_THREAD(config_process, ev, data)
+{
+	static struct netconfig config;
+
+	PROCESS_EXITHANDLER(trickle_close(&trickle); bulk_close(); topology_close(); counters_close();)
+	PROCESS_BEGIN();
+
+	params_open(0);
+	netconfig_init();
+	trickle_open(&trickle, CLOCK_SECOND, NETCONFIG_CHANNEL, &trickle_callbacks);
+	bulk_open(NULL);
+	logbuf_open(&logbuf_callbacks);
+	topology_open(&topology_callbacks);
+	counters_open(&counters_callbacks);
+	ctimer_set(&map_timer, TOPOLOGY_INTERVAL, export_map, NULL);
+
+	while(1)
+	{
+		PROCESS_WAIT_EVENT_UNTIL(ev == serial_line_event_message);
+
+		if(strncmp((char *)data, "bulk ", 5) == 0) {
+			handle_bulk((char *)data);
+			continue;
+		}
+		if(strncmp((char *)data, "log ", 4) == 0) {
+			handle_log((char *)data);
+			continue;
+		}
+		if(strncmp((char *)data, "channels ", 9) == 0) {
+			handle_channels((char *)data);
+			continue;
+		}
+		if(counters_command((char *)data)) {
+			continue;
+		}
+		if(strcmp((char *)data, "map") == 0) {
+			export_map(NULL);
+			continue;
+		}
+		if(strcmp((char *)data, "export text") == 0 || strcmp((char *)data, "export binary") == 0) {
+			serialframe_flush();
+			export_binary = ((char *)data)[7] == 'b';
+			continue;
+		}
+
+		memset(&config, 0, sizeof(config));
+		if(strncmp((char *)data, "param net ", 10) == 0) {
+			if(!parse_param((char *)data, &config)) {
+				printf("usage: param net <name> <value>\n");
+				continue;
+			}
+		} else if(params_command((char *)data)) {
+			continue;
+		} else if(!parse_config((char *)data, &config)) {
+			printf("usage: config <interval> <deadband> <max_silence> [<threshold> <hysteresis>]...\n");
+			continue;
+		}
+
+		config.version = netconfig.version + 1;
+		if(!netconfig_apply(&config)) {
+			printf("configuration rejected\n");
+			continue;
+		}
+
+		// trickle keeps repeating it at a decaying rate until everybody has it
+		DLOG_INFO("basestation: disseminating configuration version %d\n", netconfig.version);
+		packetbuf_copyfrom(&netconfig, sizeof(netconfig));
+		trickle_send(&trickle);
+	}
+
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
@@ -45,6 +45,7 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "../dlog.h"
 #include <string.h>
 
 static struct mesh_conn mesh;
@@ -81,8 +82,8 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 		if(received_msg->data != address_base)
 		{
 			address_base = received_msg->data;
-			printf("base station addr: %d\n",address_base);
-			printf("actuator: broadcast to neighbors\n");
+			DLOG_INFO("base station addr: %d\n",address_base);
+			DLOG_INFO("actuator: broadcast to neighbors\n");
 			br_msg.type = BROADCAST_TYPE_DISCOVERY;
 			br_msg.data = address_base;
 			packetbuf_copyfrom(&br_msg, sizeof(br_msg));
@@ -95,13 +96,13 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 static void
 sent(struct mesh_conn *c)
 {
-  printf("packet sent\n");
+  DLOG_DBG("packet sent\n");
 }
 
 static void
 timedout(struct mesh_conn *c)
 {
-  printf("packet timedout\n");
+  DLOG_WARN("packet timedout\n");
 }
 
 static void
@@ -134,7 +135,7 @@ PROCESS_THREAD(basestation_process, ev, data)
   		linkaddr_t addr;
 		etimer_set(&dt, CLOCK_SECOND * 5+random_rand()%128);
 		PROCESS_WAIT_UNTIL(etimer_expired(&dt));
-		printf("sending packet with value: %s \n", msg);
+		DLOG_INFO("sending packet with value: %s \n", msg);
 		packetbuf_copyfrom(msg, strlen(msg)+1);
 	    addr.u8[0] = address_base;
 	    addr.u8[1] = linkaddr_node_addr.u8[1];
@@ -46,6 +46,7 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "../dlog.h"
 #include <string.h>
 
 static struct mesh_conn mesh;
@@ -83,13 +84,13 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 static void
 sent(struct mesh_conn *c)
 {
-  printf("packet sent\n");
+  DLOG_DBG("packet sent\n");
 }
 
 static void
 timedout(struct mesh_conn *c)
 {
-  printf("packet timedout\n");
+  DLOG_WARN("packet timedout\n");
 }
 
 static void
@@ -98,7 +99,7 @@ recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
   char * received_message;
   received_message = packetbuf_dataptr();
 
-  printf("Basestation: Data received from %d.%d with value: %s \n",
+  DLOG_INFO("Basestation: Data received from %d.%d with value: %s \n",
 	 from->u8[0], from->u8[1], received_message);
 
   //packetbuf_copyfrom(received_message, sizeof(received_message));
@@ -120,10 +121,10 @@ PROCESS_THREAD(basestation_process, ev, data)
 	etimer_set(&et, CLOCK_SECOND * 1);
 
 	PROCESS_WAIT_UNTIL(etimer_expired(&et));
-	printf("basestation: broadcast to neighbors\n");
+	DLOG_INFO("basestation: broadcast to neighbors\n");
 
 	PROCESS_WAIT_UNTIL(etimer_expired(&et));
-	printf("basestation: broadcast to neighbors\n");
+	DLOG_INFO("basestation: broadcast to neighbors\n");
 	br_msg.type = BROADCAST_TYPE_DISCOVERY;
 	br_msg.data = linkaddr_node_addr.u8[0];
 	packetbuf_copyfrom(&br_msg, sizeof(br_msg));
@@ -0,0 +1,380 @@
+/*
+ * bulk.c
+ *
+ * See bulk.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "net/rime/rudolph2.h"
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#include "lib/crc16.h"
+
+#include "bulk.h"
+#include "netconfig.h"
+#include "dlog.h"
+
+/* The transfer in progress, served to neighbors by rudolph2. */
+#define BULK_FILE "bulk.rx"
+
+/* Receive progress, so a reboot does not rewrite what is already in flash. */
+#define BULK_STATE_FILE "bulk.st"
+
+/* Progress is written back every this many bytes. */
+#define BULK_SYNC_BYTES 256
+
+/*
+ * Closes the state file and every installed artifact. Coffee takes the last
+ * byte that is not zero for the end of a file, and both may end in zeros.
+ */
+#define BULK_END 0x5a
+
+struct bulk_state
+{
+	struct bulk_header rx;
+	uint16_t received;	/* contiguous bytes of BULK_FILE, header included */
+};
+
+static struct rudolph2_conn rudolph2;
+static const struct bulk_callbacks *callbacks;
+static struct bulk_state state;
+static uint16_t synced;
+static uint8_t installed[BULK_KINDS];
+
+/* Basestation side. */
+static uint16_t tx_written;
+
+/*---------------------------------------------------------------------------*/
+static void
+installed_name(char *name, uint8_t kind)
+{
+	strcpy(name, "bulk.0");
+	name[5] += kind;
+}
+/*---------------------------------------------------------------------------*/
+static void
+save_state(void)
+{
+	uint8_t end = BULK_END;
+	int fd;
+
+	fd = cfs_open(BULK_STATE_FILE, CFS_WRITE);
+	if(fd < 0) {
+		return;
+	}
+	cfs_write(fd, &state, sizeof(state));
+	cfs_write(fd, &end, 1);
+	cfs_close(fd);
+	synced = state.received;
+}
+/*---------------------------------------------------------------------------*/
+static void
+load_state(void)
+{
+	uint8_t end;
+	int fd;
+
+	memset(&state, 0, sizeof(state));
+	fd = cfs_open(BULK_STATE_FILE, CFS_READ);
+	if(fd < 0) {
+		return;
+	}
+	if(cfs_read(fd, &state, sizeof(state)) != sizeof(state) ||
+	   cfs_read(fd, &end, 1) != 1 || end != BULK_END) {
+		memset(&state, 0, sizeof(state));
+	}
+	cfs_close(fd);
+	synced = state.received;
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+file_crc(int fd, uint16_t length)
+{
+	uint8_t buf[32];
+	uint16_t crc = 0;
+	int n;
+
+	while(length > 0) {
+		n = cfs_read(fd, buf, length < sizeof(buf) ? length : sizeof(buf));
+		if(n <= 0) {
+			break;
+		}
+		crc = crc16_data(buf, n, crc);
+		length -= n;
+	}
+	return crc;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Hands an installed artifact to the application. One that is not whole,
+ * as its length, crc and closing BULK_END tell, is ignored.
+ */
+static void
+announce(uint8_t kind)
+{
+	char name[8];
+	struct bulk_header h;
+	uint8_t end;
+	int fd;
+
+	installed_name(name, kind);
+	fd = cfs_open(name, CFS_READ);
+	if(fd < 0) {
+		return;
+	}
+
+	if(cfs_read(fd, &h, sizeof(h)) == sizeof(h) && h.kind == kind &&
+	   sizeof(h) + h.length <= BULK_MAX_SIZE && file_crc(fd, h.length) == h.crc &&
+	   cfs_read(fd, &end, 1) == 1 && end == BULK_END) {
+		cfs_seek(fd, sizeof(h), CFS_SEEK_SET);
+		installed[kind] = h.version;
+		if(callbacks != NULL && callbacks->installed != NULL) {
+			callbacks->installed(kind, h.version, fd, h.length);
+		}
+	}
+	cfs_close(fd);
+}
+/*---------------------------------------------------------------------------*/
+/* Checks the completed transfer and copies it under its kind. */
+static void
+install(void)
+{
+	struct bulk_header *h = &state.rx;
+	uint8_t buf[32];
+	char name[8];
+	int in, out, n;
+	uint16_t left;
+
+	if(!netconfig_newer(h->version, installed[h->kind])) {
+		DLOG_INFO("bulk: kind %d version %d is not newer, not installing\n", h->kind, h->version);
+		return;
+	}
+
+	in = cfs_open(BULK_FILE, CFS_READ);
+	if(in < 0) {
+		return;
+	}
+	cfs_seek(in, sizeof(*h), CFS_SEEK_SET);
+	if(file_crc(in, h->length) != h->crc) {
+		DLOG_WARN("bulk: kind %d version %d has a bad crc\n", h->kind, h->version);
+		cfs_close(in);
+		return;
+	}
+
+	installed_name(name, h->kind);
+	cfs_remove(name);
+	out = cfs_open(name, CFS_WRITE);
+	if(out < 0) {
+		cfs_close(in);
+		return;
+	}
+
+	cfs_seek(in, 0, CFS_SEEK_SET);
+	for(left = sizeof(*h) + h->length; left > 0; left -= n) {
+		n = cfs_read(in, buf, left < sizeof(buf) ? left : sizeof(buf));
+		if(n <= 0 || cfs_write(out, buf, n) != n) {
+			break;
+		}
+	}
+	buf[0] = BULK_END;
+	if(left == 0 && cfs_write(out, buf, 1) != 1) {
+		left = 1;
+	}
+	cfs_close(out);
+	cfs_close(in);
+
+	if(left == 0) {
+		DLOG_INFO("bulk: installed kind %d version %d, %u bytes\n", h->kind, h->version, h->length);
+		announce(h->kind);
+	} else {
+		cfs_remove(name);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_chunk(struct rudolph2_conn *c, int offset, int flag,
+	    uint8_t *data, int datalen)
+{
+	struct bulk_header h;
+	int fd;
+
+	if(flag == RUDOLPH2_FLAG_NEWFILE) {
+		if(datalen < sizeof(h)) {
+			return;
+		}
+		memcpy(&h, data, sizeof(h));
+
+		// A transfer we already hold part of: keep what is in flash.
+		if(memcmp(&h, &state.rx, sizeof(h)) != 0) {
+			memcpy(&state.rx, &h, sizeof(h));
+			state.received = 0;
+			save_state();
+		}
+	}
+
+	if(datalen > 0 && offset + datalen > state.received) {
+		fd = cfs_open(BULK_FILE, CFS_WRITE + CFS_APPEND);
+		if(fd < 0) {
+			return;
+		}
+		cfs_seek(fd, offset, CFS_SEEK_SET);
+		cfs_write(fd, data, datalen);
+		cfs_close(fd);
+
+		if(offset <= state.received) {
+			state.received = offset + datalen;
+		}
+		if(state.received - synced >= BULK_SYNC_BYTES) {
+			save_state();
+		}
+	}
+
+	if(flag == RUDOLPH2_FLAG_LASTCHUNK) {
+		save_state();
+		if(state.rx.kind < BULK_KINDS &&
+		   state.received >= sizeof(state.rx) + state.rx.length) {
+			install();
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_chunk(struct rudolph2_conn *c, int offset, uint8_t *to, int maxsize)
+{
+	int fd, ret;
+
+	if(offset >= state.received) {
+		return 0;
+	}
+	if(maxsize > state.received - offset) {
+		maxsize = state.received - offset;
+	}
+
+	fd = cfs_open(BULK_FILE, CFS_READ);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_seek(fd, offset, CFS_SEEK_SET);
+	ret = cfs_read(fd, to, maxsize);
+	cfs_close(fd);
+	if(ret < 0) {
+		return 0;
+	}
+	// after a reboot Coffee ends the file before the zeros it ended in
+	memset(to + ret, 0, maxsize - ret);
+	return maxsize;
+}
+/*---------------------------------------------------------------------------*/
+const static struct rudolph2_callbacks rudolph2_callbacks = {write_chunk, read_chunk};
+/*---------------------------------------------------------------------------*/
+void
+bulk_open(const struct bulk_callbacks *cb)
+{
+	uint8_t kind;
+
+	callbacks = cb;
+
+	// reserve the whole buffer up front, so Coffee never has to grow the file
+	cfs_coffee_reserve(BULK_FILE, BULK_MAX_SIZE);
+	load_state();
+
+	for(kind = 0; kind < BULK_KINDS; kind++) {
+		announce(kind);
+	}
+
+	rudolph2_open(&rudolph2, BULK_CHANNEL, &rudolph2_callbacks);
+}
+/*---------------------------------------------------------------------------*/
+void
+bulk_close(void)
+{
+	rudolph2_close(&rudolph2);
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+bulk_version(uint8_t kind)
+{
+	return kind < BULK_KINDS ? installed[kind] : 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+bulk_begin(uint8_t kind, uint8_t version, uint16_t length)
+{
+	int fd;
+
+	if(kind >= BULK_KINDS || sizeof(struct bulk_header) + length > BULK_MAX_SIZE) {
+		return 0;
+	}
+
+	rudolph2_stop(&rudolph2);
+
+	state.rx.kind = kind;
+	state.rx.version = version;
+	state.rx.length = length;
+	state.rx.crc = 0;
+	state.received = 0;
+
+	fd = cfs_open(BULK_FILE, CFS_WRITE);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_write(fd, &state.rx, sizeof(state.rx));
+	cfs_close(fd);
+
+	tx_written = 0;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+bulk_append(const uint8_t *data, uint16_t len)
+{
+	int fd;
+
+	if(tx_written + len > state.rx.length) {
+		return 0;
+	}
+
+	fd = cfs_open(BULK_FILE, CFS_WRITE + CFS_APPEND);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_seek(fd, sizeof(state.rx) + tx_written, CFS_SEEK_SET);
+	cfs_write(fd, data, len);
+	cfs_close(fd);
+
+	state.rx.crc = crc16_data(data, len, state.rx.crc);
+	tx_written += len;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+bulk_commit(void)
+{
+	int fd;
+
+	if(tx_written != state.rx.length) {
+		return 0;
+	}
+
+	// the header goes out last, now that the crc is known
+	fd = cfs_open(BULK_FILE, CFS_WRITE + CFS_APPEND);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_seek(fd, 0, CFS_SEEK_SET);
+	cfs_write(fd, &state.rx, sizeof(state.rx));
+	cfs_close(fd);
+
+	state.received = sizeof(state.rx) + state.rx.length;
+	save_state();
+
+	DLOG_INFO("bulk: sending kind %d version %d, %u bytes\n",
+			state.rx.kind, state.rx.version, state.rx.length);
+	rudolph2_send(&rudolph2, CLOCK_SECOND * 2);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
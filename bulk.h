@@ -0,0 +1,91 @@
+/*
+ * bulk.h
+ *
+ * Bulk dissemination of artifacts (slot tables, rule sets, calibration
+ * tables, channel plans) from the basestation to all actuators over rudolph2. An artifact
+ * is a bulk_header followed by the payload. Every node keeps the transfer
+ * in a flash-backed CFS file, so it can serve it to its own neighbors, and
+ * installs it under its kind once the CRC matches and the version is newer
+ * than the installed one. Installed artifacts survive a reboot.
+ */
+
+#ifndef BULK_H_
+#define BULK_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#define BULK_CHANNEL 142
+
+/* Largest artifact, header included. */
+#ifndef BULK_MAX_SIZE
+#define BULK_MAX_SIZE 1024
+#endif
+
+enum
+{
+	BULK_KIND_SLOTS,
+	BULK_KIND_RULES,
+	BULK_KIND_CALIBRATION,
+	BULK_KIND_CHANNELS,
+	BULK_KINDS
+};
+
+struct bulk_header
+{
+	uint8_t kind;
+	uint8_t version;
+	uint16_t length;	/* payload only */
+	uint16_t crc;		/* crc16 of the payload */
+};
+
+/* Payload of BULK_KIND_SLOTS: one entry per sensor. */
+struct bulk_slot
+{
+	linkaddr_t addr;
+	uint8_t slot;
+};
+
+/* Payload of BULK_KIND_CALIBRATION: value = raw * gain / 256 + offset. */
+struct bulk_calibration
+{
+	linkaddr_t addr;
+	int16_t offset;
+	int16_t gain;
+};
+
+/* Payload of BULK_KIND_CHANNELS: the data channel of every cluster head. */
+struct bulk_channel
+{
+	linkaddr_t addr;
+	uint8_t channel;
+};
+
+/* The payload of BULK_KIND_RULES is an array of struct rule, see rules.h. */
+
+struct bulk_callbacks
+{
+	/* An artifact was installed. fd is positioned at the payload and is closed by the caller. */
+	void (*installed)(uint8_t kind, uint8_t version, int fd, uint16_t length);
+};
+
+/*
+ * Starts the service. The callback is called right away for every artifact
+ * that was installed before the last reboot.
+ */
+void bulk_open(const struct bulk_callbacks *callbacks);
+void bulk_close(void);
+
+/* Installed version of kind, 0 if none. */
+uint8_t bulk_version(uint8_t kind);
+
+/*
+ * Basestation side: an artifact is written with bulk_begin(), any number of
+ * bulk_append() calls and bulk_commit(), which starts the dissemination.
+ * All return 1 on success.
+ */
+int bulk_begin(uint8_t kind, uint8_t version, uint16_t length);
+int bulk_append(const uint8_t *data, uint16_t len);
+int bulk_commit(void);
+
+#endif /* BULK_H_ */
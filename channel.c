@@ -0,0 +1,54 @@
+/*
+ * channel.c
+ *
+ * See channel.h.
+ */
+
+#include "contiki.h"
+#include "dev/cc2420/cc2420.h"
+
+#include "channel.h"
+#include "dlog.h"
+
+uint8_t channel_data = CHANNEL_CONTROL;
+
+static uint8_t current = CHANNEL_CONTROL;
+
+/*---------------------------------------------------------------------------*/
+void
+channel_set_data(uint8_t channel)
+{
+	uint8_t tuned = current == channel_data && channel_data != CHANNEL_CONTROL;
+
+	if(channel < CHANNEL_DATA_FIRST || channel > CHANNEL_DATA_LAST) {
+		channel = CHANNEL_CONTROL;
+	}
+	if(channel == channel_data) {
+		return;
+	}
+
+	DLOG_INFO("channel: data channel %d\n", channel);
+	channel_data = channel;
+
+	// a node in the middle of its data exchange follows the change
+	if(tuned) {
+		channel_select(channel_data);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+channel_select(uint8_t channel)
+{
+	if(channel == current) {
+		return;
+	}
+	cc2420_set_channel(channel);
+	current = channel;
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+channel_current(void)
+{
+	return current;
+}
+/*---------------------------------------------------------------------------*/
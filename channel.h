@@ -0,0 +1,36 @@
+/*
+ * channel.h
+ *
+ * Radio channels. Discovery, dissemination and the mesh to the basestation
+ * share CHANNEL_CONTROL. Every cluster exchanges readings and schedule
+ * replies on a data channel of its own, which the basestation allocates and
+ * hands out as a BULK_KIND_CHANNELS artifact, so clusters next to each
+ * other do not contend for the same medium. Until a cluster has a data
+ * channel its data stays on the control channel.
+ */
+
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#include "contiki.h"
+
+#ifndef CHANNEL_CONTROL
+#define CHANNEL_CONTROL 26
+#endif
+
+/* 802.15.4 channels handed out as data channels. */
+#define CHANNEL_DATA_FIRST 11
+#define CHANNEL_DATA_LAST 25
+
+/* Data channel of our cluster, CHANNEL_CONTROL if it has none. */
+extern uint8_t channel_data;
+
+/* Sets the data channel; anything outside the data range means none. */
+void channel_set_data(uint8_t channel);
+
+/* Tunes the radio to channel unless it already is. */
+void channel_select(uint8_t channel);
+
+uint8_t channel_current(void);
+
+#endif /* CHANNEL_H_ */
@@ -8,6 +8,7 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "../dlog.h"
 
 #define CHANNEL 135
 
@@ -87,7 +88,7 @@ recv(struct multihop_conn *c, const linkaddr_t *sender,
      const linkaddr_t *prevhop,
      uint8_t hops)
 {
-  printf("multihop message received '%s'\n", (char *)packetbuf_dataptr());
+  DLOG_INFO("multihop message received '%s'\n", (char *)packetbuf_dataptr());
 }
 /*
  * This function is called to forward a packet. The function picks a
@@ -115,7 +116,7 @@ forward(struct multihop_conn *c,
     	}
     	if(linkaddr_cmp(&(n->addr),dest)){
     		temp = n;
-    		printf("ID 1.0 found\n");
+    		DLOG_INFO("ID 1.0 found\n");
     		break;
 
     	}
@@ -123,14 +124,14 @@ forward(struct multihop_conn *c,
     }
     n = temp;
     if(n != NULL) {
-      printf("%d.%d: Forwarding packet to %d.%d (%d in list), hops %d\n",
+      DLOG_INFO("%d.%d: Forwarding packet to %d.%d (%d in list), hops %d\n",
 	     linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1],
 	     n->addr.u8[0], n->addr.u8[1], num,
 	     packetbuf_attr(PACKETBUF_ATTR_HOPS));
       return &n->addr;
     }
   }
-  printf("%d.%d: did not find a neighbor to foward to\n",
+  DLOG_WARN("%d.%d: did not find a neighbor to foward to\n",
 	 linkaddr_node_addr.u8[0], linkaddr_node_addr.u8[1]);
   return NULL;
 }
@@ -12,10 +12,15 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "contiki.h"
 #include "../mycommon.h"
+#include "../dlog.h"
+#include "../fwdqueue.h"
+#include "../trace.h"
 #include "net/rime/rime.h"
+#include "random.h"
 
 #include "lib/list.h"
 #include "lib/memb.h"
@@ -33,12 +38,26 @@
 #define MAX_NEIGHBORS 16
 #define NUM_HISTORY_ENTRIES 2
 
+/*
+ * Our own readings go out every SEND_INTERVAL. While a parent signals
+ * congestion the interval doubles every round up to SEND_INTERVAL_MAX, and
+ * once it is clear it shrinks back by SEND_INTERVAL each round.
+ */
+#define SEND_INTERVAL (CLOCK_SECOND * 10)
+#define SEND_INTERVAL_MAX (CLOCK_SECOND * 160)
+
+/* Our own readings carry a latency trace (see trace.h). */
+#ifndef TRACE_LATENCY
+#define TRACE_LATENCY 1
+#endif
+
 /*---------------------------------------------------------------------------*/
 
 
 PROCESS(actuator_cast_process, "actuator cast");
+PROCESS(forward_process, "forward");
 
-AUTOSTART_PROCESSES(&actuator_cast_process);
+AUTOSTART_PROCESSES(&actuator_cast_process, &forward_process);
 /*---------------------------------------------------------------------------*/
 
 /*
@@ -49,9 +68,16 @@ AUTOSTART_PROCESSES(&actuator_cast_process);
 struct runicast_message
 {
 	uint8_t type;
+	uint8_t priority;
 	int16_t data;
 	int16_t actuator_id;
 };
+/* A reading with MSG_TRACED set in its type has a trace appended. */
+struct traced_message
+{
+	struct runicast_message msg;
+	struct trace trace;
+};
 struct broadcast
 {
 	uint8_t type;
@@ -68,15 +94,20 @@ enum
 	BROADCAST_TYPE_DISCOVERY,
 	RUNICAST_TYPE_SCHEDULE,
 	RUNICAST_TYPE_TEMP,
-	RUNICAST_TYPE_HUMID
+	RUNICAST_TYPE_HUMID,
+	BROADCAST_TYPE_CONGESTION
 };
 
+/* Set in the type of everything a congested relay sends. */
+#define MSG_CONGESTED 0x80
+#define MSG_TRACED 0x40
+#define MSG_TYPE(type) ((type) & ~(MSG_CONGESTED | MSG_TRACED))
+
 linkaddr_t *daddy_addr = NULL;
 
 uint16_t time_delay;
 int16_t hop_id = 0;
 int16_t flag = 0;
-int16_t runicast_flag = 0;
 
 /*---------------------------------------------------------------------------*/
 /* This structure holds information about neighbors. */
@@ -87,6 +118,10 @@ struct neighbor {
 
   /* The ->addr field holds the Rime address of the neighbor. */
   linkaddr_t addr;
+
+  /* The ->congested field is set while the neighbor signals a full
+     forwarding queue. */
+  uint8_t congested;
 };
 struct history_entry {
   struct history_entry *next;
@@ -100,6 +135,56 @@ LIST(neighbors_list);
 static struct runicast_conn runicast;
 static struct broadcast_conn broadcast;
 
+/* Readings waiting to be forwarded, ours included. */
+static struct fwdqueue queue;
+static uint8_t announced_congestion;
+
+/* The parent the head of the queue goes to, and how many parents it has been offered to. */
+static struct neighbor *parent;
+static uint8_t head_attempts;
+
+/*---------------------------------------------------------------------------*/
+static uint8_t
+congestion_bit(void)
+{
+	return queue.congested ? MSG_CONGESTED : 0;
+}
+
+/* Tells the nodes that forward through us when our queue fills up or drains. */
+static void
+signal_congestion(void)
+{
+	struct broadcast br_msg;
+
+	if(queue.congested == announced_congestion) {
+		return;
+	}
+	announced_congestion = queue.congested;
+
+	DLOG_INFO("actuator: forwarding queue %s\n", queue.congested ? "congested" : "clear");
+	br_msg.type = BROADCAST_TYPE_CONGESTION | congestion_bit();
+	br_msg.data = queue.congested;
+	packetbuf_copyfrom(&br_msg, sizeof(br_msg));
+	broadcast_send(&broadcast);
+}
+
+static void
+enqueue(const struct runicast_message *msg, uint8_t len)
+{
+	int result;
+
+	// a newer reading of the same origin and type supersedes a queued one,
+	// and alarms overtake telemetry
+	result = fwdqueue_put(&queue, ((uint16_t)msg->actuator_id << 8) | MSG_TYPE(msg->type),
+			msg->priority, msg, len);
+	if(result == FWDQUEUE_DROPPED) {
+		DLOG_WARN("forwarding queue full, %d readings dropped\n", queue.dropped);
+	}
+
+	signal_congestion();
+	process_poll(&forward_process);
+}
+
 /*
  * now we define what to do on receiving, sending or timing out a runicast_msg or broadcast
  */
@@ -110,21 +195,37 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 	struct broadcast *received_msg = packetbuf_dataptr();
 	struct neighbor *n;
 	struct broadcast br_msg;
+
+	if(MSG_TYPE(received_msg->type) == BROADCAST_TYPE_CONGESTION)
+	{
+		for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+			if(linkaddr_cmp(&n->addr, from)) {
+				n->congested = received_msg->data;
+				DLOG_INFO("parent %d.%d %s\n", from->u8[0], from->u8[1],
+						n->congested ? "congested" : "clear");
+				break;
+			}
+		}
+		return;
+	}
+
 	//check if this is first time of discovery message
 	if(hop_id==0)
 	{
-		printf("new hop_id: %d",hop_id);
-		printf("actuator: broadcast to neighbors\n");
+		DLOG_INFO("new hop_id: %d",hop_id);
+		DLOG_INFO("actuator: broadcast to neighbors\n");
 		hop_id = received_msg->data + 1;
-		br_msg.type = BROADCAST_TYPE_DISCOVERY;
+		br_msg.type = BROADCAST_TYPE_DISCOVERY | congestion_bit();
 		br_msg.data = hop_id;
 		packetbuf_copyfrom(&br_msg, sizeof(br_msg));
 		broadcast_send(&broadcast);
 		flag = 1;
+		// the broadcast went out of packetbuf, so the received message is gone
+		return;
 	}
 	// add neighbor if broadcast hop_id is lower than its own hop_id
 	//
-	if(hop_id == (received_msg->data - 1))
+	if(hop_id == (received_msg->data + 1))
 	{
 		/* Check if we already know this neighbor. */
 		for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
@@ -143,18 +244,20 @@ recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
 		if(n == NULL) {
 			n = memb_alloc(&neighbors_memb);
 
-		/* If we could not allocate a new neighbor entry, we give up. We
-		   could have reused an old neighbor entry, but we do not do this
-		   for now. */
-		if(n == NULL) {
-			return;
-		}
+			/* If we could not allocate a new neighbor entry, we give up. We
+			   could have reused an old neighbor entry, but we do not do this
+			   for now. */
+			if(n == NULL) {
+				return;
+			}
 
-		/* Initialize the fields. */
-		linkaddr_copy(&n->addr, from);
+			/* Initialize the fields. */
+			linkaddr_copy(&n->addr, from);
 
-		/* Place the neighbor on the neighbor list. */
-		list_add(neighbors_list, n);
+			/* Place the neighbor on the neighbor list. */
+			list_add(neighbors_list, n);
+		}
+		n->congested = (received_msg->type & MSG_CONGESTED) != 0;
 	}
 }
 
@@ -190,44 +293,32 @@ recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
 		/* Detect duplicate callback */
 		if(e->seq == seqno)
 		{
-			printf("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
+			DLOG_DBG("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
 					from->u8[0], from->u8[1], seqno);
+			return;
 		}
 		/* Update existing history entry */
 		e->seq = seqno;
 	}
 
-	printf("Basestation: runicast message received from %d.%d, seqno %d\n",
+	DLOG_INFO("Basestation: runicast message received from %d.%d, seqno %d\n",
 			from->u8[0], from->u8[1], seqno);
-	int16_t k, j;
-	int nr_neighbors = list_length(neighbors_list);
 	struct runicast_message *received_msg = packetbuf_dataptr();
-	if (received_msg->type == (RUNICAST_TYPE_TEMP || RUNICAST_TYPE_HUMID))
+	uint8_t len = (received_msg->type & MSG_TRACED) ?
+			sizeof(struct traced_message) : sizeof(struct runicast_message);
+	if (packetbuf_datalen() != len)
 	{
-		if(nr_neighbors > 0)
-		{
-			  while ((runicast_flag != 1) && (k != nr_neighbors))
-			  {
-				  n = list_head(neighbors_list);
-				  for(j = 0; j < k; j++)
-				  {
-					  n = list_item_next(n);
-				  }
-				  k++;
-				  printf("transfer runicast to %d.%d with message %d\n", n->addr.u8[0], n->addr.u8[1], received_msg->data);
-				  packetbuf_copyfrom(&received_msg, sizeof(received_msg));
-				  runicast_send(c, &n->addr, MAX_RETRANSMISSIONS);
-			  }
-		}
-		else
-		{
-			printf("no neighbors found!\n");
-		}
-		runicast_flag = 0;
+		DLOG_WARN("runicast message of %d bytes, expected %d\n", packetbuf_datalen(), len);
+	}
+	else if (MSG_TYPE(received_msg->type) == RUNICAST_TYPE_TEMP ||
+	    MSG_TYPE(received_msg->type) == RUNICAST_TYPE_HUMID)
+	{
+		// forwarded from the queue, never straight out of the callback
+		enqueue(received_msg, len);
 	}
 	else
 	{
-		printf("I received a runicast message that was not for me!\n");
+		DLOG_WARN("I received a runicast message that was not for me!\n");
 	}
 }
 
@@ -235,52 +326,129 @@ static void
 sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
 
-	printf("runicast message sent to %d.%d, retransmissions %d\n",
+	DLOG_DBG("runicast message sent to %d.%d, retransmissions %d\n",
 			to->u8[0], to->u8[1], retransmissions);
-	runicast_flag = 1;
+	fwdqueue_pop(&queue);
+	head_attempts = 0;
+	signal_congestion();
+	process_poll(&forward_process);
 }
 
 static void
 timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
-	printf("runicast message timed out when sending to %d.%d, retransmissions %d\n",
+	DLOG_WARN("runicast message timed out when sending to %d.%d, retransmissions %d\n",
 			to->u8[0], to->u8[1], retransmissions);
-	runicast_flag = 2;
+
+	// offer it to the next parent, and give up once every parent failed
+	if(parent != NULL) {
+		parent = list_item_next(parent);
+	}
+	if(++head_attempts >= list_length(neighbors_list)) {
+		fwdqueue_pop(&queue);
+		queue.dropped++;
+		head_attempts = 0;
+		signal_congestion();
+	}
+	process_poll(&forward_process);
 }
 
 static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
 							     	 	 	 	 	 	 	 sent_runicast,
 															 timedout_runicast};
 /*-----------------------------------------------------------------------------------*/
+// Send the head of the queue whenever nothing is in flight.
+PROCESS_THREAD(forward_process, ev, data)
+{
+	struct fwdqueue_entry *e;
+	struct traced_message out;
+
+	PROCESS_BEGIN();
 
+	fwdqueue_init(&queue);
 
+	while(1)
+	{
+		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+
+		e = fwdqueue_head(&queue);
+		if(e == NULL || runicast_is_transmitting(&runicast))
+		{
+			continue;
+		}
+		if(list_length(neighbors_list) == 0)
+		{
+			DLOG_WARN("no neighbors found!\n");
+			continue;
+		}
+		if(parent == NULL)
+		{
+			parent = list_head(neighbors_list);
+		}
 
-PROCESS_THREAD(sensor_cast_process, ev, data)
+		// the entry stays as it arrived, so a retry to the next parent does
+		// not record this hop twice
+		memcpy(&out, e->data, e->len);
+		out.msg.type = (out.msg.type & ~MSG_CONGESTED) | congestion_bit();
+		if(out.msg.type & MSG_TRACED)
+		{
+			trace_depart(&out.trace, e->queued);
+		}
+		DLOG_INFO("transfer runicast to %d.%d with message %d\n",
+				parent->addr.u8[0], parent->addr.u8[1], out.msg.data);
+		packetbuf_copyfrom(&out, e->len);
+		runicast_send(&runicast, &parent->addr, MAX_RETRANSMISSIONS);
+	}
+	PROCESS_END();
+}
+/*-----------------------------------------------------------------------------------*/
+PROCESS_THREAD(actuator_cast_process, ev, data)
 {
 	PROCESS_EXITHANDLER(runicast_close(&runicast);)
 	PROCESS_BEGIN();
 
 	broadcast_open(&broadcast, 55, &broadcast_callbacks);
+	runicast_open(&runicast, 9, &runicast_callbacks);
 
 	//time_delay = 2 * (random_rand() % 8);
 
 	static struct etimer et;
-	struct runicast_message ru_msg;
+	static clock_time_t interval = SEND_INTERVAL;
+	struct traced_message ru_msg;
+	struct neighbor *n;
 
 
 	while(1)
 	{
-		etimer_set(&et, CLOCK_SECOND * 10+random_rand()%128);
+		etimer_set(&et, interval + random_rand()%128);
 		PROCESS_WAIT_UNTIL(etimer_expired(&et));
+
+		// back off while any parent is congested
+		for(n = list_head(neighbors_list); n != NULL && !n->congested; n = list_item_next(n));
+		if(n != NULL)
+		{
+			interval = interval * 2 < SEND_INTERVAL_MAX ? interval * 2 : SEND_INTERVAL_MAX;
+		}
+		else if(interval > SEND_INTERVAL)
+		{
+			interval -= SEND_INTERVAL;
+		}
+
 		switch(flag){
 		case 0:
 			break;
 		case 1:
-			ru_msg.type = RUNICAST_TYPE_TEMP;
-			ru_msg.data = 42;
-			ru_msg.actuator_id = random_rand()%9;
-			packetbuf_copyfrom(&ru_msg, sizeof(ru_msg));
-			runicast_send(&runicast_callbacks, &n->addr, MAX_RETRANSMISSIONS);
+			ru_msg.msg.type = RUNICAST_TYPE_TEMP;
+			ru_msg.msg.priority = PRIORITY_TELEMETRY;
+			ru_msg.msg.data = 42;
+			ru_msg.msg.actuator_id = linkaddr_node_addr.u8[0];
+#if TRACE_LATENCY
+			ru_msg.msg.type |= MSG_TRACED;
+			trace_start(&ru_msg.trace);
+			enqueue(&ru_msg.msg, sizeof(ru_msg));
+#else
+			enqueue(&ru_msg.msg, sizeof(ru_msg.msg));
+#endif
 			break;
 		default:
 			break;
@@ -288,6 +456,3 @@ PROCESS_THREAD(sensor_cast_process, ev, data)
 	}
 	PROCESS_END();
 }
-
-
-
@@ -15,6 +15,8 @@
 
 #include "contiki.h"
 #include "../mycommon.h"
+#include "../dlog.h"
+#include "../trace.h"
 #include "net/rime/rime.h"
 
 #include "lib/list.h"
@@ -32,6 +34,9 @@
 #define MAX_RETRANSMISSIONS 4
 #define NUM_HISTORY_ENTRIES 2
 
+/* The latency histograms are printed, and cleared, this often. */
+#define LATENCY_REPORT_INTERVAL 60
+
 /*---------------------------------------------------------------------------*/
 
 
@@ -48,9 +53,16 @@ AUTOSTART_PROCESSES(&sensor_cast_process);
 struct runicast_message
 {
 	uint8_t type;
+	uint8_t priority;
 	int16_t data;
 	int16_t actuator_id;
 };
+/* A reading with MSG_TRACED set in its type has a trace appended. */
+struct traced_message
+{
+	struct runicast_message msg;
+	struct trace trace;
+};
 struct broadcast
 {
 	uint8_t type;
@@ -70,6 +82,10 @@ enum
 	RUNICAST_TYPE_HUMID
 };
 
+#define MSG_CONGESTED 0x80
+#define MSG_TRACED 0x40
+#define MSG_TYPE(type) ((type) & ~(MSG_CONGESTED | MSG_TRACED))
+
 struct history_entry
 {
 	struct history_entry *next;
@@ -129,32 +145,40 @@ recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
 		/* Detect duplicate callback */
 		if(e->seq == seqno)
 		{
-			printf("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
+			DLOG_DBG("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
 					from->u8[0], from->u8[1], seqno);
 		}
 		/* Update existing history entry */
 		e->seq = seqno;
 	}
 
-	printf("Basestation: runicast message received from %d.%d, seqno %d\n",
+	DLOG_INFO("Basestation: runicast message received from %d.%d, seqno %d\n",
 			from->u8[0], from->u8[1], seqno);
 
 	struct runicast_message *received_msg = packetbuf_dataptr();
+	id = received_msg->actuator_id;
+	data = received_msg->data;
+
+	if((received_msg->type & MSG_TRACED) &&
+	   packetbuf_datalen() == sizeof(struct traced_message))
+	{
+		trace_record(id, &((struct traced_message *)received_msg)->trace);
+	}
 
-	if (received_msg->type == RUNICAST_TYPE_TEMP)
+	if (MSG_TYPE(received_msg->type) == RUNICAST_TYPE_TEMP)
 	{
 		time_delay = received_msg->data;
 
-		printf("Temperature from actuator %d has value %d",id,data)
+		DLOG_INFO("Temperature from actuator %d has value %d\n",id,data);
 	}
-	else if(received_msg->type == RUNICAST_TYPE_HUMID)
+	else if(MSG_TYPE(received_msg->type) == RUNICAST_TYPE_HUMID)
 	{
 		time_delay = received_msg->data;
-		printf("Humid from actuator %d has value %d",id,data)
+		DLOG_INFO("Humid from actuator %d has value %d\n",id,data);
 	}
 	else
 	{
-		printf("I received a runicast message that was not for me!\n");
+		DLOG_WARN("I received a runicast message that was not for me!\n");
 	}
 }
 
@@ -162,14 +186,14 @@ static void
 sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
 
-	printf("runicast message sent to %d.%d, retransmissions %d\n",
+	DLOG_DBG("runicast message sent to %d.%d, retransmissions %d\n",
 			to->u8[0], to->u8[1], retransmissions);
 }
 
 static void
 timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
-	printf("runicast message timed out when sending to %d.%d, retransmissions %d\n",
+	DLOG_WARN("runicast message timed out when sending to %d.%d, retransmissions %d\n",
 			to->u8[0], to->u8[1], retransmissions);
 }
 
@@ -200,7 +224,7 @@ PROCESS_THREAD(sensor_cast_process, ev, data)
 		etimer_set(&et, CLOCK_SECOND * 1);
 
 		PROCESS_WAIT_UNTIL(etimer_expired(&et));
-		printf("basestation: broadcast to neighbors\n");
+		DLOG_INFO("basestation: broadcast to neighbors\n");
 		br_msg.type = BROADCAST_TYPE_DISCOVERY;
 		br_msg.data = 1;
 		packetbuf_copyfrom(&br_msg, sizeof(br_msg));
@@ -209,8 +233,9 @@ PROCESS_THREAD(sensor_cast_process, ev, data)
 		runicast_open(&runicast, 9, &runicast_callbacks);
 		while(1)
 		{
-			etimer_set(&dt, CLOCK_SECOND*1);
+			etimer_set(&dt, CLOCK_SECOND * LATENCY_REPORT_INTERVAL);
 			PROCESS_WAIT_UNTIL(etimer_expired(&dt));
+			trace_report(1);
 		}
 
 	//}
@@ -46,6 +46,7 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
+#include "../dlog.h"
 static int flag = 0;
 /* This is the structure of broadcast messages. */
 struct broadcast_message {
@@ -131,7 +132,7 @@ broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
   rcv_bfr = (char *)packetbuf_dataptr();
   if((strcmp(rcv_bfr, Request)==0) && (flag == 0))
   {
-	     printf("broadcast message received from %d.%d: '%s'\n",
+	     DLOG_INFO("broadcast message received from %d.%d: '%s'\n",
 	    		 from->u8[0], from->u8[1], rcv_bfr);
          flag = 1;
   }
@@ -188,7 +189,7 @@ broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
 	  /* Remember last seqno we heard. */
 	  n->last_seqno = m->seqno;
 	  flag = 2;
-	  printf("flag 2 is triggered \n");
+	  DLOG_INFO("flag 2 is triggered \n");
   }
   rcv_bfr = "null";
 }
@@ -224,7 +225,7 @@ recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
   } else {
     /* Detect duplicate callback */
     if(e->seq == seqno) {
-      printf("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
+      DLOG_DBG("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
 	     from->u8[0], from->u8[1], seqno);
       return;
     }
@@ -239,7 +240,7 @@ recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
     /* Grab the pointer to the incoming data. */
     receive_msg = packetbuf_dataptr();
 
-  printf("runicast received with message %s\n",receive_msg);
+  DLOG_INFO("runicast received with message %s\n",receive_msg);
   /* We have two message types, UNICAST_TYPE_PING and
 	 UNICAST_TYPE_PONG. If we receive a UNICAST_TYPE_PING message, we
 	 print out a message and return a UNICAST_TYPE_PONG. */
@@ -258,13 +259,13 @@ static struct broadcast_conn broadcast;
 static void
 sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
-  printf("runicast message sent to %d.%d, retransmissions %d\n",
+  DLOG_DBG("runicast message sent to %d.%d, retransmissions %d\n",
 	 to->u8[0], to->u8[1], retransmissions);
 }
 static void
 timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
 {
-  printf("runicast message timed out when sending to %d.%d, retransmissions %d\n",
+  DLOG_WARN("runicast message timed out when sending to %d.%d, retransmissions %d\n",
 	 to->u8[0], to->u8[1], retransmissions);
 }
 static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
@@ -305,14 +306,14 @@ PROCESS_THREAD(example_broadcast_process, ev, data)
           //  n = list_item_next(n);
           //}          nr_tries++;
 
-          printf("sending runicast to %d.%d with message %s\n", n->addr.u8[0], n->addr.u8[1],message);
+          DLOG_INFO("sending runicast to %d.%d with message %s\n", n->addr.u8[0], n->addr.u8[1],message);
 
           //msg.type = UNICAST_TYPE_ACK;
           packetbuf_copyfrom(message, (strlen(message)+1));
           runicast_send(&runicast, &n->addr, MAX_RETRANSMISSIONS);
 /*          packetbuf_copyfrom("address", 8);
 		  broadcast_send(&broadcast);
-		  printf("broadcast to actuator sent\n");*/
+		  DLOG_INFO("broadcast to actuator sent\n");*/
           flag = 4;
 	  break;
 	  case 3:
@@ -0,0 +1,323 @@
+/*
+ * cluster.c
+ *
+ * See cluster.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "lib/list.h"
+#include "lib/memb.h"
+#include "random.h"
+#include "sys/energest.h"
+
+#include "cluster.h"
+#include "netmux.h"
+#include "counters.h"
+#include "params.h"
+#include "dlog.h"
+
+/*
+ * Announcement: the energy of the sender and the head it belongs to, its
+ * own address if it is head, the successor right after a handover and
+ * zero if it has none.
+ */
+struct announcement
+{
+	uint16_t energy;
+	uint8_t head[2];
+};
+
+struct peer
+{
+	struct peer *next;
+	linkaddr_t addr;
+	uint16_t energy;
+	uint8_t is_head;
+	uint8_t age;
+};
+
+MEMB(peers_memb, struct peer, CLUSTER_PEERS);
+LIST(peers);
+
+static struct ctimer round_timer;
+static const struct cluster_callbacks *callbacks;
+
+static linkaddr_t head;
+static uint8_t have_head, handing_over;
+
+/* Supply current per Energest state of a sky in microamps. */
+static const uint16_t current_ua[] = {
+	[ENERGEST_TYPE_CPU] = 1800,
+	[ENERGEST_TYPE_LPM] = 55,
+	[ENERGEST_TYPE_TRANSMIT] = 17700,
+	[ENERGEST_TYPE_LISTEN] = 20000,
+};
+
+/*---------------------------------------------------------------------------*/
+uint16_t
+cluster_energy(void)
+{
+	static unsigned long last[sizeof(current_ua) / sizeof(current_ua[0])];
+	static unsigned long long charge;	/* microamp rtimer ticks */
+	unsigned long now, used_mj;
+	uint8_t type;
+
+	// the Energest counters wrap, so only the differences are summed up
+	energest_flush();
+	for(type = 0; type < sizeof(current_ua) / sizeof(current_ua[0]); type++) {
+		now = energest_type_time(type);
+		charge += (unsigned long long)(now - last[type]) * current_ua[type];
+		last[type] = now;
+	}
+
+	used_mj = charge / RTIMER_SECOND * CLUSTER_VOLTAGE_MV / 1000000UL;
+	if(used_mj >= CLUSTER_BATTERY_MJ) {
+		return 0;
+	}
+	return (unsigned long long)(CLUSTER_BATTERY_MJ - used_mj) * CLUSTER_ENERGY_FULL / CLUSTER_BATTERY_MJ;
+}
+/*---------------------------------------------------------------------------*/
+int
+cluster_is_head(void)
+{
+	return have_head && linkaddr_cmp(&head, &linkaddr_node_addr);
+}
+/*---------------------------------------------------------------------------*/
+const linkaddr_t *
+cluster_head(void)
+{
+	return have_head ? &head : NULL;
+}
+/*---------------------------------------------------------------------------*/
+static void
+join(const linkaddr_t *addr)
+{
+	if(have_head && linkaddr_cmp(&head, addr)) {
+		return;
+	}
+	linkaddr_copy(&head, addr);
+	have_head = 1;
+	DLOG_INFO("cluster: head %d.%d\n", head.u8[0], head.u8[1]);
+	if(callbacks != NULL) {
+		callbacks->joined(&head);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+announce(void)
+{
+	struct announcement a;
+
+	a.energy = cluster_energy();
+	a.head[0] = have_head ? head.u8[0] : 0;
+	a.head[1] = have_head ? head.u8[1] : 0;
+	packetbuf_copyfrom(&a, sizeof(a));
+	netmux_broadcast(NETMUX_TYPE_CLUSTER);
+}
+/*---------------------------------------------------------------------------*/
+/* 1 if a has more energy than b, the lower address winning a tie. */
+static int
+better(uint16_t a_energy, const linkaddr_t *a, uint16_t b_energy, const linkaddr_t *b)
+{
+	if(a_energy != b_energy) {
+		return a_energy > b_energy;
+	}
+	return a->u8[0] != b->u8[0] ? a->u8[0] < b->u8[0] : a->u8[1] < b->u8[1];
+}
+/*---------------------------------------------------------------------------*/
+static void
+hand_over(struct peer *successor)
+{
+	uint8_t buf[CLUSTER_STATE_MAX];
+	int len = 0;
+
+	if(netmux_is_transmitting()) {
+		return;
+	}
+	if(callbacks != NULL) {
+		len = callbacks->save(buf, sizeof(buf));
+	}
+
+	DLOG_INFO("cluster: handing over to %d.%d, %d bytes of state\n",
+			successor->addr.u8[0], successor->addr.u8[1], len);
+	packetbuf_copyfrom(buf, len);
+	handing_over = netmux_unicast(NETMUX_TYPE_HANDOVER, &successor->addr, PARAM(PARAM_MAX_RETRANSMISSIONS));
+}
+/*---------------------------------------------------------------------------*/
+static void
+decide(void)
+{
+	struct peer *p, *best = NULL, *best_head = NULL;
+	uint16_t energy = cluster_energy();
+
+	for(p = list_head(peers); p != NULL; p = list_item_next(p)) {
+		if(best == NULL || better(p->energy, &p->addr, best->energy, &best->addr)) {
+			best = p;
+		}
+		if(p->is_head && (best_head == NULL ||
+				better(p->energy, &p->addr, best_head->energy, &best_head->addr))) {
+			best_head = p;
+		}
+	}
+
+	if(cluster_is_head()) {
+		// rotate once somebody has clearly more energy left than we do
+		if(!handing_over && best != NULL && best->energy > energy + CLUSTER_MARGIN) {
+			hand_over(best);
+		}
+		return;
+	}
+	if(have_head) {
+		return;
+	}
+
+	if(best_head != NULL) {
+		join(&best_head->addr);
+	} else if(best == NULL || better(energy, &linkaddr_node_addr, best->energy, &best->addr)) {
+		// nobody around leads yet and we are the best placed to
+		join(&linkaddr_node_addr);
+		announce();
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+round_expired(void *ptr)
+{
+	struct peer *p, *next;
+
+	ctimer_set(&round_timer, CLUSTER_ROUND - CLUSTER_ROUND / 4 + random_rand() % (CLUSTER_ROUND / 2),
+			round_expired, NULL);
+
+	for(p = list_head(peers); p != NULL; p = next) {
+		next = list_item_next(p);
+		if(++p->age > CLUSTER_MAX_AGE) {
+			// a head that went silent is given up on
+			if(have_head && linkaddr_cmp(&p->addr, &head)) {
+				have_head = 0;
+			}
+			list_remove(peers, p);
+			memb_free(&peers_memb, p);
+		}
+	}
+
+	decide();
+	announce();
+}
+/*---------------------------------------------------------------------------*/
+static struct peer *
+find(const linkaddr_t *addr)
+{
+	struct peer *p, *weakest = NULL;
+
+	for(p = list_head(peers); p != NULL; p = list_item_next(p)) {
+		if(linkaddr_cmp(&p->addr, addr)) {
+			return p;
+		}
+		if(weakest == NULL || p->energy < weakest->energy) {
+			weakest = p;
+		}
+	}
+
+	p = memb_alloc(&peers_memb);
+	if(p == NULL) {
+		COUNTERS_INC(COUNTERS_NEIGHBORS, COUNTER_POOL_FULL);
+		list_remove(peers, weakest);
+		p = weakest;
+	}
+	linkaddr_copy(&p->addr, addr);
+	list_add(peers, p);
+	return p;
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_announcement(const linkaddr_t *from)
+{
+	struct announcement a;
+	struct peer *p;
+	linkaddr_t their_head;
+
+	if(packetbuf_datalen() != sizeof(a)) {
+		return;
+	}
+	memcpy(&a, packetbuf_dataptr(), sizeof(a));
+	their_head.u8[0] = a.head[0];
+	their_head.u8[1] = a.head[1];
+
+	p = find(from);
+	p->energy = a.energy;
+	p->is_head = linkaddr_cmp(&their_head, from);
+	p->age = 0;
+
+	if(have_head && linkaddr_cmp(&head, from) && !p->is_head) {
+		// our head resigned: follow it to its successor, who has our slots
+		if(linkaddr_cmp(&their_head, &linkaddr_null)) {
+			have_head = 0;
+		} else {
+			join(&their_head);
+		}
+		return;
+	}
+	if(!have_head && p->is_head) {
+		join(from);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_handover(const linkaddr_t *from)
+{
+	DLOG_INFO("cluster: taking over from %d.%d\n", from->u8[0], from->u8[1]);
+	if(callbacks != NULL) {
+		callbacks->load(packetbuf_dataptr(), packetbuf_datalen());
+	}
+	join(&linkaddr_node_addr);
+	announce();
+}
+/*---------------------------------------------------------------------------*/
+static void
+sent_handover(const linkaddr_t *to, uint8_t retransmissions)
+{
+	// the successor has the state; our announcement sends the members to it
+	handing_over = 0;
+	join(to);
+	announce();
+}
+/*---------------------------------------------------------------------------*/
+static void
+timedout_handover(const linkaddr_t *to, uint8_t retransmissions)
+{
+	DLOG_WARN("cluster: handover to %d.%d failed, staying head\n", to->u8[0], to->u8[1]);
+	handing_over = 0;
+}
+/*---------------------------------------------------------------------------*/
+static const struct netmux_handler announcement_handler = {recv_announcement, NULL, NULL, NULL};
+static const struct netmux_handler handover_handler = {NULL, recv_handover,
+		sent_handover, timedout_handover};
+/*---------------------------------------------------------------------------*/
+void
+cluster_open(const struct cluster_callbacks *cb)
+{
+	callbacks = cb;
+	have_head = handing_over = 0;
+	memb_init(&peers_memb);
+	list_init(peers);
+	netmux_open();
+	netmux_register(NETMUX_TYPE_CLUSTER, &announcement_handler);
+	netmux_register(NETMUX_TYPE_HANDOVER, &handover_handler);
+
+	// the first round only listens, so a head that is already there is found
+	cluster_energy();
+	ctimer_set(&round_timer, CLUSTER_ROUND / 4 + random_rand() % (CLUSTER_ROUND / 4),
+			round_expired, NULL);
+}
+/*---------------------------------------------------------------------------*/
+void
+cluster_close(void)
+{
+	ctimer_stop(&round_timer);
+	netmux_register(NETMUX_TYPE_CLUSTER, NULL);
+	netmux_register(NETMUX_TYPE_HANDOVER, NULL);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,76 @@
+/*
+ * cluster.h
+ *
+ * Cluster formation for deployments without actuators. Every node
+ * announces its residual energy, estimated from Energest, once per
+ * CLUSTER_ROUND. A node becomes cluster head when no neighbor it hears has
+ * more energy left and no head is around, and the other nodes join the
+ * head they hear. A head hands the role over to a neighbor with
+ * CLUSTER_MARGIN more energy than itself, so it rotates as heads drain
+ * without flapping between nodes with about the same energy.
+ *
+ * A handover passes the schedule state of the old head (its slot table,
+ * say) to the new one over runicast. The old head only resigns once the
+ * new one has acknowledged it, and its resignation names its successor, so
+ * the members keep their slots and simply send to the new head from then
+ * on.
+ *
+ * Announcements and handovers go over netmux.h. The energy estimate needs
+ * Energest, which the sky platform has on.
+ */
+
+#ifndef CLUSTER_H_
+#define CLUSTER_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#ifndef CLUSTER_ROUND
+#define CLUSTER_ROUND (CLOCK_SECOND * 300)
+#endif
+
+/* Usable energy of a fresh battery, two AA cells. */
+#ifndef CLUSTER_BATTERY_MJ
+#define CLUSTER_BATTERY_MJ 20000000UL
+#endif
+
+#define CLUSTER_VOLTAGE_MV 3000
+
+/* Energy is counted in ten-thousandths of a full battery. */
+#define CLUSTER_ENERGY_FULL 10000
+
+#ifndef CLUSTER_MARGIN
+#define CLUSTER_MARGIN 100
+#endif
+
+/* Neighbors tracked, and rounds a silent one is kept. */
+#define CLUSTER_PEERS 8
+#define CLUSTER_MAX_AGE 3
+
+/* Largest schedule state a handover carries. */
+#define CLUSTER_STATE_MAX 96
+
+struct cluster_callbacks
+{
+	/* We joined head, which is our own address when we became head. */
+	void (*joined)(const linkaddr_t *head);
+
+	/* Handover: the old head writes its schedule state to buf and returns its length. */
+	int (*save)(uint8_t *buf, int max);
+
+	/* Handover: the new head takes over the state of the old one. */
+	void (*load)(const uint8_t *buf, int len);
+};
+
+void cluster_open(const struct cluster_callbacks *callbacks);
+void cluster_close(void);
+
+/* Residual energy in ten-thousandths of CLUSTER_BATTERY_MJ. */
+uint16_t cluster_energy(void);
+
+int cluster_is_head(void);
+
+/* The head we belong to, our own address if we are head, NULL if none yet. */
+const linkaddr_t *cluster_head(void);
+
+#endif /* CLUSTER_H_ */
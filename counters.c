@@ -0,0 +1,165 @@
+/*
+ * counters.c
+ *
+ * See counters.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "net/rime/mesh.h"
+#include "dev/serial-line.h"
+#include "random.h"
+
+#include "counters.h"
+#include "topology.h"
+
+uint16_t counters[COUNTERS_MODULES][COUNTER_KINDS];
+
+static const char *const module_names[COUNTERS_MODULES] = {
+	"netmux", "fwdqueue", "neighbors", "topology"
+};
+
+static struct mesh_conn mesh;
+static struct ctimer report_timer;
+static const struct counters_callbacks *callbacks;
+static uint8_t seqno;
+
+PROCESS(counters_process, "counters");
+
+/*---------------------------------------------------------------------------*/
+void
+counters_dump(void)
+{
+	uint8_t m;
+
+	printf("counters: rx tx retries timeouts pool-full duplicates dropped\n");
+	for(m = 0; m < COUNTERS_MODULES; m++) {
+		printf("counters %s: %u %u %u %u %u %u %u\n", module_names[m],
+				counters[m][COUNTER_RX], counters[m][COUNTER_TX],
+				counters[m][COUNTER_RETRIES], counters[m][COUNTER_TIMEOUTS],
+				counters[m][COUNTER_POOL_FULL], counters[m][COUNTER_DUPLICATES],
+				counters[m][COUNTER_DROPPED]);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+counters_reset(void)
+{
+	memset(counters, 0, sizeof(counters));
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_report(void)
+{
+	uint8_t *buf;
+	uint8_t m, k;
+	linkaddr_t sink;
+
+	packetbuf_clear();
+	buf = packetbuf_dataptr();
+	*buf++ = seqno++;
+	*buf++ = COUNTERS_MODULES;
+	*buf++ = COUNTER_KINDS;
+	for(m = 0; m < COUNTERS_MODULES; m++) {
+		for(k = 0; k < COUNTER_KINDS; k++) {
+			*buf++ = counters[m][k] & 0xff;
+			*buf++ = counters[m][k] >> 8;
+		}
+	}
+	packetbuf_set_datalen(COUNTERS_REPORT_HEADER + sizeof(counters));
+
+	sink.u8[0] = TOPOLOGY_SINK_0;
+	sink.u8[1] = TOPOLOGY_SINK_1;
+	mesh_send(&mesh, &sink);
+}
+/*---------------------------------------------------------------------------*/
+static void
+report_tick(void *ptr)
+{
+	ctimer_set(&report_timer, COUNTERS_INTERVAL / 2 + random_rand() % COUNTERS_INTERVAL,
+			report_tick, NULL);
+	send_report();
+}
+/*---------------------------------------------------------------------------*/
+int
+counters_command(const char *line)
+{
+	if(strcmp(line, "counters") == 0) {
+		counters_dump();
+	} else if(strcmp(line, "counters reset") == 0) {
+		counters_reset();
+	} else if(strcmp(line, "counters report") == 0) {
+		if(callbacks == NULL) {
+			send_report();
+		}
+	} else {
+		return 0;
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
+{
+	uint8_t *buf = packetbuf_dataptr();
+
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_RX);
+	if(callbacks == NULL || packetbuf_datalen() < COUNTERS_REPORT_HEADER) {
+		return;
+	}
+	if(packetbuf_datalen() != COUNTERS_REPORT_HEADER + buf[1] * buf[2] * 2) {
+		return;
+	}
+	callbacks->report(from, hops, buf + COUNTERS_REPORT_HEADER, buf[1], buf[2]);
+}
+/*---------------------------------------------------------------------------*/
+static void
+sent(struct mesh_conn *c)
+{
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_TX);
+}
+/*---------------------------------------------------------------------------*/
+static void
+timedout(struct mesh_conn *c)
+{
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_TIMEOUTS);
+}
+/*---------------------------------------------------------------------------*/
+static const struct mesh_callbacks mesh_callbacks = {recv, sent, timedout};
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(counters_process, ev, data)
+{
+	PROCESS_BEGIN();
+
+	while(1) {
+		PROCESS_WAIT_EVENT_UNTIL(ev == serial_line_event_message);
+		counters_command((char *)data);
+	}
+
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+counters_open(const struct counters_callbacks *cb)
+{
+	callbacks = cb;
+	mesh_open(&mesh, COUNTERS_CHANNEL, &mesh_callbacks);
+
+	if(callbacks == NULL) {
+		ctimer_set(&report_timer, COUNTERS_INTERVAL / 2 + random_rand() % COUNTERS_INTERVAL,
+				report_tick, NULL);
+		process_start(&counters_process, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+counters_close(void)
+{
+	ctimer_stop(&report_timer);
+	process_exit(&counters_process);
+	mesh_close(&mesh);
+}
+/*---------------------------------------------------------------------------*/
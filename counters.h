@@ -0,0 +1,78 @@
+/*
+ * counters.h
+ *
+ * Event counters per module: frames received and sent, retransmissions,
+ * timeouts, allocations that found the pool empty, duplicates and frames
+ * dropped for other reasons. Counting is an increment of a static array,
+ * cheap enough for receive callbacks. Counters wrap at 65535.
+ *
+ * Every node answers "counters" on its serial line with a dump, "counters
+ * reset" by clearing them and "counters report" by sending them upstream
+ * right away. Otherwise they go to the sink every COUNTERS_INTERVAL over
+ * mesh, like the topology reports.
+ */
+
+#ifndef COUNTERS_H_
+#define COUNTERS_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+/* mesh uses this channel and the two after it */
+#define COUNTERS_CHANNEL 153
+
+#ifndef COUNTERS_INTERVAL
+#define COUNTERS_INTERVAL (CLOCK_SECOND * 300)
+#endif
+
+enum
+{
+	COUNTERS_NETMUX,	/* single-hop frames, see netmux.h */
+	COUNTERS_FWDQUEUE,	/* packets waiting for the radio, see fwdqueue.h */
+	COUNTERS_NEIGHBORS,	/* neighbor and link tables */
+	COUNTERS_TOPOLOGY,	/* mesh reports to the sink */
+	COUNTERS_MODULES
+};
+
+enum
+{
+	COUNTER_RX,
+	COUNTER_TX,
+	COUNTER_RETRIES,
+	COUNTER_TIMEOUTS,
+	COUNTER_POOL_FULL,
+	COUNTER_DUPLICATES,
+	COUNTER_DROPPED,
+	COUNTER_KINDS
+};
+
+/* Report: seqno (1) | modules (1) | kinds (1) | modules x kinds values (2) */
+#define COUNTERS_REPORT_HEADER 3
+
+extern uint16_t counters[COUNTERS_MODULES][COUNTER_KINDS];
+
+#define COUNTERS_INC(module, kind) (counters[module][kind]++)
+#define COUNTERS_ADD(module, kind, n) (counters[module][kind] += (n))
+
+struct counters_callbacks
+{
+	/* A report arrived at the sink; values are little-endian, row by module. */
+	void (*report)(const linkaddr_t *from, uint8_t hops,
+			const uint8_t *values, uint8_t modules, uint8_t kinds);
+};
+
+/*
+ * Opens the reporting. The sink passes callbacks and runs the commands
+ * from its own shell with counters_command(); everybody else passes NULL
+ * and gets the commands on its serial line.
+ */
+void counters_open(const struct counters_callbacks *callbacks);
+void counters_close(void);
+
+/* Runs a "counters" command. Returns 0 if the line is not one. */
+int counters_command(const char *line);
+
+void counters_dump(void);
+void counters_reset(void);
+
+#endif /* COUNTERS_H_ */
@@ -0,0 +1,89 @@
+/*
+ * deadband.c
+ *
+ * See deadband.h.
+ */
+
+#include "contiki.h"
+#include "deadband.h"
+#include "netconfig.h"
+
+/*---------------------------------------------------------------------------*/
+void
+deadband_filter_init(struct deadband_filter *f)
+{
+	f->last_sent = 0;
+	f->silent_ticks = 0;
+	f->primed = 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+deadband_filter_check(struct deadband_filter *f, int16_t value)
+{
+#if REPORT_MODE == REPORT_MODE_PERIODIC
+	f->last_sent = value;
+	f->primed = 1;
+	return 1;
+#else
+	int16_t diff = value - f->last_sent;
+	if(diff < 0) diff = -diff;
+
+	// always send the first reading and whenever the heartbeat is due
+	if(!f->primed || diff > netconfig.deadband || f->silent_ticks + 1 >= netconfig.max_silence)
+	{
+		f->last_sent = value;
+		f->silent_ticks = 0;
+		f->primed = 1;
+		return 1;
+	}
+
+	f->silent_ticks++;
+	return 0;
+#endif
+}
+/*---------------------------------------------------------------------------*/
+void
+deadband_track_init(struct deadband_track *t)
+{
+	t->value = 0;
+	t->updated = 0;
+	t->valid = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+deadband_track_update(struct deadband_track *t, int16_t value)
+{
+	t->value = value;
+	t->updated = clock_seconds();
+	t->valid = 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+deadband_track_get(const struct deadband_track *t, int16_t *value)
+{
+	// in seconds, as clock_time() wraps within a few heartbeats
+	uint32_t interval = netconfig.time_interval;
+	uint32_t age;
+
+	if(!t->valid)
+	{
+		return DEADBAND_EMPTY;
+	}
+
+	*value = t->value;
+	age = clock_seconds() - t->updated;
+
+	if(age < interval)
+	{
+		return DEADBAND_FRESH;
+	}
+
+	// allow one extra interval of slack before giving up on the held value
+	if(age <= interval * (netconfig.max_silence + 1UL))
+	{
+		return DEADBAND_HELD;
+	}
+
+	return DEADBAND_STALE;
+}
+/*---------------------------------------------------------------------------*/
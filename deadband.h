@@ -0,0 +1,77 @@
+/*
+ * deadband.h
+ *
+ * Event-triggered (dead-band) reporting. A sensor only transmits a reading
+ * when it leaves the dead-band around the last reported value, or when
+ * REPORT_MAX_SILENCE schedule ticks have passed without a report
+ * (heartbeat). The actuator keeps the last reported value per sensor and
+ * holds it until the next report, so the series can be rebuilt from the
+ * reports alone.
+ */
+
+#ifndef DEADBAND_H_
+#define DEADBAND_H_
+
+#include "contiki.h"
+
+#define REPORT_MODE_PERIODIC 0
+#define REPORT_MODE_DEADBAND 1
+
+#ifndef REPORT_MODE
+#define REPORT_MODE REPORT_MODE_DEADBAND
+#endif
+
+/*
+ * Defaults for the dead-band and the heartbeat. At runtime the values from
+ * netconfig.h are used, so they can be changed from the basestation.
+ */
+
+/* A reading must move more than this from the last reported value. */
+#ifndef REPORT_DEADBAND
+#define REPORT_DEADBAND 1
+#endif
+
+/* Heartbeat: report at least every REPORT_MAX_SILENCE schedule ticks. */
+#ifndef REPORT_MAX_SILENCE
+#define REPORT_MAX_SILENCE 10
+#endif
+
+/* Sensor side: decides per tick whether a reading has to go out. */
+struct deadband_filter
+{
+	int16_t last_sent;
+	uint8_t silent_ticks;
+	uint8_t primed;
+};
+
+/* Actuator side: last reported value of one sensor. */
+struct deadband_track
+{
+	int16_t value;
+	uint32_t updated;	/* clock_seconds() of the last report */
+	uint8_t valid;
+};
+
+enum
+{
+	DEADBAND_EMPTY,		/* nothing received yet */
+	DEADBAND_FRESH,		/* reported in the current tick */
+	DEADBAND_HELD,		/* unchanged since the last report */
+	DEADBAND_STALE		/* heartbeat missed, the held value is not trusted */
+};
+
+void deadband_filter_init(struct deadband_filter *f);
+
+/* Returns 1 if value has to be sent this tick, 0 if it can be suppressed. */
+int deadband_filter_check(struct deadband_filter *f, int16_t value);
+
+void deadband_track_init(struct deadband_track *t);
+void deadband_track_update(struct deadband_track *t, int16_t value);
+
+/*
+ * Reconstructs the value of the series at the current time, holding the
+ * last report. Returns one of the DEADBAND_* states above.
+ */
+int deadband_track_get(const struct deadband_track *t, int16_t *value);
+
+#endif /* DEADBAND_H_ */
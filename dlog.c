@@ -0,0 +1,163 @@
+/*
+ * dlog.c
+ *
+ * See dlog.h. Every record in the ring is preceded by its length, and
+ * frames carry records in the same form.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "contiki.h"
+
+#include "dlog.h"
+#include "serialframe.h"
+
+/* count, format address and every argument as a five byte varint or a string */
+#define DLOG_RECORD_MAX (1 + 5 + DLOG_ARGS_MAX * (1 + DLOG_STRING_MAX))
+
+static uint8_t ring[DLOG_RING_SIZE];
+static volatile uint16_t head, tail;
+
+uint16_t dlog_dropped;
+
+PROCESS(dlog_process, "dlog");
+
+/*---------------------------------------------------------------------------*/
+static int
+put_varint(uint8_t *p, unsigned long v)
+{
+	int n = 0;
+
+	while(v >= 0x80) {
+		p[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the conversion character of the next directive of fmt, or 0. */
+static char
+next_conversion(const char **fmt)
+{
+	const char *p = *fmt;
+
+	for(;;) {
+		while(*p != '\0' && *p != '%') {
+			p++;
+		}
+		if(*p == '\0') {
+			*fmt = p;
+			return 0;
+		}
+		p++;
+		if(*p == '%') {
+			p++;
+			continue;
+		}
+		while(*p != '\0' && strchr("-+ #0123456789.hlzjt", *p) != NULL) {
+			p++;
+		}
+		*fmt = *p != '\0' ? p + 1 : p;
+		return *p;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+used(void)
+{
+	return (head - tail + DLOG_RING_SIZE) % DLOG_RING_SIZE;
+}
+/*---------------------------------------------------------------------------*/
+void
+dlog_write(const char *fmt, uint8_t n, ...)
+{
+	uint8_t rec[1 + DLOG_RECORD_MAX];
+	const char *p = fmt, *s;
+	unsigned long v;
+	uint8_t len = 1, i, k;
+	va_list ap;
+
+	if(!process_is_running(&dlog_process)) {
+		process_start(&dlog_process, NULL);
+	}
+
+	rec[len++] = n;
+	len += put_varint(rec + len, (uintptr_t)fmt);
+
+	va_start(ap, n);
+	for(i = 0; i < n; i++) {
+		v = va_arg(ap, long);
+		if(next_conversion(&p) == 's') {
+			s = (const char *)(uintptr_t)v;
+			for(k = 0; s != NULL && s[k] != '\0' && k < DLOG_STRING_MAX; k++) {
+				rec[len + 1 + k] = s[k];
+			}
+			rec[len] = k;
+			len += 1 + k;
+		} else {
+			// zigzag, so small negative numbers stay short
+			v = (v << 1) ^ -(v >> (sizeof(long) * 8 - 1));
+			len += put_varint(rec + len, v);
+		}
+	}
+	va_end(ap);
+	rec[0] = len - 1;
+
+	if(used() + len >= DLOG_RING_SIZE) {
+		dlog_dropped++;
+		return;
+	}
+	for(i = 0; i < len; i++) {
+		ring[(head + i) % DLOG_RING_SIZE] = rec[i];
+	}
+	head = (head + len) % DLOG_RING_SIZE;
+
+	process_poll(&dlog_process);
+}
+/*---------------------------------------------------------------------------*/
+/* Sends as many whole records as fit into one frame. */
+static void
+drain(void)
+{
+	uint8_t frame[FRAME_MAX_SIZE - 3];
+	uint16_t len = 2, rec;
+
+	frame[0] = dlog_dropped & 0xff;
+	frame[1] = dlog_dropped >> 8;
+	dlog_dropped = 0;
+
+	while(tail != head) {
+		rec = 1 + ring[tail];
+		if(len + rec > sizeof(frame)) {
+			break;
+		}
+		for(; rec > 0; rec--) {
+			frame[len++] = ring[tail];
+			tail = (tail + 1) % DLOG_RING_SIZE;
+		}
+	}
+	serialframe_send(FRAME_TYPE_DLOG, frame, len);
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(dlog_process, ev, data)
+{
+	PROCESS_BEGIN();
+
+	while(1) {
+		PROCESS_WAIT_EVENT_UNTIL(ev == PROCESS_EVENT_POLL);
+
+		while(tail != head || dlog_dropped > 0) {
+			// the UART is slow, let everything that is waiting run first
+			if(process_nevents() == 0) {
+				drain();
+			}
+			PROCESS_PAUSE();
+		}
+	}
+
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
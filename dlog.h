@@ -0,0 +1,102 @@
+/*
+ * dlog.h
+ *
+ * Deferred binary logging. A log statement does not format anything: it
+ * records the address of its format string and its arguments into a RAM
+ * ring, which dlog_process drains as binary frames (FRAME_TYPE_DLOG, see
+ * frame.h) once no other events are pending. tools/dlogdump expands them
+ * again with the format strings from the firmware image.
+ *
+ * Statements above DLOG_LEVEL compile to nothing, arguments included. A file
+ * can set its own level by defining DLOG_LEVEL before including dlog.h.
+ *
+ * Arguments are integers of up to long size. %s arguments are copied, up to
+ * DLOG_STRING_MAX bytes, since they usually point into the packetbuf.
+ * Statements must not be used from interrupts, e.g. rtimer callbacks.
+ */
+
+#ifndef DLOG_H_
+#define DLOG_H_
+
+#include <stdio.h>
+
+#include "contiki.h"
+
+#include "frame.h"
+
+#define DLOG_LEVEL_NONE 0
+#define DLOG_LEVEL_ERR  1
+#define DLOG_LEVEL_WARN 2
+#define DLOG_LEVEL_INFO 3
+#define DLOG_LEVEL_DBG  4
+
+#ifndef DLOG_LEVEL
+#define DLOG_LEVEL DLOG_LEVEL_INFO
+#endif
+
+/* Print right away instead, for consoles that are read by people (Cooja, native). */
+#ifndef DLOG_PRINTF
+#define DLOG_PRINTF 0
+#endif
+
+#ifndef DLOG_RING_SIZE
+#define DLOG_RING_SIZE 256
+#endif
+
+#define DLOG_STRING_MAX 16
+#define DLOG_ARGS_MAX 6
+
+/* Records a statement with n arguments, each passed as a long. */
+void dlog_write(const char *fmt, uint8_t n, ...);
+
+/* Statements dropped because the ring was full, since the last drain. */
+extern uint16_t dlog_dropped;
+
+/* Counts the arguments after the format, up to DLOG_ARGS_MAX. */
+#define DLOG_NARGS(...) DLOG_NARGS_(__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(f, a, b, c, d, e, g, n, ...) n
+#define DLOG_CAT(a, b) DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b) a##b
+
+#define DLOG_RECORD0(f) dlog_write(f, 0)
+#define DLOG_RECORD1(f, a) dlog_write(f, 1, (long)(a))
+#define DLOG_RECORD2(f, a, b) dlog_write(f, 2, (long)(a), (long)(b))
+#define DLOG_RECORD3(f, a, b, c) dlog_write(f, 3, (long)(a), (long)(b), (long)(c))
+#define DLOG_RECORD4(f, a, b, c, d) \
+	dlog_write(f, 4, (long)(a), (long)(b), (long)(c), (long)(d))
+#define DLOG_RECORD5(f, a, b, c, d, e) \
+	dlog_write(f, 5, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e))
+#define DLOG_RECORD6(f, a, b, c, d, e, g) \
+	dlog_write(f, 6, (long)(a), (long)(b), (long)(c), (long)(d), (long)(e), (long)(g))
+
+#if DLOG_PRINTF
+#define DLOG_RECORD(...) printf(__VA_ARGS__)
+#else
+#define DLOG_RECORD(...) DLOG_CAT(DLOG_RECORD, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_ERR
+#define DLOG_ERR(...) DLOG_RECORD(__VA_ARGS__)
+#else
+#define DLOG_ERR(...) do { } while(0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_WARN
+#define DLOG_WARN(...) DLOG_RECORD(__VA_ARGS__)
+#else
+#define DLOG_WARN(...) do { } while(0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_INFO
+#define DLOG_INFO(...) DLOG_RECORD(__VA_ARGS__)
+#else
+#define DLOG_INFO(...) do { } while(0)
+#endif
+
+#if DLOG_LEVEL >= DLOG_LEVEL_DBG
+#define DLOG_DBG(...) DLOG_RECORD(__VA_ARGS__)
+#else
+#define DLOG_DBG(...) do { } while(0)
+#endif
+
+#endif /* DLOG_H_ */
@@ -0,0 +1,76 @@
+/*
+ * frame.h
+ *
+ * Wire format of the binary serial export of the basestation. Shared by the
+ * firmware and the host tools, so it must not depend on Contiki.
+ *
+ * A frame is SLIP encoded: it ends with FRAME_END, and FRAME_END or
+ * FRAME_ESC inside the frame are sent as FRAME_ESC FRAME_ESC_END or
+ * FRAME_ESC FRAME_ESC_ESC. Decoded, a frame is
+ *
+ *   type (1) | payload | crc16 (2)
+ *
+ * where the crc is the Contiki crc16 over type and payload. All integers
+ * are little-endian.
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#define FRAME_END     0xC0
+#define FRAME_ESC     0xDB
+#define FRAME_ESC_END 0xDC
+#define FRAME_ESC_ESC 0xDD
+
+/* Largest decoded frame, type and crc included. */
+#define FRAME_MAX_SIZE 128
+
+enum
+{
+	/*
+	 * time (4, basestation seconds) | count (1) | count readings of
+	 * source (2) | type (1) | value (2)
+	 */
+	FRAME_TYPE_READINGS = 1,
+
+	/* source (2) | offset (4) | log bytes */
+	FRAME_TYPE_LOG = 2,
+
+	/*
+	 * dropped (2) | records of length (1) | count (1) | format address
+	 * (varint) | count arguments, see dlog.h. Integers are zigzag varints,
+	 * strings length (1) | bytes.
+	 */
+	FRAME_TYPE_DLOG = 3,
+
+	/*
+	 * One node of the network map, see netmap.h: node (2) | report hops (1,
+	 * 0xff if it never reported) | depth (1, 0xff if unreachable) | parent
+	 * (2) | load (1) | cost (2) | bottleneck from (2) | to (2) | bottleneck
+	 * etx (1) | count (1) | count links of node (2) | etx (1) | rssi (1).
+	 * ETX is in sixteenths, 0 if unknown.
+	 */
+	FRAME_TYPE_TOPOLOGY = 4,
+
+	/*
+	 * Event counters of a node, see counters.h: node (2) | report hops (1)
+	 * | modules (1) | kinds (1) | modules x kinds counters (2), row by
+	 * module.
+	 */
+	FRAME_TYPE_COUNTERS = 5
+};
+
+#define FRAME_READINGS_HEADER 5
+#define FRAME_READING_SIZE 5
+
+/* Readings that fit into one frame. */
+#define FRAME_READINGS_MAX ((FRAME_MAX_SIZE - 1 - FRAME_READINGS_HEADER - 2) / FRAME_READING_SIZE)
+
+#define FRAME_LOG_HEADER 6
+
+#define FRAME_TOPOLOGY_HEADER 15
+#define FRAME_TOPOLOGY_LINK_SIZE 4
+
+#define FRAME_COUNTERS_HEADER 5
+
+#endif /* FRAME_H_ */
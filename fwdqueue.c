@@ -0,0 +1,138 @@
+/*
+ * fwdqueue.c
+ *
+ * See fwdqueue.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+
+#include "fwdqueue.h"
+#include "counters.h"
+
+/* How long an entry has been queued, in puts. */
+#define AGE(q, e) ((uint16_t)((q)->order - (e)->order))
+
+/*---------------------------------------------------------------------------*/
+void
+fwdqueue_init(struct fwdqueue *q)
+{
+	uint8_t i;
+
+	memset(q, 0, sizeof(*q));
+	for(i = 0; i < FWDQUEUE_SIZE; i++) {
+		q->entries[i].priority = FWDQUEUE_FREE;
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* A free entry, or the newest entry less urgent than priority, or NULL. */
+static struct fwdqueue_entry *
+find_room(struct fwdqueue *q, uint8_t priority)
+{
+	struct fwdqueue_entry *e, *victim = NULL;
+
+	for(e = q->entries; e < q->entries + FWDQUEUE_SIZE; e++) {
+		if(e->priority == FWDQUEUE_FREE) {
+			return e;
+		}
+		// the head may be in flight
+		if(e == q->head || e->priority <= priority) {
+			continue;
+		}
+		if(victim == NULL || e->priority > victim->priority ||
+				(e->priority == victim->priority && AGE(q, e) < AGE(q, victim))) {
+			victim = e;
+		}
+	}
+
+	if(victim != NULL) {
+		q->count--;
+		q->dropped++;
+		COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_DROPPED);
+	}
+	return victim;
+}
+/*---------------------------------------------------------------------------*/
+int
+fwdqueue_put(struct fwdqueue *q, uint16_t key, uint8_t priority,
+		const void *data, uint8_t len)
+{
+	struct fwdqueue_entry *e;
+
+	COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_RX);
+	if(len > FWDQUEUE_DATA_MAX || priority == FWDQUEUE_FREE) {
+		q->dropped++;
+		COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_DROPPED);
+		return FWDQUEUE_DROPPED;
+	}
+
+	if(q->congested) {
+		// the head may be in flight, so it is never replaced
+		for(e = q->entries; e < q->entries + FWDQUEUE_SIZE; e++) {
+			if(e != q->head && e->priority == priority && e->key == key) {
+				memcpy(e->data, data, len);
+				e->len = len;
+				e->queued = clock_time();
+				q->merged++;
+				COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_DUPLICATES);
+				return FWDQUEUE_MERGED;
+			}
+		}
+	}
+
+	e = find_room(q, priority);
+	if(e == NULL) {
+		q->dropped++;
+		COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_POOL_FULL);
+		return FWDQUEUE_DROPPED;
+	}
+
+	e->key = key;
+	e->priority = priority;
+	e->order = q->order++;
+	e->queued = clock_time();
+	e->len = len;
+	memcpy(e->data, data, len);
+	if(++q->count >= FWDQUEUE_HIGH) {
+		q->congested = 1;
+	}
+	return FWDQUEUE_QUEUED;
+}
+/*---------------------------------------------------------------------------*/
+struct fwdqueue_entry *
+fwdqueue_head(struct fwdqueue *q)
+{
+	struct fwdqueue_entry *e;
+
+	if(q->head != NULL) {
+		return q->head;
+	}
+
+	// the most urgent class first, the oldest entry within it
+	for(e = q->entries; e < q->entries + FWDQUEUE_SIZE; e++) {
+		if(e->priority == FWDQUEUE_FREE) {
+			continue;
+		}
+		if(q->head == NULL || e->priority < q->head->priority ||
+				(e->priority == q->head->priority && AGE(q, e) > AGE(q, q->head))) {
+			q->head = e;
+		}
+	}
+	return q->head;
+}
+/*---------------------------------------------------------------------------*/
+void
+fwdqueue_pop(struct fwdqueue *q)
+{
+	if(q->head == NULL) {
+		return;
+	}
+	q->head->priority = FWDQUEUE_FREE;
+	q->head = NULL;
+	COUNTERS_INC(COUNTERS_FWDQUEUE, COUNTER_TX);
+	if(--q->count <= FWDQUEUE_LOW) {
+		q->congested = 0;
+	}
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,88 @@
+/*
+ * fwdqueue.h
+ *
+ * Bounded queue for packets a relay forwards. The queue turns congested
+ * when it fills up to FWDQUEUE_HIGH and clear again when it has drained to
+ * FWDQUEUE_LOW, so the congestion signal does not flap with every packet.
+ *
+ * Every packet belongs to a priority class, 0 being the most urgent, and
+ * the queue is served in strict priority order: a packet is only sent when
+ * no packet of a more urgent class is waiting. Within a class packets go
+ * out in arrival order. A full queue makes room for an urgent packet by
+ * dropping the newest packet of a less urgent class.
+ *
+ * While congested, a packet with the same key and class as one already
+ * queued (the same origin and reading type, say) replaces it instead of
+ * taking another place: the newer reading supersedes the older one. Only
+ * when that is not possible and the queue is full is the packet dropped.
+ */
+
+#ifndef FWDQUEUE_H_
+#define FWDQUEUE_H_
+
+#include "contiki.h"
+
+#ifndef FWDQUEUE_SIZE
+#define FWDQUEUE_SIZE 8
+#endif
+
+#ifndef FWDQUEUE_HIGH
+#define FWDQUEUE_HIGH 6
+#endif
+
+#ifndef FWDQUEUE_LOW
+#define FWDQUEUE_LOW 2
+#endif
+
+#define FWDQUEUE_DATA_MAX 16
+
+/* Priority of an unused entry. */
+#define FWDQUEUE_FREE 0xff
+
+enum
+{
+	FWDQUEUE_QUEUED,
+	FWDQUEUE_MERGED,
+	FWDQUEUE_DROPPED
+};
+
+struct fwdqueue_entry
+{
+	uint16_t key;
+	uint8_t priority;
+	uint16_t order;
+	clock_time_t queued;	/* when the data arrived */
+	uint8_t len;
+	uint8_t data[FWDQUEUE_DATA_MAX];
+};
+
+struct fwdqueue
+{
+	struct fwdqueue_entry entries[FWDQUEUE_SIZE];
+	struct fwdqueue_entry *head;
+	uint16_t order;
+	uint8_t count;
+	uint8_t congested;
+
+	uint16_t merged, dropped;
+};
+
+void fwdqueue_init(struct fwdqueue *q);
+
+/*
+ * Queues len bytes of data in the given priority class. Returns
+ * FWDQUEUE_QUEUED, _MERGED or _DROPPED.
+ */
+int fwdqueue_put(struct fwdqueue *q, uint16_t key, uint8_t priority,
+		const void *data, uint8_t len);
+
+/*
+ * The entry to send next, or NULL if the queue is empty. It stays the head
+ * until it is popped, even if a more urgent packet arrives meanwhile.
+ */
+struct fwdqueue_entry *fwdqueue_head(struct fwdqueue *q);
+
+/* Removes the head once it has been forwarded. */
+void fwdqueue_pop(struct fwdqueue *q);
+
+#endif /* FWDQUEUE_H_ */
@@ -0,0 +1,89 @@
+/*
+ * handshake.c
+ *
+ * See handshake.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#include "handshake.h"
+#include "dlog.h"
+
+/* Size of the fields following each opcode. */
+static const uint8_t field_len[HANDSHAKE_OPS] = {
+	[HANDSHAKE_OP_REQUEST] = sizeof(struct handshake_request),
+	[HANDSHAKE_OP_JOIN] = sizeof(struct handshake_join),
+	[HANDSHAKE_OP_JOIN_ACK] = sizeof(struct handshake_ack),
+	[HANDSHAKE_OP_SCHEDULE] = sizeof(struct handshake_schedule),
+	[HANDSHAKE_OP_CONFIRM] = sizeof(struct handshake_confirm),
+};
+
+/* Size of the entries after the fields; their count is the last field byte. */
+static const uint8_t entry_len[HANDSHAKE_OPS] = {
+	[HANDSHAKE_OP_JOIN_ACK] = sizeof(struct handshake_slot),
+	[HANDSHAKE_OP_SCHEDULE] = sizeof(struct handshake_slot),
+};
+
+#define HANDSHAKE_FRAME_MAX (1 + sizeof(struct handshake_schedule) + \
+		HANDSHAKE_MINISLOTS_MAX * sizeof(struct handshake_slot))
+
+/*---------------------------------------------------------------------------*/
+/* Number of entries the fields announce, 0 for opcodes without. */
+static uint8_t
+entry_count(uint8_t op, const uint8_t *fields)
+{
+	return entry_len[op] > 0 ? fields[field_len[op] - 1] : 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+handshake_dispatch(const struct handshake_op ops[HANDSHAKE_OPS],
+		const linkaddr_t *from)
+{
+	const uint8_t *frame = packetbuf_dataptr();
+	uint16_t len = packetbuf_datalen();
+	uint8_t op;
+
+	if(len < 1) {
+		return 0;
+	}
+	op = frame[0];
+	if(op >= HANDSHAKE_OPS || len < 1 + field_len[op] ||
+			len != 1 + field_len[op] + entry_count(op, frame + 1) * entry_len[op] ||
+			ops[op].handle == NULL) {
+		DLOG_DBG("handshake: dropped opcode %d, %d bytes from %d.%d\n",
+				op, len, from->u8[0], from->u8[1]);
+		return 0;
+	}
+	ops[op].handle(from, frame + 1);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+handshake_copy(uint8_t op, const void *fields, const void *entries)
+{
+	uint8_t frame[HANDSHAKE_FRAME_MAX];
+	uint16_t len = 1 + field_len[op];
+	uint8_t count;
+
+	frame[0] = op;
+	if(field_len[op] > 0) {
+		memcpy(frame + 1, fields, field_len[op]);
+	}
+	if(entry_len[op] > 0) {
+		// the count comes from the caller, the frame only has room for so many
+		count = entry_count(op, frame + 1);
+		if(count > HANDSHAKE_MINISLOTS_MAX) {
+			DLOG_WARN("handshake: opcode %d cut from %d to %d entries\n",
+					op, count, HANDSHAKE_MINISLOTS_MAX);
+			count = HANDSHAKE_MINISLOTS_MAX;
+			frame[len - 1] = count;
+		}
+		memcpy(frame + len, entries, count * entry_len[op]);
+		len += count * entry_len[op];
+	}
+	packetbuf_copyfrom(frame, len);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,139 @@
+/*
+ * handshake.h
+ *
+ * Neighbor discovery between sensor.c and actuator.c, carried in
+ * NETMUX_TYPE_HANDSHAKE frames. A frame is a one-byte opcode followed by
+ * the fields of that opcode:
+ *
+ *   actuator -> broadcast  REQUEST   round, mini-slots offered
+ *   sensor   -> broadcast  JOIN      actuator, round, attempts
+ *   actuator -> broadcast  JOIN_ACK  round, count, count x (sensor, slot)
+ *   actuator -> broadcast  SCHEDULE  version, interval, slots, count,
+ *                                    count x (sensor, slot)
+ *   sensor   -> broadcast  CONFIRM   actuator, version
+ *
+ * Joining is slotted random access. A REQUEST is followed by a window of
+ * mini-slots; every sensor that has not joined yet sends its JOIN in one
+ * picked at random. At the end of the window the actuator acknowledges all
+ * joins it heard in one JOIN_ACK, with the slot each sensor was given. A
+ * sensor missing from it collided, and sits out a random number of the next
+ * requests, up to 2^n - 1 after n failed attempts.
+ *
+ * Once joining has settled the actuator sends the schedule of all its
+ * sensors in as few SCHEDULE frames as they fit in. The i-th sensor listed
+ * in a frame confirms in the i-th mini-slot after it, so confirmations do
+ * not collide, and the frames are repeated for the sensors that did not
+ * confirm only.
+ *
+ * A received frame is handed to the handler the node registered for its
+ * opcode by indexing a table, after checking that its length is exactly
+ * the opcode plus its fields. Frames with an unknown opcode, without a
+ * handler or with the wrong length are dropped.
+ */
+
+#ifndef HANDSHAKE_H_
+#define HANDSHAKE_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+/*
+ * Collided joins are not heard at all, so the actuator learns about
+ * collisions from the attempts joiners report. It opens with the largest
+ * window, keeps it while joins fill most of it or report earlier attempts,
+ * and shrinks it when a round stays empty. One JOIN_ACK has room for a
+ * full window.
+ */
+#define HANDSHAKE_MINISLOTS_MIN 4
+#define HANDSHAKE_MINISLOTS_MAX 24
+
+/* Long enough for a JOIN broadcast and the turnaround of the radio. */
+#define HANDSHAKE_MINISLOT_TIME (CLOCK_SECOND / 16)
+
+/* Caps the backoff of a sensor at 2^HANDSHAKE_BACKOFF_MAX - 1 requests. */
+#define HANDSHAKE_BACKOFF_MAX 4
+
+/*
+ * The actuator sends the schedule to every sensor after this many idle
+ * requests and drops those that do not confirm it, so their entries and
+ * slots go to new sensors.
+ */
+#define HANDSHAKE_REFRESH_REQUESTS 5
+
+/*
+ * A joined sensor that has seen this many requests announce a schedule
+ * version it was never sent takes itself for dropped and joins again.
+ */
+#define HANDSHAKE_STALE_REQUESTS 8
+
+enum
+{
+	HANDSHAKE_OP_REQUEST,
+	HANDSHAKE_OP_JOIN,
+	HANDSHAKE_OP_JOIN_ACK,
+	HANDSHAKE_OP_SCHEDULE,
+	HANDSHAKE_OP_CONFIRM,
+	HANDSHAKE_OPS
+};
+
+/* Addresses are kept as bytes; the fields follow the opcode unaligned. */
+struct handshake_request
+{
+	uint8_t round;
+	uint8_t minislots;
+	uint8_t version;	/* of the schedule in force */
+};
+
+struct handshake_join
+{
+	uint8_t actuator[2];
+	uint8_t round;
+	uint8_t attempts;	/* joins of this sensor that collided before */
+};
+
+struct handshake_ack
+{
+	uint8_t round;
+	uint8_t count;		/* struct handshake_slot following */
+};
+
+struct handshake_slot
+{
+	uint8_t addr[2];
+	uint8_t slot;
+};
+
+struct handshake_schedule
+{
+	uint8_t version;
+	uint8_t interval;	/* seconds per frame */
+	uint8_t slots;		/* a frame is split into this many */
+	uint8_t count;		/* struct handshake_slot following */
+};
+
+struct handshake_confirm
+{
+	uint8_t actuator[2];
+	uint8_t version;
+};
+
+struct handshake_op
+{
+	/* Gets the sender and the fields of the opcode, already length checked;
+	   the entries of an opcode that has them follow its fields. */
+	void (*handle)(const linkaddr_t *from, const void *fields);
+};
+
+/* Hands the frame in the packetbuf to ops[opcode]. Returns 1 if it did. */
+int handshake_dispatch(const struct handshake_op ops[HANDSHAKE_OPS],
+		const linkaddr_t *from);
+
+/*
+ * Puts a frame into the packetbuf. fields may be NULL for opcodes without;
+ * entries are copied for opcodes that have them, as many as the count in
+ * the fields says. A count above HANDSHAKE_MINISLOTS_MAX is cut down to it,
+ * in the frame as well.
+ */
+void handshake_copy(uint8_t op, const void *fields, const void *entries);
+
+#endif /* HANDSHAKE_H_ */
@@ -0,0 +1,377 @@
+/*
+ * logbuf.c
+ *
+ * See logbuf.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "net/rime/rucb.h"
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+
+#include "logbuf.h"
+#include "dlog.h"
+
+/* A fetch is retried from where it stopped when no chunk came for this long. */
+#define LOGBUF_STALL (CLOCK_SECOND * 10)
+#define LOGBUF_RETRIES 3
+
+/*
+ * Every log file starts with its generation and holds whole records only,
+ * FILE_BYTES of them; file g holds offsets [g * FILE_BYTES, (g + 1) * FILE_BYTES).
+ */
+#define HEADER_SIZE sizeof(uint32_t)
+#define FILE_BYTES (LOGBUF_FILE_SIZE - LOGBUF_FILE_SIZE % sizeof(struct log_record))
+
+struct request
+{
+	uint32_t offset;
+};
+
+static struct rucb_conn rucb;
+static struct unicast_conn request_conn;
+static const struct logbuf_callbacks *callbacks;
+
+static uint32_t generation;
+static uint16_t fill;
+
+static struct log_record pending[LOGBUF_BATCH];
+static uint8_t pending_count;
+
+/* Sending side. */
+static uint32_t upload_base;
+static uint8_t uploading;
+
+/* Receiving side. */
+static struct {
+	linkaddr_t from;
+	uint32_t start;		/* offset the current stream is served from */
+	uint32_t next;		/* next offset we are waiting for */
+	uint8_t retries;
+	uint8_t active;
+} fetch;
+static struct ctimer stall_timer;
+
+/*---------------------------------------------------------------------------*/
+static const char *
+file_name(uint32_t gen)
+{
+	return (gen & 1) ? "log.1" : "log.0";
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+read_generation(const char *name, uint16_t *size)
+{
+	uint32_t gen = 0;
+	cfs_offset_t end;
+	int fd;
+
+	*size = 0;
+	fd = cfs_open(name, CFS_READ);
+	if(fd < 0) {
+		return 0;
+	}
+	if(cfs_read(fd, &gen, HEADER_SIZE) == HEADER_SIZE) {
+		end = cfs_seek(fd, 0, CFS_SEEK_END);
+		*size = end > HEADER_SIZE ? end - HEADER_SIZE : 0;
+		// Coffee drops the zero bytes a file ends in, and a record mostly
+		// ends in some; the last record is whole again when rounded up
+		*size += (sizeof(struct log_record) - *size % sizeof(struct log_record)) %
+				sizeof(struct log_record);
+		if(*size > FILE_BYTES) {
+			*size = FILE_BYTES;
+		}
+	}
+	cfs_close(fd);
+	return gen;
+}
+/*---------------------------------------------------------------------------*/
+static void
+start_file(uint32_t gen)
+{
+	const char *name = file_name(gen);
+	int fd;
+
+	cfs_remove(name);
+	cfs_coffee_reserve(name, HEADER_SIZE + LOGBUF_FILE_SIZE);
+	fd = cfs_open(name, CFS_WRITE);
+	if(fd >= 0) {
+		cfs_write(fd, &gen, HEADER_SIZE);
+		cfs_close(fd);
+	}
+	generation = gen;
+	fill = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+logbuf_flush(void)
+{
+	const uint8_t *data = (const uint8_t *)pending;
+	uint16_t len = pending_count * sizeof(struct log_record);
+	uint16_t room, n;
+	int fd;
+
+	while(len > 0) {
+		room = FILE_BYTES - fill;
+		if(room == 0) {
+			// the older file is dropped to make room
+			start_file(generation + 1);
+			continue;
+		}
+		n = len < room ? len : room;
+
+		// written at fill rather than appended, as Coffee may put the end
+		// of the file before the zero bytes of the last record
+		fd = cfs_open(file_name(generation), CFS_WRITE);
+		if(fd < 0) {
+			break;
+		}
+		cfs_seek(fd, HEADER_SIZE + fill, CFS_SEEK_SET);
+		cfs_write(fd, data, n);
+		cfs_close(fd);
+
+		fill += n;
+		data += n;
+		len -= n;
+	}
+	pending_count = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+logbuf_append(const struct log_record *r)
+{
+	memcpy(&pending[pending_count++], r, sizeof(*r));
+	if(pending_count == LOGBUF_BATCH) {
+		logbuf_flush();
+	}
+}
+/*---------------------------------------------------------------------------*/
+uint32_t
+logbuf_end(void)
+{
+	return generation * FILE_BYTES + fill + pending_count * sizeof(struct log_record);
+}
+/*---------------------------------------------------------------------------*/
+/* Oldest offset still in flash. */
+static uint32_t
+logbuf_start(void)
+{
+	return generation > 0 ? (generation - 1) * FILE_BYTES : 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+read_at(uint32_t offset, char *to, int maxsize)
+{
+	uint32_t gen = offset / FILE_BYTES;
+	uint16_t pos = offset % FILE_BYTES;
+	uint16_t size = gen == generation ? fill : FILE_BYTES;
+	int fd, n;
+
+	if(pos >= size) {
+		return 0;
+	}
+	if(maxsize > size - pos) {
+		maxsize = size - pos;
+	}
+
+	fd = cfs_open(file_name(gen), CFS_READ);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_seek(fd, HEADER_SIZE + pos, CFS_SEEK_SET);
+	n = cfs_read(fd, to, maxsize);
+	cfs_close(fd);
+	if(n < 0) {
+		return 0;
+	}
+	// what Coffee did not return past its end of the file are the dropped zeros
+	memset(to + n, 0, maxsize - n);
+	return maxsize;
+}
+/*---------------------------------------------------------------------------*/
+/* The stream starts with the offset it was actually served from. */
+static int
+read_chunk(struct rucb_conn *c, int offset, char *to, int maxsize)
+{
+	uint32_t at;
+	int n = 0;
+
+	if(offset == 0) {
+		memcpy(to, &upload_base, HEADER_SIZE);
+		n = HEADER_SIZE;
+	}
+	at = upload_base + offset + n - HEADER_SIZE;
+
+	n += read_at(at, to + n, maxsize - n);
+	if(n < maxsize && upload_base + offset + n - HEADER_SIZE < logbuf_end()) {
+		// the chunk crosses into the newer file
+		n += read_at(upload_base + offset + n - HEADER_SIZE, to + n, maxsize - n);
+	}
+
+	if(n < maxsize) {
+		uploading = 0;
+	}
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+sender_timedout(struct rucb_conn *c)
+{
+	DLOG_WARN("logbuf: upload to %d.%d timed out\n", c->receiver.u8[0], c->receiver.u8[1]);
+	uploading = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+stalled(void *ptr)
+{
+	struct request req;
+
+	if(!fetch.active) {
+		return;
+	}
+
+	if(++fetch.retries > LOGBUF_RETRIES) {
+		fetch.active = 0;
+		if(callbacks != NULL && callbacks->done != NULL) {
+			callbacks->done(&fetch.from, fetch.next, 0);
+		}
+		return;
+	}
+
+	DLOG_WARN("logbuf: upload from %d.%d stalled, resuming at %lu\n",
+			fetch.from.u8[0], fetch.from.u8[1], (unsigned long)fetch.next);
+
+	req.offset = fetch.next;
+	packetbuf_copyfrom(&req, sizeof(req));
+	unicast_send(&request_conn, &fetch.from);
+	ctimer_set(&stall_timer, LOGBUF_STALL, stalled, NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_chunk(struct rucb_conn *c, int offset, int flag, char *data, int datalen)
+{
+	uint32_t at;
+
+	if(!fetch.active || !linkaddr_cmp(&c->sender, &fetch.from)) {
+		return;
+	}
+
+	if(offset == 0) {
+		if(datalen < HEADER_SIZE) {
+			return;
+		}
+		// the sender may have moved the start up if older data is gone
+		memcpy(&fetch.start, data, HEADER_SIZE);
+		if(fetch.start > fetch.next) {
+			fetch.next = fetch.start;
+		}
+		data += HEADER_SIZE;
+		datalen -= HEADER_SIZE;
+		at = fetch.start;
+	} else {
+		at = fetch.start + offset - HEADER_SIZE;
+	}
+
+	if(datalen > 0 && at == fetch.next) {
+		if(callbacks != NULL && callbacks->received != NULL) {
+			callbacks->received(&fetch.from, fetch.next, (uint8_t *)data, datalen);
+		}
+		fetch.next += datalen;
+		fetch.retries = 0;
+	}
+
+	if(flag == RUCB_FLAG_LASTCHUNK) {
+		fetch.active = 0;
+		ctimer_stop(&stall_timer);
+		if(callbacks != NULL && callbacks->done != NULL) {
+			callbacks->done(&fetch.from, fetch.next, 1);
+		}
+	} else {
+		ctimer_restart(&stall_timer);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_request(struct unicast_conn *c, const linkaddr_t *from)
+{
+	struct request req;
+
+	if(packetbuf_datalen() != sizeof(req) || uploading) {
+		return;
+	}
+	memcpy(&req, packetbuf_dataptr(), sizeof(req));
+
+	logbuf_flush();
+
+	upload_base = req.offset;
+	if(upload_base < logbuf_start()) {
+		upload_base = logbuf_start();
+	}
+	if(upload_base > logbuf_end()) {
+		upload_base = logbuf_end();
+	}
+
+	DLOG_INFO("logbuf: uploading to %d.%d from %lu\n", from->u8[0], from->u8[1], (unsigned long)upload_base);
+	uploading = 1;
+	rucb_send(&rucb, from);
+}
+/*---------------------------------------------------------------------------*/
+const static struct rucb_callbacks rucb_callbacks = {write_chunk, read_chunk, sender_timedout};
+const static struct unicast_callbacks request_callbacks = {recv_request};
+/*---------------------------------------------------------------------------*/
+void
+logbuf_open(const struct logbuf_callbacks *cb)
+{
+	uint32_t gen0, gen1;
+	uint16_t size0, size1;
+
+	callbacks = cb;
+
+	gen0 = read_generation("log.0", &size0);
+	gen1 = read_generation("log.1", &size1);
+	if(size0 == 0 && size1 == 0 && gen0 == 0 && gen1 == 0) {
+		start_file(0);
+	} else if(gen1 > gen0) {
+		generation = gen1;
+		fill = size1;
+	} else {
+		generation = gen0;
+		fill = size0;
+	}
+
+	rucb_open(&rucb, LOGBUF_CHANNEL, &rucb_callbacks);
+	unicast_open(&request_conn, LOGBUF_REQUEST_CHANNEL, &request_callbacks);
+}
+/*---------------------------------------------------------------------------*/
+void
+logbuf_close(void)
+{
+	logbuf_flush();
+	rucb_close(&rucb);
+}
+/*---------------------------------------------------------------------------*/
+int
+logbuf_fetch(const linkaddr_t *neighbor, uint32_t offset)
+{
+	struct request req;
+
+	if(fetch.active) {
+		return 0;
+	}
+
+	linkaddr_copy(&fetch.from, neighbor);
+	fetch.next = offset;
+	fetch.retries = 0;
+	fetch.active = 1;
+
+	req.offset = offset;
+	packetbuf_copyfrom(&req, sizeof(req));
+	unicast_send(&request_conn, neighbor);
+	ctimer_set(&stall_timer, LOGBUF_STALL, stalled, NULL);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,65 @@
+/*
+ * logbuf.h
+ *
+ * Flash-backed log of samples and diagnostic records. Records are appended
+ * to two alternating Coffee files, so the log holds between one and two
+ * files' worth of history. Every byte has a logical offset that only grows,
+ * so an interrupted upload can resume where it stopped.
+ *
+ * A neighbor asks for the log from a given offset and the node streams
+ * everything after it with rucb, which acknowledges every chunk before the
+ * next one goes out. rucb is single-hop, so the requester has to be a
+ * neighbor.
+ */
+
+#ifndef LOGBUF_H_
+#define LOGBUF_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#define LOGBUF_CHANNEL 137
+#define LOGBUF_REQUEST_CHANNEL 139
+
+/* Size of one of the two log files. */
+#ifndef LOGBUF_FILE_SIZE
+#define LOGBUF_FILE_SIZE 8192
+#endif
+
+/* Records are kept in RAM and written to flash this many at a time. */
+#ifndef LOGBUF_BATCH
+#define LOGBUF_BATCH 4
+#endif
+
+struct log_record
+{
+	uint32_t time;		/* clock_seconds() when it was taken */
+	linkaddr_t source;	/* the sensor it came from */
+	uint8_t type;
+	int16_t value;
+};
+
+struct logbuf_callbacks
+{
+	/* A chunk of a requested log arrived. offset is the logical offset of data. */
+	void (*received)(const linkaddr_t *from, uint32_t offset, const uint8_t *data, int len);
+
+	/* The upload is complete, or was given up after retrying. */
+	void (*done)(const linkaddr_t *from, uint32_t end, int complete);
+};
+
+void logbuf_open(const struct logbuf_callbacks *callbacks);
+void logbuf_close(void);
+
+void logbuf_append(const struct log_record *r);
+
+/* Writes the records still kept in RAM to flash. */
+void logbuf_flush(void);
+
+/* Logical offset after the last record. */
+uint32_t logbuf_end(void);
+
+/* Asks neighbor to upload its log from offset on. Returns 0 if an upload is already running. */
+int logbuf_fetch(const linkaddr_t *neighbor, uint32_t offset);
+
+#endif /* LOGBUF_H_ */
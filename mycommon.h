@@ -8,6 +8,9 @@
 #ifndef COMMON_H_
 #define COMMON_H_
 
+#include "deadband.h"
+#include "netconfig.h"
+
 #define SLEEP_THREAD(time) \
 	{ \
 		static struct etimer SLEEP_TIMER_IN_SLEEP_MACRO; \
@@ -19,16 +22,17 @@
 #define NEW_TIMER_RECEIVED_EVENT        0x01
 
 /*
- * Then we define the values needed for runicast to be reliable ;), wich are
- * the amount of allowable rettransmissions before accepting failure, and
- * the amount of message id's in the history list, wich should be enough
- * to contain at least one message from each parent node (so, one :D)
+ * The runicast retransmissions, the duplicate history and the number of
+ * neighbors are runtime parameters now, see params.h.
  */
 
-#define MAX_RETRANSMISSIONS 4
-#define NUM_HISTORY_ENTRIES 2
-#define MAX_NEIGHBORS 60
-#define TIME_INTERVAL 60
+/*
+ * An actuator forgets a sensor, and gives its entry and slot to the next
+ * one, after this many intervals beyond the heartbeat without a report.
+ */
+#ifndef NEIGHBOR_LEASE_MISSES
+#define NEIGHBOR_LEASE_MISSES 2
+#endif
 
 /* These two defines are used for computing the moving average for the
    broadcast sequence number gaps. */
@@ -44,10 +48,53 @@
 struct runicast_message
 {
 	uint8_t type;
+	uint8_t priority;
 	int16_t data;
 	uint8_t seqno;
+	/* In a schedule reply, the TDMA slot the sensor was given and the
+	   data channel of its cluster (see channel.h). */
+	uint8_t slot;
+	uint8_t channel;
+	/* In a schedule reply, milliseconds on top of the seconds in data,
+	   and how many milliseconds a day the clock of the sensor runs fast
+	   (see DRIFT_DAY). */
+	uint16_t data_ms;
+	int16_t drift;
+};
+
+/*
+ * Priority classes, the most urgent first. Queues serve them in strict
+ * priority order.
+ */
+enum
+{
+	PRIORITY_ALARM,
+	PRIORITY_CONTROL,
+	PRIORITY_TELEMETRY
 };
 
+/*
+ * A TDMA frame lasts one reporting interval and is split into
+ * TDMA_SLOTS slots. The first TDMA_URGENT_SLOTS are a contention slot
+ * reserved for alarms; the sensors are given the slots after them.
+ */
+#define TDMA_URGENT_SLOTS 1
+#define TDMA_SLOTS (TDMA_URGENT_SLOTS + MAX_NEIGHBORS)
+
+/* Start of a slot in seconds from the start of a frame of the given length. */
+#define TDMA_SLOT_OFFSET(slot, interval) ((int)(slot) * (int)(interval) / TDMA_SLOTS)
+
+/*
+ * Clock drift is counted in milliseconds per day. A report that arrives
+ * further than DRIFT_WINDOW_MS from the start of its slot was not sent on
+ * time (a retransmission, a rejoin) and says nothing about the clock.
+ * Once DRIFT_SETTLED estimates are in, the actuator listens for a sensor
+ * with a guard of one second instead of two.
+ */
+#define DRIFT_DAY 86400L
+#define DRIFT_WINDOW_MS 500
+#define DRIFT_SETTLED 3
+
 
 /* This is the structure of broadcast messages. */
 struct broadcast_message {
@@ -76,27 +123,11 @@ struct history_entry
 
 
 
-static void timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
-static void recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno);
-static void sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
-
-static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
-							     	 	 	 	 	 	 	 sent_runicast,
-															 timedout_runicast};
-
-static void recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from);
-
-static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
-
-
 int schedule_set = 0;
 
-clock_time_t time_delay = -1;
-
+uint32_t time_delay = -1;
 
 /*---------------------------------------------------------------------------*/
-static struct runicast_conn runicast;
-static struct broadcast_conn broadcast;
 
 
 /* This structure holds information about neighbors. */
@@ -107,6 +138,37 @@ struct neighbor {
 
   /* The ->addr field holds the Rime address of the neighbor. */
   linkaddr_t addr;
+
+  /* The ->track field holds the last reported reading, which is held
+     while the sensor stays inside its dead-band. */
+  struct deadband_track track;
+
+  /* The ->type and ->zone fields tell the rule engine which zone
+     average the tracked reading belongs to. */
+  uint8_t type;
+  uint8_t zone;
+
+  /* The ->config_version field holds the configuration version this
+     neighbor has acknowledged. */
+  uint8_t config_version;
+
+  /* The ->slot field holds the TDMA slot the neighbor was given. */
+  uint8_t slot;
+
+  /* The ->lease timer fires once per interval; ->missed counts the
+     intervals without a report since the last one. */
+  struct ctimer lease;
+  uint8_t missed;
+
+  /* The ->synced field holds clock_seconds() when the last schedule
+     reply reached the neighbor, 0 if unknown. The ->bias field holds
+     how late its reports arrive in milliseconds, and ->drift how fast
+     its clock runs in milliseconds a day; ->drift_samples counts the
+     estimates that went into it. */
+  uint32_t synced;
+  int16_t bias;
+  int16_t drift;
+  uint8_t drift_samples;
 };
 
 
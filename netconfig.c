@@ -0,0 +1,63 @@
+/*
+ * netconfig.c
+ *
+ * See netconfig.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "netconfig.h"
+
+struct netconfig netconfig = {0, REPORT_MAX_SILENCE, TIME_INTERVAL, REPORT_DEADBAND, 0};
+
+/*---------------------------------------------------------------------------*/
+void
+netconfig_init(void)
+{
+	struct netconfig c;
+
+	if(netconfig.version == 0) {
+		memcpy(&c, &netconfig, sizeof(c));
+		c.time_interval = PARAM(PARAM_TIME_INTERVAL);
+		netconfig_apply(&c);
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+netconfig_newer(uint8_t a, uint8_t b)
+{
+	return (int8_t)(a - b) > 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+netconfig_apply(const struct netconfig *c)
+{
+	uint8_t i;
+
+	// version 0 is the default and may be replaced by the default again
+	if(!netconfig_newer(c->version, netconfig.version) &&
+	   (c->version != 0 || netconfig.version != 0)) {
+		return 0;
+	}
+
+	if(c->time_interval < TIME_INTERVAL_MIN || c->time_interval > TIME_INTERVAL_MAX ||
+	   c->deadband < 0 || c->max_silence == 0 ||
+	   c->rule_count > NETCONFIG_RULES) {
+		return 0;
+	}
+	for(i = 0; i < PARAMS; i++) {
+		if(c->params[i] != 0 && !params_valid(i, c->params[i])) {
+			return 0;
+		}
+	}
+
+	memcpy(&netconfig, c, sizeof(netconfig));
+	for(i = 0; i < PARAMS; i++) {
+		if(c->params[i] != 0) {
+			params_set(i, c->params[i]);
+		}
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,63 @@
+/*
+ * netconfig.h
+ *
+ * Network-wide configuration that can be changed without reflashing. The
+ * basestation floods new versions over trickle, actuators apply them and
+ * hand them to their sensors with the next schedule reply.
+ */
+
+#ifndef NETCONFIG_H_
+#define NETCONFIG_H_
+
+#include "contiki.h"
+#include "deadband.h"
+#include "params.h"
+
+#define NETCONFIG_CHANNEL 140
+
+/* Number of rule thresholds that can be overridden. */
+#define NETCONFIG_RULES 4
+
+struct netconfig_rule
+{
+	int16_t threshold;
+	int16_t hysteresis;
+};
+
+struct netconfig
+{
+	uint8_t version;
+	uint8_t max_silence;
+	uint16_t time_interval;
+	int16_t deadband;
+	uint8_t rule_count;
+	struct netconfig_rule rules[NETCONFIG_RULES];
+	/* New values for the runtime parameters, 0 leaves one as it is. */
+	uint16_t params[PARAMS];
+};
+
+/*
+ * The configuration currently in use. Version 0 is the compiled-in default,
+ * with the interval of the parameters once netconfig_init() ran.
+ */
+extern struct netconfig netconfig;
+
+/*
+ * Takes the default interval from the parameters; call after params_open().
+ * params calls it again whenever the interval parameter changes. Does
+ * nothing once a configuration arrived.
+ */
+void netconfig_init(void);
+
+/*
+ * Checks c and, if it is valid and newer than the current configuration,
+ * replaces the current configuration with it in one go, and sets the
+ * parameters it carries. A version 0 may replace version 0, so the default
+ * can change. Returns 1 if c was applied.
+ */
+int netconfig_apply(const struct netconfig *c);
+
+/* Returns 1 if version a is newer than version b, taking wrap-around into account. */
+int netconfig_newer(uint8_t a, uint8_t b);
+
+#endif /* NETCONFIG_H_ */
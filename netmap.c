@@ -0,0 +1,295 @@
+/*
+ * netmap.c
+ *
+ * See netmap.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#include "netmap.h"
+#include "channel.h"
+#include "serialframe.h"
+
+/* ETX assumed for a link that was heard over but not yet used for unicast. */
+#define NETMAP_ETX_GUESS (2 * TOPOLOGY_ETX_UNIT)
+
+struct netmap_node netmap_nodes[NETMAP_NODES];
+uint8_t netmap_count;
+
+/*---------------------------------------------------------------------------*/
+/* Index of a node, added if create is set. Returns -1 if it is unknown or the map is full. */
+static int
+find(uint8_t a0, uint8_t a1, int create)
+{
+	struct netmap_node *n;
+	int i;
+
+	// the basestation is always node 0
+	if(netmap_count == 0) {
+		memset(&netmap_nodes[0], 0, sizeof(netmap_nodes[0]));
+		linkaddr_copy(&netmap_nodes[0].addr, &linkaddr_node_addr);
+		netmap_count = 1;
+	}
+
+	for(i = 0; i < netmap_count; i++) {
+		if(netmap_nodes[i].addr.u8[0] == a0 && netmap_nodes[i].addr.u8[1] == a1) {
+			return i;
+		}
+	}
+	if(!create || netmap_count == NETMAP_NODES) {
+		return -1;
+	}
+
+	n = &netmap_nodes[netmap_count];
+	memset(n, 0, sizeof(*n));
+	n->addr.u8[0] = a0;
+	n->addr.u8[1] = a1;
+	return netmap_count++;
+}
+/*---------------------------------------------------------------------------*/
+void
+netmap_report(const linkaddr_t *from, uint8_t hops,
+		const struct topology_link *links, uint8_t count)
+{
+	struct netmap_node *n;
+	int i;
+
+	i = find(from->u8[0], from->u8[1], 1);
+	if(i < 0) {
+		return;
+	}
+	n = &netmap_nodes[i];
+	n->reported = 1;
+	n->hops = hops;
+	n->count = count < TOPOLOGY_LINKS ? count : TOPOLOGY_LINKS;
+	memcpy(n->links, links, n->count * sizeof(struct topology_link));
+
+	// neighbors that did not report yet still show up on the map
+	for(i = 0; i < n->count; i++) {
+		find(n->links[i].addr[0], n->links[i].addr[1], 1);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* ETX of the link as seen by from, or 0 if from does not report it. */
+static uint8_t
+reported_etx(int from, int to)
+{
+	const struct netmap_node *n = &netmap_nodes[from];
+	int i;
+
+	for(i = 0; i < n->count; i++) {
+		if(n->links[i].addr[0] == netmap_nodes[to].addr.u8[0] &&
+		   n->links[i].addr[1] == netmap_nodes[to].addr.u8[1]) {
+			return n->links[i].etx != 0 ? n->links[i].etx : NETMAP_ETX_GUESS;
+		}
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* ETX from u to v, falling back to what v reports about u. 0 if there is no link. */
+static uint8_t
+edge(int u, int v)
+{
+	uint8_t etx = reported_etx(u, v);
+
+	return etx != 0 ? etx : reported_etx(v, u);
+}
+/*---------------------------------------------------------------------------*/
+void
+netmap_update(void)
+{
+	struct netmap_node *n;
+	uint8_t etx, changed;
+	uint16_t cost;
+	int u, v, round;
+
+	find(0, 0, 0);
+
+	for(u = 0; u < netmap_count; u++) {
+		n = &netmap_nodes[u];
+		n->cost = u == 0 ? 0 : NETMAP_UNREACHABLE;
+		n->parent = NETMAP_NO_PARENT;
+		n->depth = 0;
+		n->load = 0;
+		n->bottleneck = 0;
+		n->bottleneck_from = n->bottleneck_to = u;
+	}
+
+	// Bellman-Ford towards the basestation; there are only a few nodes
+	for(round = 0, changed = 1; changed && round < netmap_count; round++) {
+		changed = 0;
+		for(u = 1; u < netmap_count; u++) {
+			for(v = 0; v < netmap_count; v++) {
+				if(v == u || netmap_nodes[v].cost == NETMAP_UNREACHABLE) {
+					continue;
+				}
+				etx = edge(u, v);
+				cost = netmap_nodes[v].cost + etx;
+				if(etx != 0 && cost < netmap_nodes[u].cost) {
+					netmap_nodes[u].cost = cost;
+					netmap_nodes[u].parent = v;
+					changed = 1;
+				}
+			}
+		}
+	}
+
+	// walk every path once for depth, bottleneck and the load of its relays
+	for(u = 1; u < netmap_count; u++) {
+		n = &netmap_nodes[u];
+		if(n->cost == NETMAP_UNREACHABLE) {
+			continue;
+		}
+		for(v = u; v != 0 && n->depth < netmap_count; v = netmap_nodes[v].parent) {
+			etx = edge(v, netmap_nodes[v].parent);
+			if(etx > n->bottleneck) {
+				n->bottleneck = etx;
+				n->bottleneck_from = v;
+				n->bottleneck_to = netmap_nodes[v].parent;
+			}
+			if(v != u) {
+				netmap_nodes[v].load++;
+			}
+			n->depth++;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* 1 if u and v are neighbors or have a neighbor in common. */
+static int
+interferes(int u, int v)
+{
+	int w;
+
+	if(edge(u, v) != 0) {
+		return 1;
+	}
+	for(w = 0; w < netmap_count; w++) {
+		if(w != u && w != v && edge(u, w) != 0 && edge(w, v) != 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+netmap_channels(struct bulk_channel *plan, int max)
+{
+	uint8_t used[CHANNEL_DATA_LAST - CHANNEL_DATA_FIRST + 1];
+	uint8_t taken[CHANNEL_DATA_LAST - CHANNEL_DATA_FIRST + 1];
+	int u, v, c, best, n = 0;
+
+	find(0, 0, 0);
+	memset(used, 0, sizeof(used));
+
+	// greedy colouring in map order, which is the order nodes first showed up in
+	for(u = 1; u < netmap_count && n < max; u++) {
+		memset(taken, 0, sizeof(taken));
+		for(v = 1; v < u; v++) {
+			if(interferes(u, v)) {
+				taken[netmap_nodes[v].channel - CHANNEL_DATA_FIRST] = 1;
+			}
+		}
+
+		best = -1;
+		for(c = 0; c < (int)sizeof(used); c++) {
+			if(best < 0 || taken[c] < taken[best] ||
+					(taken[c] == taken[best] && used[c] < used[best])) {
+				best = c;
+			}
+		}
+		used[best]++;
+		netmap_nodes[u].channel = CHANNEL_DATA_FIRST + best;
+
+		linkaddr_copy(&plan[n].addr, &netmap_nodes[u].addr);
+		plan[n].channel = netmap_nodes[u].channel;
+		n++;
+	}
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_etx(const char *label, uint16_t etx)
+{
+	printf(" %s %u.%02u", label, etx / TOPOLOGY_ETX_UNIT,
+			(etx % TOPOLOGY_ETX_UNIT) * 100 / TOPOLOGY_ETX_UNIT);
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_node(const struct netmap_node *n)
+{
+	const struct netmap_node *from, *to;
+	int i;
+
+	printf("map %d.%d", n->addr.u8[0], n->addr.u8[1]);
+	if(n->cost == NETMAP_UNREACHABLE) {
+		printf(" unreachable");
+	} else if(n->parent != NETMAP_NO_PARENT) {
+		from = &netmap_nodes[n->bottleneck_from];
+		to = &netmap_nodes[n->bottleneck_to];
+		printf(" depth %d via %d.%d load %d", n->depth,
+				netmap_nodes[n->parent].addr.u8[0], netmap_nodes[n->parent].addr.u8[1], n->load);
+		print_etx("cost", n->cost);
+		printf(" bottleneck %d.%d->%d.%d", from->addr.u8[0], from->addr.u8[1],
+				to->addr.u8[0], to->addr.u8[1]);
+		print_etx("etx", n->bottleneck);
+	} else {
+		printf(" basestation");
+	}
+	if(!n->reported) {
+		printf(" (no report)");
+	}
+	printf("\n");
+
+	for(i = 0; i < n->count; i++) {
+		printf("  link %d.%d", n->links[i].addr[0], n->links[i].addr[1]);
+		print_etx("etx", n->links[i].etx);
+		printf(" rssi %d\n", n->links[i].rssi);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_node(const struct netmap_node *n)
+{
+	uint8_t frame[FRAME_TOPOLOGY_HEADER + TOPOLOGY_LINKS * sizeof(struct topology_link)];
+	const struct netmap_node *parent = &netmap_nodes[n->parent == NETMAP_NO_PARENT ? 0 : n->parent];
+
+	frame[0] = n->addr.u8[0];
+	frame[1] = n->addr.u8[1];
+	frame[2] = n->reported ? n->hops : 0xff;
+	frame[3] = n->cost == NETMAP_UNREACHABLE ? 0xff : n->depth;
+	frame[4] = parent->addr.u8[0];
+	frame[5] = parent->addr.u8[1];
+	frame[6] = n->load;
+	frame[7] = n->cost & 0xff;
+	frame[8] = n->cost >> 8;
+	frame[9] = netmap_nodes[n->bottleneck_from].addr.u8[0];
+	frame[10] = netmap_nodes[n->bottleneck_from].addr.u8[1];
+	frame[11] = netmap_nodes[n->bottleneck_to].addr.u8[0];
+	frame[12] = netmap_nodes[n->bottleneck_to].addr.u8[1];
+	frame[13] = n->bottleneck;
+	frame[14] = n->count;
+	memcpy(frame + FRAME_TOPOLOGY_HEADER, n->links, n->count * sizeof(struct topology_link));
+
+	serialframe_send(FRAME_TYPE_TOPOLOGY, frame,
+			FRAME_TOPOLOGY_HEADER + n->count * sizeof(struct topology_link));
+}
+/*---------------------------------------------------------------------------*/
+void
+netmap_export(int binary)
+{
+	int i;
+
+	for(i = 0; i < netmap_count; i++) {
+		if(binary) {
+			send_node(&netmap_nodes[i]);
+		} else {
+			print_node(&netmap_nodes[i]);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
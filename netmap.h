@@ -0,0 +1,65 @@
+/*
+ * netmap.h
+ *
+ * Network map assembled at the basestation from topology reports. Routes
+ * to the basestation are chosen by the lowest sum of link ETX, which gives
+ * every node its hop depth, the parent it forwards through, the number of
+ * nodes routed through it (its load) and the worst link on its path (the
+ * bottleneck). Relays with a high load are the ones that drain first.
+ */
+
+#ifndef NETMAP_H_
+#define NETMAP_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#include "topology.h"
+#include "bulk.h"
+
+#define NETMAP_NODES 24
+
+#define NETMAP_UNREACHABLE 0xffff
+#define NETMAP_NO_PARENT 0xff
+
+struct netmap_node
+{
+	linkaddr_t addr;
+	uint8_t reported;	/* a report arrived from it */
+	uint8_t hops;		/* mesh hops of its last report */
+	uint8_t count;
+	struct topology_link links[TOPOLOGY_LINKS];
+
+	/* filled in by netmap_update() */
+	uint16_t cost;		/* path ETX in sixteenths, NETMAP_UNREACHABLE */
+	uint8_t depth;
+	uint8_t parent;		/* index of the next hop, NETMAP_NO_PARENT at the basestation */
+	uint8_t load;
+	uint8_t bottleneck;	/* ETX of the worst link on the path */
+	uint8_t bottleneck_from, bottleneck_to;
+
+	uint8_t channel;	/* data channel, filled in by netmap_channels() */
+};
+
+extern struct netmap_node netmap_nodes[NETMAP_NODES];
+extern uint8_t netmap_count;
+
+/* Stores the links reported by from, replacing its previous report. */
+void netmap_report(const linkaddr_t *from, uint8_t hops,
+		const struct topology_link *links, uint8_t count);
+
+/* Recomputes routes, depths, loads and bottlenecks; node 0 is the basestation. */
+void netmap_update(void);
+
+/*
+ * Gives every node but the basestation a data channel (see channel.h) that
+ * no node within two hops of it uses, where there are enough channels, and
+ * the least used one otherwise. Writes up to max entries to plan and
+ * returns their number.
+ */
+int netmap_channels(struct bulk_channel *plan, int max);
+
+/* Prints the map as text, or sends it as FRAME_TYPE_TOPOLOGY frames. */
+void netmap_export(int binary);
+
+#endif /* NETMAP_H_ */
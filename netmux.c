@@ -0,0 +1,202 @@
+/*
+ * netmux.c
+ *
+ * See netmux.h.
+ */
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#include "netmux.h"
+#include "counters.h"
+#include "params.h"
+
+struct history_entry
+{
+	linkaddr_t addr;
+	uint8_t seqno;
+};
+
+static struct broadcast_conn broadcast;
+static struct runicast_conn runicast;
+static uint8_t opened;
+
+static const struct netmux_handler *handlers[NETMUX_TYPES];
+
+/* Type of the runicast frame in flight. */
+static uint8_t in_flight;
+
+static struct history_entry history[NETMUX_HISTORY];
+static uint8_t history_next;
+
+/*---------------------------------------------------------------------------*/
+/* Strips the type off a received frame. Returns its handler, or NULL. */
+static const struct netmux_handler *
+strip(void)
+{
+	uint8_t type;
+
+	if(packetbuf_datalen() < 1) {
+		return NULL;
+	}
+	type = *(uint8_t *)packetbuf_dataptr();
+	if(type >= NETMUX_TYPES) {
+		return NULL;
+	}
+	packetbuf_hdrreduce(1);
+	return handlers[type];
+}
+/*---------------------------------------------------------------------------*/
+static int
+prepend(uint8_t type)
+{
+	if(!packetbuf_hdralloc(1)) {
+		return 0;
+	}
+	*(uint8_t *)packetbuf_hdrptr() = type;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_broadcast(struct broadcast_conn *c, const linkaddr_t *from)
+{
+	const struct netmux_handler *h = strip();
+
+	COUNTERS_INC(COUNTERS_NETMUX, COUNTER_RX);
+	if(h != NULL && h->broadcast != NULL) {
+		h->broadcast(from);
+	} else {
+		COUNTERS_INC(COUNTERS_NETMUX, COUNTER_DROPPED);
+	}
+}
+/*---------------------------------------------------------------------------*/
+/* 1 if seqno from this sender was delivered already. */
+static int
+duplicate(const linkaddr_t *from, uint8_t seqno)
+{
+	uint8_t i, size = PARAM(PARAM_HISTORY_ENTRIES);
+
+	for(i = 0; i < size; i++) {
+		if(linkaddr_cmp(&history[i].addr, from)) {
+			if(history[i].seqno == seqno) {
+				return 1;
+			}
+			history[i].seqno = seqno;
+			return 0;
+		}
+	}
+
+	// forget the sender we have known longest
+	if(history_next >= size) {
+		history_next = 0;
+	}
+	linkaddr_copy(&history[history_next].addr, from);
+	history[history_next].seqno = seqno;
+	history_next = (history_next + 1) % size;
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+{
+	const struct netmux_handler *h;
+
+	COUNTERS_INC(COUNTERS_NETMUX, COUNTER_RX);
+	if(duplicate(from, seqno)) {
+		COUNTERS_INC(COUNTERS_NETMUX, COUNTER_DUPLICATES);
+		return;
+	}
+	h = strip();
+	if(h != NULL && h->unicast != NULL) {
+		h->unicast(from);
+	} else {
+		COUNTERS_INC(COUNTERS_NETMUX, COUNTER_DROPPED);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+{
+	const struct netmux_handler *h = handlers[in_flight];
+
+	COUNTERS_ADD(COUNTERS_NETMUX, COUNTER_RETRIES, retransmissions);
+	if(h != NULL && h->sent != NULL) {
+		h->sent(to, retransmissions);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+{
+	const struct netmux_handler *h = handlers[in_flight];
+
+	COUNTERS_ADD(COUNTERS_NETMUX, COUNTER_RETRIES, retransmissions);
+	COUNTERS_INC(COUNTERS_NETMUX, COUNTER_TIMEOUTS);
+	if(h != NULL && h->timedout != NULL) {
+		h->timedout(to, retransmissions);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static const struct broadcast_callbacks broadcast_callbacks = {recv_broadcast};
+static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
+		sent_runicast, timedout_runicast};
+/*---------------------------------------------------------------------------*/
+void
+netmux_open(void)
+{
+	if(opened) {
+		return;
+	}
+	opened = 1;
+	broadcast_open(&broadcast, NETMUX_BROADCAST_CHANNEL, &broadcast_callbacks);
+	runicast_open(&runicast, NETMUX_UNICAST_CHANNEL, &runicast_callbacks);
+}
+/*---------------------------------------------------------------------------*/
+void
+netmux_close(void)
+{
+	if(!opened) {
+		return;
+	}
+	opened = 0;
+	runicast_close(&runicast);
+	broadcast_close(&broadcast);
+}
+/*---------------------------------------------------------------------------*/
+void
+netmux_register(uint8_t type, const struct netmux_handler *handler)
+{
+	if(type < NETMUX_TYPES) {
+		handlers[type] = handler;
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+netmux_broadcast(uint8_t type)
+{
+	if(!prepend(type)) {
+		COUNTERS_INC(COUNTERS_NETMUX, COUNTER_DROPPED);
+		return 0;
+	}
+	COUNTERS_INC(COUNTERS_NETMUX, COUNTER_TX);
+	return broadcast_send(&broadcast);
+}
+/*---------------------------------------------------------------------------*/
+int
+netmux_unicast(uint8_t type, const linkaddr_t *to, uint8_t max_retransmissions)
+{
+	if(runicast_is_transmitting(&runicast) || !prepend(type)) {
+		COUNTERS_INC(COUNTERS_NETMUX, COUNTER_DROPPED);
+		return 0;
+	}
+	COUNTERS_INC(COUNTERS_NETMUX, COUNTER_TX);
+	in_flight = type;
+	return runicast_send(&runicast, to, max_retransmissions);
+}
+/*---------------------------------------------------------------------------*/
+int
+netmux_is_transmitting(void)
+{
+	return runicast_is_transmitting(&runicast);
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,68 @@
+/*
+ * netmux.h
+ *
+ * Protocol multiplexer. A node opens one broadcast and one runicast
+ * connection for everything it exchanges with its neighbors, instead of a
+ * connection per protocol on channels that every image has to agree on.
+ * Each frame starts with a one-byte type, and is handed to the handler
+ * registered for that type with the type already stripped off the
+ * packetbuf. Frames of a type nobody registered are dropped.
+ *
+ * Runicast duplicates (a retransmission whose ack got lost) are dropped
+ * here once, rather than by every protocol keeping its own history.
+ * Multihop protocols (mesh, trickle, rudolph2, rucb) keep their own
+ * channels.
+ */
+
+#ifndef NETMUX_H_
+#define NETMUX_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#define NETMUX_BROADCAST_CHANNEL 129
+#define NETMUX_UNICAST_CHANNEL 130
+
+/* Senders remembered for duplicate detection, at most; see params.h. */
+#define NETMUX_HISTORY 4
+
+/* Frame types; one list, so all images agree on them. */
+enum
+{
+	NETMUX_TYPE_ADVERTISEMENT,	/* an actuator looking for sensors */
+	NETMUX_TYPE_DATA,		/* readings and schedule replies */
+	NETMUX_TYPE_DISCOVERY,		/* hop count flood from the basestation */
+	NETMUX_TYPE_HANDSHAKE,		/* neighbor discovery of sensor.c and actuator.c */
+	NETMUX_TYPE_CLUSTER,		/* cluster head announcements */
+	NETMUX_TYPE_HANDOVER,		/* schedule state of a resigning cluster head */
+	NETMUX_TYPE_HEAD_REPLY,		/* schedule replies of a cluster head to its members */
+	NETMUX_TYPES
+};
+
+struct netmux_handler
+{
+	/* A broadcast frame arrived; NULL if the type is unicast only. */
+	void (*broadcast)(const linkaddr_t *from);
+
+	/* A runicast frame arrived; NULL if the type is broadcast only. */
+	void (*unicast)(const linkaddr_t *from);
+
+	/* The runicast frame of this type in flight was acknowledged, or not. */
+	void (*sent)(const linkaddr_t *to, uint8_t retransmissions);
+	void (*timedout)(const linkaddr_t *to, uint8_t retransmissions);
+};
+
+/* Opens the two connections; later calls do nothing. */
+void netmux_open(void);
+void netmux_close(void);
+
+void netmux_register(uint8_t type, const struct netmux_handler *handler);
+
+/* Sends the contents of the packetbuf as a frame of the given type. */
+int netmux_broadcast(uint8_t type);
+int netmux_unicast(uint8_t type, const linkaddr_t *to, uint8_t max_retransmissions);
+
+/* 1 while a runicast frame is waiting for its ack; only one can be. */
+int netmux_is_transmitting(void);
+
+#endif /* NETMUX_H_ */
@@ -0,0 +1,224 @@
+/*
+ * params.c
+ *
+ * See params.h.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "contiki.h"
+#include "cfs/cfs.h"
+#include "dev/serial-line.h"
+
+#include "params.h"
+#include "netmux.h"
+#include "netconfig.h"
+#include "dlog.h"
+
+#define PARAMS_FILE "params"
+
+/*
+ * Written after the values. Coffee takes the last byte that is not zero for
+ * the end of a file, and the last value ends in one.
+ */
+#define PARAMS_END 0x5a
+
+struct param_def
+{
+	const char *name;
+	uint16_t def;
+	uint16_t min;
+	uint16_t max;
+};
+
+static const struct param_def defs[PARAMS] = {
+	[PARAM_MAX_RETRANSMISSIONS] = {"retransmissions", MAX_RETRANSMISSIONS, 1, 15},
+	[PARAM_HISTORY_ENTRIES] = {"history", NETMUX_HISTORY, 1, NETMUX_HISTORY},
+	[PARAM_TIME_INTERVAL] = {"interval", TIME_INTERVAL, TIME_INTERVAL_MIN, TIME_INTERVAL_MAX},
+	[PARAM_MAX_NEIGHBORS] = {"neighbors", MAX_NEIGHBORS, 1, MAX_NEIGHBORS},
+};
+
+/*
+ * As kept in flash, followed by PARAMS_END; count lets a file of an older
+ * image be rejected.
+ */
+struct params_file
+{
+	uint8_t count;
+	uint16_t values[PARAMS];
+};
+
+uint16_t params[PARAMS] = {
+	[PARAM_MAX_RETRANSMISSIONS] = MAX_RETRANSMISSIONS,
+	[PARAM_HISTORY_ENTRIES] = NETMUX_HISTORY,
+	[PARAM_TIME_INTERVAL] = TIME_INTERVAL,
+	[PARAM_MAX_NEIGHBORS] = MAX_NEIGHBORS,
+};
+
+PROCESS(params_process, "params");
+
+/*---------------------------------------------------------------------------*/
+static void
+save(void)
+{
+	struct params_file f;
+	uint8_t end = PARAMS_END;
+	int fd;
+
+	memset(&f, 0, sizeof(f));
+	f.count = PARAMS;
+	memcpy(f.values, params, sizeof(f.values));
+	fd = cfs_open(PARAMS_FILE, CFS_WRITE);
+	if(fd < 0) {
+		return;
+	}
+	if(cfs_write(fd, &f, sizeof(f)) != sizeof(f) || cfs_write(fd, &end, 1) != 1) {
+		DLOG_WARN("params: not saved\n");
+	}
+	cfs_close(fd);
+}
+/*---------------------------------------------------------------------------*/
+/* Passes a change on to what was derived from the parameters. */
+static void
+changed(uint8_t id)
+{
+	if(id == PARAM_TIME_INTERVAL) {
+		netconfig_init();
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+load(void)
+{
+	struct params_file f;
+	uint8_t i, end;
+	int fd;
+
+	fd = cfs_open(PARAMS_FILE, CFS_READ);
+	if(fd < 0) {
+		return;
+	}
+	if(cfs_read(fd, &f, sizeof(f)) == sizeof(f) && cfs_read(fd, &end, 1) == 1 &&
+	   end == PARAMS_END && f.count == PARAMS) {
+		for(i = 0; i < PARAMS; i++) {
+			if(params_valid(i, f.values[i])) {
+				params[i] = f.values[i];
+			}
+		}
+	}
+	cfs_close(fd);
+}
+/*---------------------------------------------------------------------------*/
+int
+params_valid(uint8_t id, uint16_t value)
+{
+	return id < PARAMS && value >= defs[id].min && value <= defs[id].max;
+}
+/*---------------------------------------------------------------------------*/
+int
+params_set(uint8_t id, uint16_t value)
+{
+	if(!params_valid(id, value)) {
+		return 0;
+	}
+	// spare the flash when nothing changes
+	if(params[id] != value) {
+		params[id] = value;
+		save();
+		changed(id);
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+params_find(const char *name)
+{
+	uint8_t i;
+
+	for(i = 0; i < PARAMS; i++) {
+		if(strcmp(defs[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+list(void)
+{
+	uint8_t i;
+
+	for(i = 0; i < PARAMS; i++) {
+		printf("param %s %u (default %u, %u to %u)\n", defs[i].name, params[i],
+				defs[i].def, defs[i].min, defs[i].max);
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+params_command(const char *line)
+{
+	char name[16];
+	char *end;
+	const char *value;
+	long v;
+	int id;
+	uint8_t i;
+
+	if(strcmp(line, "param") == 0) {
+		list();
+		return 1;
+	}
+	if(strcmp(line, "param reset") == 0) {
+		cfs_remove(PARAMS_FILE);
+		for(i = 0; i < PARAMS; i++) {
+			if(params[i] != defs[i].def) {
+				params[i] = defs[i].def;
+				changed(i);
+			}
+		}
+		return 1;
+	}
+	if(strncmp(line, "param ", 6) != 0) {
+		return 0;
+	}
+
+	line += 6;
+	value = strchr(line, ' ');
+	if(value == NULL || value - line >= sizeof(name)) {
+		printf("usage: param [<name> <value> | reset]\n");
+		return 1;
+	}
+	memcpy(name, line, value - line);
+	name[value - line] = '\0';
+
+	id = params_find(name);
+	v = strtol(value, &end, 10);
+	if(id < 0 || end == value || v < 0 || v > 0xffff || !params_set(id, v)) {
+		printf("param: cannot set %s to %s\n", name, value + 1);
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+PROCESS_THREAD(params_process, ev, data)
+{
+	PROCESS_BEGIN();
+
+	while(1) {
+		PROCESS_WAIT_EVENT_UNTIL(ev == serial_line_event_message);
+		params_command((char *)data);
+	}
+
+	PROCESS_END();
+}
+/*---------------------------------------------------------------------------*/
+void
+params_open(int shell)
+{
+	load();
+	if(shell) {
+		process_start(&params_process, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
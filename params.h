@@ -0,0 +1,70 @@
+/*
+ * params.h
+ *
+ * Protocol parameters that can be tuned in the field without reflashing.
+ * Each has a compiled-in default and bounds; values set at runtime are
+ * kept in flash and survive a reboot.
+ *
+ * A node takes "param" (list), "param <name> <value>" and "param reset"
+ * on its serial line. The basestation takes the same commands for itself,
+ * and "param net <name> <value>" to flood a value with the next network
+ * configuration (see netconfig.h).
+ *
+ * Parameters that size a table are bounded by its compiled capacity; the
+ * runtime value only lowers the limit.
+ */
+
+#ifndef PARAMS_H_
+#define PARAMS_H_
+
+#include "contiki.h"
+
+/* Compiled-in defaults. */
+#define MAX_RETRANSMISSIONS 4
+#define TIME_INTERVAL 60
+
+/*
+ * Bounds of the reporting interval in seconds. A schedule reply puts a
+ * sensor to sleep for up to one and a half intervals, and that sleep has
+ * to fit the 16-bit clock_time_t of the sky: 1.5 * 340 * CLOCK_SECOND is
+ * 65280 ticks.
+ */
+#define TIME_INTERVAL_MIN 10
+#define TIME_INTERVAL_MAX 340
+
+/* Sensors an actuator keeps, and the capacity of its neighbor table. */
+#define MAX_NEIGHBORS 60
+
+enum
+{
+	PARAM_MAX_RETRANSMISSIONS,	/* runicast retransmissions over a link without an ETX yet */
+	PARAM_HISTORY_ENTRIES,		/* senders remembered for duplicate detection */
+	PARAM_TIME_INTERVAL,		/* reporting interval in seconds until a configuration arrives */
+	PARAM_MAX_NEIGHBORS,		/* sensors an actuator accepts */
+	PARAMS
+};
+
+extern uint16_t params[PARAMS];
+
+#define PARAM(id) (params[id])
+
+/*
+ * Loads the values kept in flash. With shell set, the commands are read
+ * from the serial line; the basestation passes 0 and calls
+ * params_command() from its own shell.
+ */
+void params_open(int shell);
+
+/* Returns 1 if value is within the bounds of parameter id. */
+int params_valid(uint8_t id, uint16_t value);
+
+/* Sets parameter id and keeps it in flash. Returns 0 if value is out of bounds. */
+int params_set(uint8_t id, uint16_t value);
+
+/* Returns the id of the parameter called name, or -1. */
+int params_find(const char *name);
+
+/* Runs a "param" command. Returns 0 if the line is not one. */
+int params_command(const char *line);
+
+#endif /* PARAMS_H_ */
@@ -0,0 +1,208 @@
+/*
+ * rules.c
+ *
+ * See rules.h.
+ */
+
+#include <stdio.h>
+
+#include "contiki.h"
+#include "dev/leds.h"
+
+#include "rules.h"
+#include "dlog.h"
+
+struct zone_aggregate
+{
+	int32_t sum;
+	uint8_t count;
+};
+
+/* The compiled rules, ordered by zone; zone z owns [zone_first[z], zone_first[z + 1]). */
+static struct rule compiled[RULES_MAX];
+static uint8_t zone_first[RULES_ZONES + 1];
+static uint8_t active[RULES_MAX];
+
+/* How many active rules drive each output bit. */
+static uint8_t output_refs[8];
+static uint8_t outputs;
+
+static struct zone_aggregate aggregates[RULES_ZONES][RULES_TYPES];
+
+rtimer_clock_t rules_wcet;
+rtimer_clock_t rules_last;
+
+/*---------------------------------------------------------------------------*/
+static void
+set_outputs(uint8_t mask, int on)
+{
+	uint8_t bit, changed = 0;
+	int i;
+
+	for(i = 0, bit = 1; i < 8; i++, bit <<= 1) {
+		if(!(mask & bit)) {
+			continue;
+		}
+		if(on) {
+			if(output_refs[i]++ == 0) changed |= bit;
+		} else if(output_refs[i] > 0) {
+			if(--output_refs[i] == 0) changed |= bit;
+		}
+	}
+
+	if(changed == 0) {
+		return;
+	}
+	outputs ^= changed;
+
+	if(changed & LEDS_ALL) {
+		leds_set((leds_get() & ~LEDS_ALL) | (outputs & LEDS_ALL));
+	}
+	if(changed & ~LEDS_ALL) {
+		// deferred, as this runs inside the timed evaluation of a reading
+		DLOG_INFO("Rules: actuator outputs now 0x%02x\n", outputs >> 3);
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+rules_load(const struct rule *table, uint8_t count)
+{
+	uint8_t i, k, z;
+
+	if(count > RULES_MAX) {
+		return 0;
+	}
+	for(i = 0; i < count; i++) {
+		if(table[i].zone >= RULES_ZONES || table[i].type >= RULES_TYPES) {
+			return 0;
+		}
+	}
+
+	// release everything the old rule set was driving
+	for(i = 0; i < zone_first[RULES_ZONES]; i++) {
+		if(active[i]) {
+			set_outputs(compiled[i].outputs, 0);
+			active[i] = 0;
+		}
+	}
+
+	// counting sort by zone, keeping the table order inside a zone
+	k = 0;
+	for(z = 0; z < RULES_ZONES; z++) {
+		zone_first[z] = k;
+		for(i = 0; i < count; i++) {
+			if(table[i].zone == z) {
+				compiled[k++] = table[i];
+			}
+		}
+	}
+	zone_first[RULES_ZONES] = k;
+
+	rules_wcet = 0;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* reading is NULL when only the zone average changed. */
+static void
+evaluate(uint8_t zone, uint8_t type, const int16_t *reading)
+{
+	struct zone_aggregate *a = &aggregates[zone][type];
+	struct rule *r;
+	int16_t input;
+	uint8_t i, on;
+
+	for(i = zone_first[zone]; i < zone_first[zone + 1]; i++) {
+		r = &compiled[i];
+		if(r->type != type) {
+			continue;
+		}
+
+		if(r->source == RULE_SOURCE_ZONE) {
+			if(a->count == 0) {
+				continue;
+			}
+			input = a->sum / a->count;
+		} else if(reading != NULL) {
+			input = *reading;
+		} else {
+			continue;
+		}
+
+		// hysteresis: the release point is moved away from the threshold
+		if(r->op == RULE_ABOVE) {
+			on = active[i] ? input > r->threshold - r->hysteresis : input > r->threshold;
+		} else {
+			on = active[i] ? input < r->threshold + r->hysteresis : input < r->threshold;
+		}
+
+		if(on != active[i]) {
+			active[i] = on;
+			set_outputs(r->outputs, on);
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+rules_reading(uint8_t zone, uint8_t type, int16_t value, const int16_t *previous)
+{
+	struct zone_aggregate *a;
+	rtimer_clock_t start;
+
+	if(zone >= RULES_ZONES || type >= RULES_TYPES) {
+		return;
+	}
+
+	start = RTIMER_NOW();
+
+	a = &aggregates[zone][type];
+	if(previous != NULL) {
+		a->sum -= *previous;
+	} else {
+		a->count++;
+	}
+	a->sum += value;
+
+	evaluate(zone, type, &value);
+
+	rules_last = RTIMER_NOW() - start;
+	if(rules_last > rules_wcet) {
+		rules_wcet = rules_last;
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+rules_forget(uint8_t zone, uint8_t type, int16_t value)
+{
+	struct zone_aggregate *a;
+	uint8_t i;
+
+	if(zone >= RULES_ZONES || type >= RULES_TYPES) {
+		return;
+	}
+
+	a = &aggregates[zone][type];
+	if(a->count == 0) {
+		return;
+	}
+	a->sum -= value;
+	a->count--;
+
+	// zone rules with nothing left to average over are released
+	if(a->count == 0) {
+		for(i = zone_first[zone]; i < zone_first[zone + 1]; i++) {
+			if(compiled[i].type == type && compiled[i].source == RULE_SOURCE_ZONE && active[i]) {
+				active[i] = 0;
+				set_outputs(compiled[i].outputs, 0);
+			}
+		}
+	} else {
+		evaluate(zone, type, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+rules_outputs(void)
+{
+	return outputs;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,82 @@
+/*
+ * rules.h
+ *
+ * Table-driven rule engine for the actuator. Each rule compares either a
+ * single reading or the average of a zone against a threshold with
+ * hysteresis, and switches a set of outputs (LEDs and external actuator
+ * outputs) while it is active. The rule table is compiled once into a flat
+ * array ordered by zone, so a reading only walks the rules of its own zone.
+ */
+
+#ifndef RULES_H_
+#define RULES_H_
+
+#include "contiki.h"
+
+#ifndef RULES_MAX
+#define RULES_MAX 16
+#endif
+
+#ifndef RULES_ZONES
+#define RULES_ZONES 4
+#endif
+
+/* Number of distinct reading types the zone aggregates are kept for. */
+#ifndef RULES_TYPES
+#define RULES_TYPES 4
+#endif
+
+enum
+{
+	RULE_ABOVE,		/* active while value > threshold */
+	RULE_BELOW		/* active while value < threshold */
+};
+
+enum
+{
+	RULE_SOURCE_READING,	/* the reading that just came in */
+	RULE_SOURCE_ZONE	/* the average of the zone */
+};
+
+/* Outputs 0-2 are the LEDs, the others are external actuator outputs. */
+#define RULE_OUT_GREEN  0x01
+#define RULE_OUT_YELLOW 0x02
+#define RULE_OUT_RED    0x04
+#define RULE_OUT_EXT(i) (0x08 << (i))
+
+struct rule
+{
+	uint8_t zone;
+	uint8_t type;
+	uint8_t source;
+	uint8_t op;
+	int16_t threshold;
+	int16_t hysteresis;
+	uint8_t outputs;
+};
+
+/* Worst case and last evaluation time in rtimer ticks. */
+extern rtimer_clock_t rules_wcet;
+extern rtimer_clock_t rules_last;
+
+/*
+ * Compiles count rules from table into the engine, replacing the previous
+ * set. All outputs are released first. Returns 0 if the table is too large
+ * or refers to an unknown zone or type.
+ */
+int rules_load(const struct rule *table, uint8_t count);
+
+/*
+ * Feeds a reading from a sensor in zone into the engine. previous is the
+ * value the same sensor contributed to the zone average before, or NULL if
+ * it did not contribute yet.
+ */
+void rules_reading(uint8_t zone, uint8_t type, int16_t value, const int16_t *previous);
+
+/* Removes a sensor's contribution from its zone average, e.g. when it went quiet. */
+void rules_forget(uint8_t zone, uint8_t type, int16_t value);
+
+/* Current state of all outputs. */
+uint8_t rules_outputs(void);
+
+#endif /* RULES_H_ */
@@ -46,238 +46,191 @@
 #include "dev/leds.h"
 
 #include <stdio.h>
-static int flag = 0;
-static int check = 0;
-/* This is the structure of broadcast messages. */
-struct broadcast_message {
-  uint8_t seqno;
-};
-
-/* This is the structure of unicast ping messages. */
-struct unicast_message {
-  uint8_t type;
-};
-
-// integer to check for timeouts
-
-
-/* This structure holds information about neighbors. */
-struct neighbor {
-  /* The ->next pointer is needed since we are placing these on a
-     Contiki list. */
-  struct neighbor *next;
-
-  /* The ->addr field holds the Rime address of the neighbor. */
-  linkaddr_t addr;
-
-  /* The ->last_rssi and ->last_lqi fields hold the Received Signal
-     Strength Indicator (RSSI) and CC2420 Link Quality Indicator (LQI)
-     values that are received for the incoming broadcast packets. */
-  uint16_t last_rssi, last_lqi;
-
-  /* Each broadcast packet contains a sequence number (seqno). The
-     ->last_seqno field holds the last sequenuce number we saw from
-     this neighbor. */
-  uint8_t last_seqno;
-
-  /* The ->avg_gap contains the average seqno gap that we have seen
-     from this neighbor. */
-  uint32_t avg_seqno_gap;
-
-};
-
-/* This #define defines the maximum amount of neighbors we can remember. */
-#define MAX_NEIGHBORS 16
-
-/* This MEMB() definition defines a memory pool from which we allocate
-   neighbor entries. */
-MEMB(neighbors_memb, struct neighbor, MAX_NEIGHBORS);
-
-/* The neighbors_list is a Contiki list that holds the neighbors we
-   have seen thus far. */
-LIST(neighbors_list);
-
-/* These hold the broadcast and unicast structures, respectively. */
-static struct broadcast_conn broadcast;
-static struct runicast_conn runicast;
-
-/* These two defines are used for computing the moving average for the
-   broadcast sequence number gaps. */
-#define SEQNO_EWMA_UNITY 0x100
-#define SEQNO_EWMA_ALPHA 0x040
-
-/*runicast vallues */
-#define MAX_RETRANSMISSIONS 4
-#define NUM_HISTORY_ENTRIES 4
+#include "dlog.h"
+#include "netmux.h"
+#include "handshake.h"
+#include "counters.h"
+#include "params.h"
+/* The actuator we join, and the slot it gave us. */
+static linkaddr_t actuator;
+static uint8_t joined;
+static uint8_t slot;
+
+/* Set from our JOIN until the JOIN_ACK of that round. */
+static uint8_t pending;
+
+/* Failed attempts so far, and requests left to sit out. */
+static uint8_t attempts;
+static uint8_t backoff;
+
+/* Requests in a row that announced a schedule we were not sent. */
+static uint8_t stale;
+
+/* Fires at the start of the mini-slot we picked. */
+static struct ctimer join_timer;
+static struct handshake_join join;
+
+/* The schedule we run: frame length in seconds and slots per frame. */
+static uint8_t schedule_version;
+static uint8_t interval;
+static uint8_t slots;
+
+/* Fires in the mini-slot our entry in the schedule frame gives us. */
+static struct ctimer confirm_timer;
+static struct handshake_confirm confirm;
 /*---------------------------------------------------------------------------*/
 PROCESS(example_broadcast_process, "Broadcast example");
 AUTOSTART_PROCESSES(&example_broadcast_process);
 /*---------------------------------------------------------------------------*/
 static void
-broadcast_recv(struct broadcast_conn *c, const linkaddr_t *from)
+send_join(void *ptr)
 {
-  char * rcv_bfr;
-  char * Request = "req";
-
-  struct neighbor *n;
-  struct broadcast_message *m;
-
-  rcv_bfr = (char *)packetbuf_dataptr();
-  if((strcmp(rcv_bfr, Request)==0) && (flag == 0))
-  {
-	     printf("broadcast message received from %d.%d: '%s'\n",
-	    		 from->u8[0], from->u8[1], rcv_bfr);
-         flag = 1;
+  handshake_copy(HANDSHAKE_OP_JOIN, &join, NULL);
+  netmux_broadcast(NETMUX_TYPE_HANDSHAKE);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_request(const linkaddr_t *from, const void *fields)
+{
+  const struct handshake_request *request = fields;
+
+  /* The actuator drops sensors that miss a schedule, and does not list
+     them in the next one. */
+  if(joined && linkaddr_cmp(from, &actuator)) {
+    stale = request->version == schedule_version ? 0 : stale + 1;
+    if(stale >= HANDSHAKE_STALE_REQUESTS) {
+      DLOG_INFO("dropped by %d.%d, joining again\n", from->u8[0], from->u8[1]);
+      joined = 0;
+      stale = 0;
+    }
+  }
+  if(joined || request->minislots == 0) {
+    return;
   }
-  if ((flag == 1) && (strcmp(rcv_bfr, Request)==0))
-  {
-	  /* Check if we already know this neighbor. */
-	  for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
-
-	    /* We break out of the loop if the address of the neighbor matches
-	       the address of the neighbor from which we received this
-	       broadcast message. */
-	    if(linkaddr_cmp(&n->addr, from)) {
-	      break;
-	    }
-	  }
-
-	  /* If n is NULL, this neighbor was not found in our list, and we
-	     allocate a new struct neighbor from the neighbors_memb memory
-	     pool. */
-	  if(n == NULL) {
-	    n = memb_alloc(&neighbors_memb);
 
-	    /* If we could not allocate a new neighbor entry, we give up. We
-	       could have reused an old neighbor entry, but we do not do this
-	       for now. */
-	    if(n == NULL) {
-	      return;
-	    }
+  /* A join that was not acknowledged by the next request collided. */
+  if(pending) {
+    pending = 0;
+    if(attempts < HANDSHAKE_BACKOFF_MAX) {
+      attempts++;
+    }
+    backoff = random_rand() % (1 << attempts);
+    DLOG_DBG("join not acknowledged, sitting out %d requests\n", backoff);
+  }
+  if(backoff > 0) {
+    backoff--;
+    return;
+  }
 
-	    /* Initialize the fields. */
-	    linkaddr_copy(&n->addr, from);
+  linkaddr_copy(&actuator, from);
+  join.actuator[0] = from->u8[0];
+  join.actuator[1] = from->u8[1];
+  join.round = request->round;
+  join.attempts = attempts;
+  pending = 1;
+  ctimer_set(&join_timer,
+             (random_rand() % request->minislots) * HANDSHAKE_MINISLOT_TIME,
+             send_join, NULL);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_join_ack(const linkaddr_t *from, const void *fields)
+{
+  const struct handshake_ack *ack = fields;
+  const struct handshake_slot *e = (const struct handshake_slot *)(ack + 1);
+  uint8_t i;
 
-	    /* Place the neighbor on the neighbor list. */
-	    list_add(neighbors_list, n);
-	  }
-	  flag = 2;
-	  printf("flag 2 is triggered \n");
+  if(!pending || !linkaddr_cmp(from, &actuator)) {
+    return;
+  }
+  for(i = 0; i < ack->count; i++, e++) {
+    if(e->addr[0] == linkaddr_node_addr.u8[0] && e->addr[1] == linkaddr_node_addr.u8[1]) {
+      joined = 1;
+      pending = 0;
+      stale = 0;
+      slot = e->slot;
+      DLOG_INFO("joined %d.%d after %d collisions, slot %d\n",
+                from->u8[0], from->u8[1], attempts, slot);
+      attempts = 0;
+      return;
+    }
   }
-  rcv_bfr = "null";
 }
-
-/* history */
-struct history_entry {
-  struct history_entry *next;
-  linkaddr_t addr;
-  uint8_t seq;
-};
-LIST(history_table);
-MEMB(history_mem, struct history_entry, NUM_HISTORY_ENTRIES);
 /*---------------------------------------------------------------------------*/
 static void
-recv_runicast(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+send_confirm(void *ptr)
 {
-  char * receive_msg;
-  struct runicast_message *msg;
-  /* OPTIONAL: Sender history */
-  struct history_entry *e = NULL;
-  for(e = list_head(history_table); e != NULL; e = e->next) {
-    if(linkaddr_cmp(&e->addr, from)) {
+  handshake_copy(HANDSHAKE_OP_CONFIRM, &confirm, NULL);
+  netmux_broadcast(NETMUX_TYPE_HANDSHAKE);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv_schedule(const linkaddr_t *from, const void *fields)
+{
+  const struct handshake_schedule *schedule = fields;
+  const struct handshake_slot *e = (const struct handshake_slot *)(schedule + 1);
+  uint8_t i;
+
+  if(!joined || !linkaddr_cmp(from, &actuator)) {
+    return;
+  }
+  for(i = 0; i < schedule->count; i++, e++) {
+    if(e->addr[0] == linkaddr_node_addr.u8[0] && e->addr[1] == linkaddr_node_addr.u8[1]) {
       break;
     }
   }
-  if(e == NULL) {
-    /* Create new history entry */
-    e = memb_alloc(&history_mem);
-    if(e == NULL) {
-      e = list_chop(history_table); /* Remove oldest at full history */
-    }
-    linkaddr_copy(&e->addr, from);
-    e->seq = seqno;
-    list_push(history_table, e);
-  } else {
-    /* Detect duplicate callback */
-    if(e->seq == seqno) {
-      printf("runicast message received from %d.%d, seqno %d (DUPLICATE)\n",
-	     from->u8[0], from->u8[1], seqno);
-      return;
-    }
-    /* Update existing history entry */
-    e->seq = seqno;
+  /* Not listed: we confirmed this version already. */
+  if(i == schedule->count) {
+    return;
   }
 
-    /* Grab the pointer to the incoming data. */
-    receive_msg = packetbuf_dataptr();
-
-  receive_msg = packetbuf_dataptr();
-  printf("runicast received with message %s\n",receive_msg);
-  /* We have two message types, UNICAST_TYPE_PING and
-	 UNICAST_TYPE_PONG. If we receive a UNICAST_TYPE_PING message, we
-	 print out a message and return a UNICAST_TYPE_PONG. */
+  if(schedule->version != schedule_version) {
+    schedule_version = schedule->version;
+    interval = schedule->interval;
+    slots = schedule->slots;
+    slot = e->slot;
+    DLOG_INFO("schedule %d: slot %d of %d, %d s frames\n",
+              schedule_version, slot, slots, interval);
+  }
 
-  receive_msg = "null";
+  /* The i-th sensor listed confirms in the i-th mini-slot after the frame. */
+  confirm.actuator[0] = from->u8[0];
+  confirm.actuator[1] = from->u8[1];
+  confirm.version = schedule->version;
+  ctimer_set(&confirm_timer, i * HANDSHAKE_MINISLOT_TIME, send_confirm, NULL);
 }
-static const struct broadcast_callbacks broadcast_call = {broadcast_recv};
-static struct broadcast_conn broadcast;
+/*---------------------------------------------------------------------------*/
+/* Opcodes the sensor answers to. */
+static const struct handshake_op handshake_ops[HANDSHAKE_OPS] = {
+  [HANDSHAKE_OP_REQUEST] = {recv_request},
+  [HANDSHAKE_OP_JOIN_ACK] = {recv_join_ack},
+  [HANDSHAKE_OP_SCHEDULE] = {recv_schedule},
+};
 
-// runicast shizzle
-static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
-{
-  printf("runicast message sent to %d.%d, retransmissions %d\n",
-	 to->u8[0], to->u8[1], retransmissions);
-}
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+recv_handshake(const linkaddr_t *from)
 {
-  printf("runicast message timed out when sending to %d.%d, retransmissions %d\n",
-	 to->u8[0], to->u8[1], retransmissions);
+  handshake_dispatch(handshake_ops, from);
 }
-static const struct runicast_callbacks runicast_callbacks = {recv_runicast,
-							     sent_runicast,
-							     timedout_runicast};
-static struct runicast_conn runicast;
+
+static const struct netmux_handler handshake_handler = {recv_handshake,
+							   NULL,
+							   NULL,
+							   NULL};
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(example_broadcast_process, ev, data)
 {
-  static struct etimer et;
-  struct unicast_message msg;
-  struct neighbor *n;
-  char * message = "address";
-  int randneighbor, i;
-
-  PROCESS_EXITHANDLER(broadcast_close(&broadcast);)
+  PROCESS_EXITHANDLER(netmux_close();)
 
   PROCESS_BEGIN();
 
-  broadcast_open(&broadcast, 129, &broadcast_call);
-
+  params_open(1);
+  netmux_open();
+  netmux_register(NETMUX_TYPE_HANDSHAKE, &handshake_handler);
+  counters_open(NULL);
 
   while(1) {
-	  etimer_set(&et,  CLOCK_SECOND * 2 + random_rand() % (CLOCK_SECOND * 4));
-
-	  PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
-	  switch(flag)
-	  {
-	  case 0:
-	  break;
-	  case 2:
-		  runicast_open(&runicast, 146, &runicast_callbacks);
-	      randneighbor = random_rand() % list_length(neighbors_list);
-          n = list_head(neighbors_list);
-
-          printf("sending runicast to %d.%d with message %s\n", n->addr.u8[0], n->addr.u8[1],message);
-
-          packetbuf_copyfrom(message, (strlen(message)+1));
-          runicast_send(&runicast, &n->addr, MAX_RETRANSMISSIONS);
-          flag = 3;
-	  break;
-	  default:
-	  break;
-	  }
-
+    PROCESS_YIELD();
   }
 
   PROCESS_END();
@@ -12,6 +12,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "contiki.h"
 #include "net/rime/rime.h"
@@ -27,52 +28,391 @@
 #include "sensor_data_sender.h"
 #include "sensor_node_setup.h"
 #include "../mycommon.h"
+#include "../logbuf.h"
+#include "../dlog.h"
+#include "../topology.h"
+#include "../fwdqueue.h"
+#include "../channel.h"
+#include "../cluster.h"
+#include "../netmux.h"
+#include "../counters.h"
+#include "../params.h"
+#include "../warmstart.h"
 #include "sensor.h";
 
-MEMB(history_mem, struct history_entry, NUM_HISTORY_ENTRIES);
-LIST(history_table);
+linkaddr_t actuator_address;
 
+/* Set while we listen for actuator advertisements. */
+static uint8_t waiting_for_actuator;
 
-linkaddr_t *actuator_address;
+/* Our TDMA slot, as the last schedule reply gave it. */
+static uint8_t schedule_slot;
 
+/* Set after a reset that resumed from a checkpoint, until the first reading. */
+static uint8_t resumed;
+
+/* How fast our clock runs against the actuator's, in milliseconds a day. */
+static int16_t drift;
+
+/* Drift corrections too small for a tick yet, in microseconds. */
+static int32_t sleep_owed;
+static int32_t urgent_owed;
+
+static struct deadband_filter report_filter;
+
+/* Readings waiting for the radio, alarms first. */
+static struct fwdqueue outbox;
+
+/* Fires at the start of every TDMA frame, in the slot reserved for alarms. */
+static struct ctimer urgent_timer;
+
+/* Set while the reading is above the alarm threshold. */
+static uint8_t alarm_raised;
+
+/* Bounds the wait for a schedule reply on the data channel. */
+static struct ctimer listen_timer;
+
+#if SENSOR_CLUSTERS
+/*
+ * Slots we handed out as cluster head. They are the schedule state a
+ * handover passes on, and are kept afterwards so a member that has not
+ * moved on to the new head yet is still answered.
+ */
+struct member
+{
+	linkaddr_t addr;
+	uint8_t slot;
+};
+
+#define MEMBERS_MAX (CLUSTER_STATE_MAX / sizeof(struct member))
+
+static struct member members[MEMBERS_MAX];
+static uint8_t member_count;
+
+/*
+ * Schedule replies to members waiting for the radio, one per member. They
+ * have a type of their own, so their acks do not take our own readings off
+ * the outbox.
+ */
+static struct fwdqueue replies;
+#endif /* SENSOR_CLUSTERS */
+
+/*---------------------------------------------------------------------------*/
+static int16_t
+read_value(void)
+{
+	return random_rand() % 10;
+}
+
+static void
+leave_data_channel(void *ptr)
+{
+	channel_select(CHANNEL_CONTROL);
+}
+
+// Readings go out on the data channel of our cluster once we have a slot in
+// it; before that they are join requests and go out on the control channel.
+static void
+send_next(void)
+{
+	struct fwdqueue_entry *e = fwdqueue_head(&outbox);
+
+	if(e == NULL || netmux_is_transmitting()) {
+		return;
+	}
+	ctimer_stop(&listen_timer);
+	channel_select(schedule_set ? channel_data : CHANNEL_CONTROL);
+	packetbuf_copyfrom(e->data, e->len);
+	netmux_unicast(NETMUX_TYPE_DATA, &actuator_address,
+			topology_budget(&actuator_address, e->priority, PARAM(PARAM_MAX_RETRANSMISSIONS)));
+}
+
+static void
+send_reading(uint8_t priority, int16_t value)
+{
+	struct runicast_message msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.type = RUNICAST_TYPE_TEMP;
+	msg.priority = priority;
+	msg.data = value;
+	if(fwdqueue_put(&outbox, msg.type, priority, &msg, sizeof(msg)) == FWDQUEUE_DROPPED) {
+		DLOG_WARN("Outgoing queue full, reading %d dropped\n", value);
+	}
+	send_next();
+}
+
+/*
+ * Ticks for a sleep of ms milliseconds of actuator time on our clock. The
+ * corrections smaller than a tick are kept in owed until they add up.
+ */
+static clock_time_t
+compensate(uint32_t ms, int32_t *owed)
+{
+	int32_t ticks;
+
+	*owed += (int32_t)(ms / 1000) * drift * 10 / 864;
+	ticks = *owed / (1000000L / CLOCK_SECOND);
+	*owed -= ticks * (1000000L / CLOCK_SECOND);
+	return ms * CLOCK_SECOND / 1000 + ticks;
+}
+
+// A reading that crosses the alarm threshold between our own slots goes out
+// in the urgent slot of the next frame instead of waiting up to a whole frame.
+static void
+urgent_slot(void *ptr)
+{
+	int16_t value = read_value();
+
+	ctimer_set(&urgent_timer, compensate((uint32_t)netconfig.time_interval * 1000, &urgent_owed),
+			urgent_slot, NULL);
+
+	if(value > ALARM_THRESHOLD && !alarm_raised) {
+		DLOG_WARN("Alarm: reading %d, sending in the urgent slot\n", value);
+		send_reading(PRIORITY_ALARM, value);
+	}
+	alarm_raised = value > ALARM_THRESHOLD;
+}
+
+#if SENSOR_CLUSTERS
+/*---------------------------------------------------------------------------*/
+// As cluster head we do for our members what an actuator does for its sensors.
+// The time to the slot is worked out when the reply actually goes out, so
+// the time it spent in the queue does not shift the member off its slot.
+static void
+send_next_reply(void)
+{
+	struct fwdqueue_entry *e = fwdqueue_head(&replies);
+	struct runicast_message reply;
+	linkaddr_t to;
+	uint8_t i;
+
+	if(e == NULL || netmux_is_transmitting()) {
+		return;
+	}
+	memcpy(&to, e->data, sizeof(to));
+	for(i = 0; i < member_count; i++) {
+		if(linkaddr_cmp(&members[i].addr, &to)) {
+			break;
+		}
+	}
+	if(i == member_count) {
+		fwdqueue_pop(&replies);
+		send_next_reply();
+		return;
+	}
+
+	int interval = netconfig.time_interval;
+	int next_time = interval - (clock_seconds() % interval - TDMA_SLOT_OFFSET(members[i].slot, interval));
+	if(next_time < interval / 2) next_time += interval;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.type = RUNICAST_TYPE_SCHEDULE;
+	reply.priority = PRIORITY_CONTROL;
+	reply.data = next_time;
+	reply.slot = members[i].slot;
+	reply.channel = channel_data;
+
+	packetbuf_copyfrom(&reply, sizeof(reply));
+	netmux_unicast(NETMUX_TYPE_HEAD_REPLY, &to,
+			topology_budget(&to, PRIORITY_CONTROL, PARAM(PARAM_MAX_RETRANSMISSIONS)));
+}
+
+static void
+head_reading(const linkaddr_t *from, const struct runicast_message *m)
+{
+	struct log_record record;
+	uint8_t i;
+
+	record.time = clock_seconds();
+	linkaddr_copy(&record.source, from);
+	record.type = m->type;
+	record.value = m->data;
+	logbuf_append(&record);
+
+	if(m->priority == PRIORITY_ALARM) {
+		DLOG_WARN("Alarm from member %d: %d\n", from->u16, m->data);
+		return;
+	}
+
+	for(i = 0; i < member_count; i++) {
+		if(linkaddr_cmp(&members[i].addr, from)) {
+			break;
+		}
+	}
+	if(i == member_count) {
+		if(member_count == MEMBERS_MAX) {
+			DLOG_WARN("Cluster full, no slot for %d\n", from->u16);
+			return;
+		}
+		linkaddr_copy(&members[i].addr, from);
+		members[i].slot = TDMA_URGENT_SLOTS + i;
+		member_count++;
+	}
+
+	if(fwdqueue_put(&replies, from->u16, PRIORITY_CONTROL, from, sizeof(*from)) == FWDQUEUE_DROPPED) {
+		DLOG_WARN("Reply queue full, member %d not answered\n", from->u16);
+	}
+	send_next_reply();
+}
+
+static void
+sent_reply(const linkaddr_t *to, uint8_t retransmissions)
+{
+	topology_sent(to, retransmissions + 1, 1);
+	fwdqueue_pop(&replies);
+	send_next_reply();
+	send_next();
+}
+
+static void
+timedout_reply(const linkaddr_t *to, uint8_t retransmissions)
+{
+	DLOG_WARN("Schedule reply to member %d timed out, attempts: %d\n",
+			to->u16, retransmissions);
+	topology_sent(to, retransmissions + 1, 0);
+	fwdqueue_pop(&replies);
+	send_next_reply();
+	send_next();
+}
+
+// Members take the reply like one from an actuator.
+static const struct netmux_handler head_reply_handler = {NULL, recv_runicast_schedule,
+							sent_reply, timedout_reply};
+
+static void
+cluster_joined(const linkaddr_t *head)
+{
+	if(linkaddr_cmp(head, &linkaddr_node_addr)) {
+		DLOG_INFO("Cluster head now, %d members\n", member_count);
+	} else {
+		DLOG_INFO("Joining cluster head %d\n", head->u16);
+		// members keep their slot, the new head knows it
+		linkaddr_copy(&actuator_address, head);
+	}
+
+	if(!process_is_running(&data_sender_process)) {
+		process_start(&data_sender_process, NULL);
+	}
+}
+
+static int
+cluster_save(uint8_t *buf, int max)
+{
+	int len = member_count * sizeof(struct member);
+
+	len = len < max ? len : max;
+	memcpy(buf, members, len);
+	return len;
+}
+
+static void
+cluster_load(const uint8_t *buf, int len)
+{
+	len = len < sizeof(members) ? len : sizeof(members);
+	memcpy(members, buf, len);
+	member_count = len / sizeof(struct member);
+}
+
+static const struct cluster_callbacks cluster_callbacks = {cluster_joined, cluster_save, cluster_load};
+#endif /* SENSOR_CLUSTERS */
 
 // Receive new time delay.
 static void
-recv_runicast_schedule(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
+recv_runicast_schedule(const linkaddr_t *from)
 {
 	struct runicast_message *received_msg = packetbuf_dataptr();
 
-	printf("Runicast received from actuator with address %d, data: %d\n",
+	topology_heard(from);
+
+	DLOG_INFO("Runicast received from actuator with address %d, data: %d\n",
 			from->u16, received_msg->data);
 
 	if (received_msg->type == RUNICAST_TYPE_SCHEDULE)
 	{
+		// A newer configuration from the basestation may ride along.
+		if(packetbuf_datalen() >= sizeof(struct runicast_message) + sizeof(struct netconfig)) {
+			struct netconfig config;
+
+			memcpy(&config, (uint8_t *)packetbuf_dataptr() + sizeof(struct runicast_message), sizeof(config));
+			if(netconfig_apply(&config)) {
+				DLOG_INFO("Configuration version %d applied: interval %u, dead-band %d\n",
+						netconfig.version, netconfig.time_interval, netconfig.deadband);
+			}
+		}
+
 		schedule_set = 1;
-		time_delay = (clock_time_t)(received_msg->data);
-		printf("Should send again in %lu seconds\n", time_delay);
-		time_delay *= 1000;
-		process_post(&data_sender_process, NEW_TIMER_RECEIVED_EVENT, time_delay);
+		time_delay = (uint16_t)received_msg->data;
+
+		// the exchange is over, back to the control channel until our next slot
+		channel_set_data(received_msg->channel);
+		schedule_slot = received_msg->slot;
+		warmstart_touch();
+		ctimer_stop(&listen_timer);
+		channel_select(CHANNEL_CONTROL);
+
+		// our slot is this far into its frame, so the frame starts before it
+		int frame_start = ((int)time_delay - TDMA_SLOT_OFFSET(received_msg->slot, netconfig.time_interval))
+				% netconfig.time_interval;
+		ctimer_set(&urgent_timer, CLOCK_SECOND * (frame_start > 0 ? frame_start : netconfig.time_interval),
+				urgent_slot, NULL);
+
+		DLOG_INFO("Should send again in %lu seconds\n", (unsigned long)time_delay);
+		time_delay = time_delay * 1000 + received_msg->data_ms;
+
+		// the reply puts us back on time, its drift keeps us there
+		drift = received_msg->drift;
+		sleep_owed = 0;
+		urgent_owed = 0;
+		process_post(&data_sender_process, NEW_TIMER_RECEIVED_EVENT, NULL);
+	}
+#if SENSOR_CLUSTERS
+	else if(received_msg->type == RUNICAST_TYPE_TEMP || received_msg->type == RUNICAST_TYPE_HUMID)
+	{
+		head_reading(from, received_msg);
 	}
+#endif
 	else
 	{
-		printf("I received a runicast message that was not for me!\n");
+		DLOG_WARN("I received a runicast message that was not for me!\n");
 	}
 }
 
 static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+sent_runicast(const linkaddr_t *to, uint8_t retransmissions)
 {
 
-	printf("Runicast message sent to %d, attempts: %d\n",
+	DLOG_DBG("Runicast message sent to %d, attempts: %d\n",
 			to->u16, retransmissions);
+	topology_sent(to, retransmissions + 1, 1);
+
+	// telemetry is answered with a schedule, an alarm is not
+	struct fwdqueue_entry *e = fwdqueue_head(&outbox);
+	if(e != NULL && e->priority == PRIORITY_ALARM) {
+		channel_select(CHANNEL_CONTROL);
+	} else {
+		ctimer_set(&listen_timer, SCHEDULE_WAIT, leave_data_channel, NULL);
+	}
+	fwdqueue_pop(&outbox);
+	send_next();
+#if SENSOR_CLUSTERS
+	send_next_reply();
+#endif
 
 }
 
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions)
+timedout_runicast(const linkaddr_t *to, uint8_t retransmissions)
 {
-	printf("Runicast message timed out when sending to %d, attempts: %d\n",
+	DLOG_WARN("Runicast message timed out when sending to %d, attempts: %d\n",
 			to->u16, retransmissions);
+	topology_sent(to, retransmissions + 1, 0);
+	channel_select(CHANNEL_CONTROL);
+	fwdqueue_pop(&outbox);
+	send_next();
+#if SENSOR_CLUSTERS
+	send_next_reply();
+#endif
 }
 
 
@@ -82,24 +422,78 @@ timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retrans
  */
 
 static void
-recv_broadcast_actuator_adv(struct broadcast_conn *c, const linkaddr_t *from)
+recv_broadcast_actuator_adv(const linkaddr_t *from)
 {
+	if(!waiting_for_actuator) {
+		return;
+	}
+
     leds_toggle(LEDS_ALL); // toggle all leds
 
     linkaddr_copy(&actuator_address, from);
+    topology_heard(from);
+    warmstart_touch();
 
 	char * received_msg = packetbuf_dataptr();
 
-	printf("Receiving an actuator advertisement from %d\n", from->u16);
+	DLOG_INFO("Receiving an actuator advertisement from %d\n", from->u16);
 //	printf("Received: %s\n", received_msg);
 
     // Start data sending process.
     process_start(&data_sender_process, NULL);
 
-    // remove the broadcast listener.
-	broadcast_close(&broadcast);
+    // stop listening for advertisements.
+	waiting_for_actuator = 0;
+}
+
+/* What a sensor resumes with after a reset, see warmstart.h. */
+struct sensor_checkpoint
+{
+	uint8_t actuator[2];
+	uint8_t slot;
+	uint8_t channel;
+	int16_t drift;
+	struct netconfig config;
+};
+
+static int
+checkpoint_save(uint8_t *buf, int max)
+{
+	struct sensor_checkpoint cp;
+
+	if(waiting_for_actuator || sizeof(cp) > max) {
+		return 0;
+	}
+	cp.actuator[0] = actuator_address.u8[0];
+	cp.actuator[1] = actuator_address.u8[1];
+	cp.slot = schedule_slot;
+	cp.channel = channel_data;
+	cp.drift = drift;
+	memcpy(&cp.config, &netconfig, sizeof(cp.config));
+	memcpy(buf, &cp, sizeof(cp));
+	return sizeof(cp);
+}
+
+static void
+checkpoint_load(const uint8_t *buf, int len)
+{
+	struct sensor_checkpoint cp;
+
+	if(len != sizeof(cp)) {
+		return;
+	}
+	memcpy(&cp, buf, sizeof(cp));
+	actuator_address.u8[0] = cp.actuator[0];
+	actuator_address.u8[1] = cp.actuator[1];
+	schedule_slot = cp.slot;
+	channel_set_data(cp.channel);
+	drift = cp.drift;
+	netconfig_apply(&cp.config);
+	resumed = 1;
 }
 
+static const struct warmstart_callbacks warmstart_callbacks = {checkpoint_save, checkpoint_load};
+
 /*---------------------------------------------------------------------------*/
 // Setup the network when button is pressed.
 
@@ -111,20 +505,40 @@ AUTOSTART_PROCESSES(&sensor_node_setup_process);
 PROCESS_THREAD(sensor_node_setup_process, ev, data)
 {
 
-	PROCESS_EXITHANDLER(runicast_close(&runicast);)
+	PROCESS_EXITHANDLER(netmux_close();)
 	PROCESS_BEGIN();
 
 	SENSORS_ACTIVATE(button_sensor);
 	SENSORS_ACTIVATE(light_sensor); // activate sensor
 
+	params_open(1);
+	netconfig_init();
+	logbuf_open(NULL);
+	topology_open(NULL);
+	counters_open(NULL);
+	netmux_open();
+	netmux_register(NETMUX_TYPE_ADVERTISEMENT, &actuator_adv_handler);
+	netmux_register(NETMUX_TYPE_DATA, &schedule_handler);
+#if SENSOR_CLUSTERS
+	fwdqueue_init(&replies);
+	netmux_register(NETMUX_TYPE_HEAD_REPLY, &head_reply_handler);
+	cluster_open(&cluster_callbacks);
+#endif
+
+	// after a reset we go back to the actuator we had, without the button
+	if(warmstart_open(&warmstart_callbacks)) {
+		DLOG_INFO("Resuming with actuator %d, slot %d\n", actuator_address.u16, schedule_slot);
+		process_start(&data_sender_process, NULL);
+		PROCESS_WAIT_EVENT_UNTIL(ev == sensors_event && data == &button_sensor);
+	}
 
 	while(1) {
 		// Wait for broadcast from actuator.
 
 	    process_exit(&data_sender_process);
 
-		printf("Waiting for an actuator advertisement.\n");
-		broadcast_open(&broadcast, 129, &actuator_adv_broadcast_callbacks);
+		DLOG_INFO("Waiting for an actuator advertisement.\n");
+		waiting_for_actuator = 1;
 
 		PROCESS_WAIT_EVENT_UNTIL(ev == sensors_event && data == &button_sensor); // wait for button press event
 	}
@@ -137,44 +551,80 @@ PROCESS(data_sender_process, "Data Sender");
 /*---------------------------------------------------------------------------*/
 PROCESS_THREAD(data_sender_process, ev, data)
 {
-	PROCESS_EXITHANDLER(runicast_close(&runicast);)
 	PROCESS_BEGIN();
 
-
-	runicast_open(&runicast, 130, &runicast_schedule_callbacks);
+	deadband_filter_init(&report_filter);
+	fwdqueue_init(&outbox);
 
 	while(1)
 	{
-		if(!schedule_set) {
+		if(!schedule_set && resumed) {
+			// back from a reset, ask the actuator for our slot right away
+			time_delay = abs(random_rand() % 2000);
+			resumed = 0;
+		} else if(!schedule_set) {
 			// Random time between 5 and 15 seconds
 			time_delay = 5000 + (abs(random_rand() % 10000));
 			//time_delay = 5000;
 
-			printf("Will wait for a schedule for a random time (%lu seconds) before retrying.\n", time_delay / 1000);
+			DLOG_INFO("Will wait for a schedule for a random time (%lu seconds) before retrying.\n", (unsigned long)(time_delay / 1000));
 		}
 
+		// the correction is worked on a copy and only kept for a sleep that
+		// ran its course
 		static struct etimer et;
-		etimer_set(&et,  (time_delay * CLOCK_SECOND) / 1000);
+		static int32_t owed;
+		owed = sleep_owed;
+		etimer_set(&et, compensate(time_delay, &owed));
 
 		// Wait either for a timeout or for an event from the schedule receiver.
 		PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et) || ev == NEW_TIMER_RECEIVED_EVENT);
 
 		if(ev == NEW_TIMER_RECEIVED_EVENT) {
-			// time_delay = data;
-
-			printf("Sleeping for %lu seconds.\n", time_delay / 1000);
-			SLEEP_THREAD(time_delay);
+			DLOG_INFO("Sleeping for %lu seconds.\n", (unsigned long)(time_delay / 1000));
+			owed = sleep_owed;
+			etimer_set(&et, compensate(time_delay, &owed));
+			PROCESS_WAIT_EVENT_UNTIL(etimer_expired(&et));
 		}
+		sleep_owed = owed;
 
 		struct runicast_message msg;
 
-		printf("Sending data to actuator\n", actuator_address->u16);
-
 		msg.type = RUNICAST_TYPE_TEMP;
-		msg.data = random_rand() % 10;
+		msg.data = read_value();
+		alarm_raised = msg.data > ALARM_THRESHOLD;
+		msg.priority = alarm_raised ? PRIORITY_ALARM : PRIORITY_TELEMETRY;
+
+		// Every reading is logged, including the ones the dead-band suppresses.
+		struct log_record record;
+		record.time = clock_seconds();
+		linkaddr_copy(&record.source, &linkaddr_node_addr);
+		record.type = msg.type;
+		record.value = msg.data;
+		logbuf_append(&record);
+
+#if SENSOR_CLUSTERS
+		// a head keeps its own readings in its log with those of its members
+		if(cluster_is_head()) {
+			schedule_set = 1;
+			time_delay = (uint32_t)netconfig.time_interval * 1000;
+			continue;
+		}
+#endif
+
+		// Until we have a schedule every reading doubles as a join request.
+		// Alarms are never held back by the dead-band.
+		if(!alarm_raised && schedule_set && !deadband_filter_check(&report_filter, msg.data)) {
+			DLOG_INFO("Reading %d inside the dead-band, not reporting.\n", msg.data);
+
+			// Stay on our slot: the next reading is due one interval from now.
+			time_delay = (uint32_t)netconfig.time_interval * 1000;
+			continue;
+		}
+
+		DLOG_INFO("Sending data to actuator %d\n", actuator_address.u16);
 
-		packetbuf_copyfrom(&msg, sizeof(msg));
-		runicast_send(&runicast, &actuator_address, MAX_RETRANSMISSIONS);
+		send_reading(msg.priority, msg.data);
 
 	}
 
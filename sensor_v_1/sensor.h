@@ -8,23 +8,39 @@
 #ifndef SENSOR_H_
 #define SENSOR_H_
 
+/*
+ * Without actuators the sensors elect cluster heads among themselves (see
+ * cluster.h) and the head collects the readings of its members.
+ */
+#ifndef SENSOR_CLUSTERS
+#define SENSOR_CLUSTERS 0
+#endif
+
+/* Readings above this are alarms. */
+#ifndef ALARM_THRESHOLD
+#define ALARM_THRESHOLD 8
+#endif
+
+/* How long to listen for a schedule reply on the data channel. */
+#define SCHEDULE_WAIT (CLOCK_SECOND * 2)
+
 static void
-recv_runicast_schedule(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno);
+recv_runicast_schedule(const linkaddr_t *from);
 
 static void
-sent_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
+sent_runicast(const linkaddr_t *to, uint8_t retransmissions);
 
 static void
-timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retransmissions);
+timedout_runicast(const linkaddr_t *to, uint8_t retransmissions);
 
 static void
-recv_broadcast_actuator_adv(struct broadcast_conn *c, const linkaddr_t *from);
+recv_broadcast_actuator_adv(const linkaddr_t *from);
 
 
 
-static const struct broadcast_callbacks actuator_adv_broadcast_callbacks = {recv_broadcast_actuator_adv};
+static const struct netmux_handler actuator_adv_handler = {recv_broadcast_actuator_adv, NULL, NULL, NULL};
 
-static const struct runicast_callbacks runicast_schedule_callbacks = {recv_runicast_schedule,
+static const struct netmux_handler schedule_handler = {NULL, recv_runicast_schedule,
 							     	 	 	 	 	 	 	 sent_runicast,
 															 timedout_runicast};
 
@@ -10,6 +10,7 @@
 
 #include "contiki.h"
 #include "../mycommon.h"
+#include "../dlog.h"
 #include "net/rime/rime.h"
 
 #include "lib/list.h"
@@ -74,7 +75,7 @@ PROCESS_THREAD(sensor_node_setup_process, ev, data)
 		// Wait for broadcast from actuator.
 		broadcast_open(&broadcast, 129, &broadcast_callbacks);
 
-		printf("sensor_cast_process: waiting for daddy_addr\n");
+		DLOG_INFO("sensor_cast_process: waiting for daddy_addr\n");
 	}
 
 	PROCESS_END();
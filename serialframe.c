@@ -0,0 +1,108 @@
+/*
+ * serialframe.c
+ *
+ * See serialframe.h.
+ */
+
+#include <stdio.h>
+
+#include "contiki.h"
+#include "lib/crc16.h"
+
+#include "serialframe.h"
+
+static uint8_t batch[FRAME_READINGS_HEADER + FRAME_READINGS_MAX * FRAME_READING_SIZE];
+static uint8_t batch_count;
+static struct ctimer flush_timer;
+
+/*---------------------------------------------------------------------------*/
+static void
+put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xff;
+	p[1] = v >> 8;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v & 0xffff);
+	put16(p + 2, v >> 16);
+}
+/*---------------------------------------------------------------------------*/
+static void
+slip_put(uint8_t c)
+{
+	if(c == FRAME_END) {
+		putchar(FRAME_ESC);
+		putchar(FRAME_ESC_END);
+	} else if(c == FRAME_ESC) {
+		putchar(FRAME_ESC);
+		putchar(FRAME_ESC_ESC);
+	} else {
+		putchar(c);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+serialframe_send(uint8_t type, const uint8_t *payload, uint16_t len)
+{
+	uint16_t crc, i;
+
+	if(len > FRAME_MAX_SIZE - 3) {
+		return;
+	}
+
+	// a leading END flushes any line noise on the receiver side
+	putchar(FRAME_END);
+
+	crc = crc16_add(type, 0);
+	slip_put(type);
+	for(i = 0; i < len; i++) {
+		crc = crc16_add(payload[i], crc);
+		slip_put(payload[i]);
+	}
+	slip_put(crc & 0xff);
+	slip_put(crc >> 8);
+
+	putchar(FRAME_END);
+}
+/*---------------------------------------------------------------------------*/
+void
+serialframe_flush(void)
+{
+	if(batch_count == 0) {
+		return;
+	}
+	ctimer_stop(&flush_timer);
+
+	put32(batch, clock_seconds());
+	batch[4] = batch_count;
+	serialframe_send(FRAME_TYPE_READINGS, batch,
+			FRAME_READINGS_HEADER + batch_count * FRAME_READING_SIZE);
+	batch_count = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+flush_timeout(void *ptr)
+{
+	serialframe_flush();
+}
+/*---------------------------------------------------------------------------*/
+void
+serialframe_reading(const linkaddr_t *source, uint8_t type, int16_t value)
+{
+	uint8_t *p = batch + FRAME_READINGS_HEADER + batch_count * FRAME_READING_SIZE;
+
+	p[0] = source->u8[0];
+	p[1] = source->u8[1];
+	p[2] = type;
+	put16(p + 3, value);
+
+	if(++batch_count == FRAME_READINGS_MAX) {
+		serialframe_flush();
+	} else if(batch_count == 1) {
+		ctimer_set(&flush_timer, SERIALFRAME_DELAY, flush_timeout, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,30 @@
+/*
+ * serialframe.h
+ *
+ * Binary export of readings over the serial line, see frame.h for the
+ * format. Readings are batched and go out together once a frame is full or
+ * SERIALFRAME_DELAY after the first reading of the batch.
+ */
+
+#ifndef SERIALFRAME_H_
+#define SERIALFRAME_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+#include "frame.h"
+
+#ifndef SERIALFRAME_DELAY
+#define SERIALFRAME_DELAY (CLOCK_SECOND / 4)
+#endif
+
+/* Queues a reading for the next frame. */
+void serialframe_reading(const linkaddr_t *source, uint8_t type, int16_t value);
+
+/* Sends the queued readings now. */
+void serialframe_flush(void);
+
+/* Sends a frame with the given type and payload right away. */
+void serialframe_send(uint8_t type, const uint8_t *payload, uint16_t len);
+
+#endif /* SERIALFRAME_H_ */
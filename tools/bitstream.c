@@ -0,0 +1,59 @@
+/*
+ * bitstream.c
+ *
+ * See bitstream.h.
+ */
+
+#include <string.h>
+
+#include "bitstream.h"
+
+/*---------------------------------------------------------------------------*/
+void
+bitwriter_init(struct bitwriter *w, uint8_t *buf, size_t size)
+{
+	w->buf = buf;
+	w->size = size;
+	w->bits = 0;
+	memset(buf, 0, size);
+}
+/*---------------------------------------------------------------------------*/
+int
+bitwriter_put(struct bitwriter *w, uint64_t v, int n)
+{
+	int i;
+
+	if(w->bits + n > w->size * 8) {
+		return 0;
+	}
+	for(i = n - 1; i >= 0; i--, w->bits++) {
+		if((v >> i) & 1) {
+			w->buf[w->bits / 8] |= 0x80 >> (w->bits % 8);
+		}
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+bitreader_init(struct bitreader *r, const uint8_t *buf, size_t size)
+{
+	r->buf = buf;
+	r->size = size;
+	r->bits = 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+bitreader_get(struct bitreader *r, int n, uint64_t *v)
+{
+	int i;
+
+	if(r->bits + n > r->size * 8) {
+		return 0;
+	}
+	*v = 0;
+	for(i = 0; i < n; i++, r->bits++) {
+		*v = (*v << 1) | ((r->buf[r->bits / 8] >> (7 - r->bits % 8)) & 1);
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
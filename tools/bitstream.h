@@ -0,0 +1,44 @@
+/*
+ * bitstream.h
+ *
+ * MSB-first bit writer and reader over a byte buffer, used by the
+ * time-series encoding in tsstore.c.
+ */
+
+#ifndef BITSTREAM_H_
+#define BITSTREAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct bitwriter
+{
+	uint8_t *buf;
+	size_t size;	/* bytes */
+	size_t bits;	/* bits written */
+};
+
+struct bitreader
+{
+	const uint8_t *buf;
+	size_t size;	/* bytes */
+	size_t bits;	/* bits read */
+};
+
+void bitwriter_init(struct bitwriter *w, uint8_t *buf, size_t size);
+
+/* Appends the low n bits of v, n <= 64. Returns 0 if the buffer is full. */
+int bitwriter_put(struct bitwriter *w, uint64_t v, int n);
+
+static inline size_t
+bitwriter_bytes(const struct bitwriter *w)
+{
+	return (w->bits + 7) / 8;
+}
+
+void bitreader_init(struct bitreader *r, const uint8_t *buf, size_t size);
+
+/* Reads n bits, n <= 64. Returns 0 if the buffer is exhausted. */
+int bitreader_get(struct bitreader *r, int n, uint64_t *v);
+
+#endif /* BITSTREAM_H_ */
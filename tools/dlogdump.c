@@ -0,0 +1,273 @@
+/*
+ * dlogdump.c
+ *
+ * Expands the deferred log records of a node (see ../dlog.h) into text.
+ *
+ *   dlogdump <firmware> [file]
+ *
+ * firmware is the ELF image running on the node, e.g. sensor.sky; the
+ * records only carry the addresses of their format strings. The log is read
+ * from file (a serial device, a pty or a capture) or stdin.
+ */
+
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "framedec.h"
+
+#define DLOG_STRING_MAX 16
+
+struct section
+{
+	uint64_t addr, size, offset;
+};
+
+struct image
+{
+	uint8_t *data;
+	size_t size;
+	struct section *sections;
+	int count;
+};
+
+/*---------------------------------------------------------------------------*/
+static uint64_t
+get_le(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = n - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+/*---------------------------------------------------------------------------*/
+/* Loads the allocated sections of a little-endian ELF file. */
+static int
+load_image(struct image *im, const char *path)
+{
+	const uint8_t *h, *sh;
+	uint64_t shoff;
+	int is64, shentsize, shnum, i;
+	FILE *f;
+	long size;
+
+	f = fopen(path, "rb");
+	if(f == NULL) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	im->data = malloc(size);
+	if(im->data == NULL || fread(im->data, 1, size, f) != (size_t)size) {
+		fclose(f);
+		return 0;
+	}
+	fclose(f);
+	im->size = size;
+
+	h = im->data;
+	if(size < EI_NIDENT || memcmp(h, ELFMAG, SELFMAG) != 0 || h[EI_DATA] != ELFDATA2LSB) {
+		return 0;
+	}
+	is64 = h[EI_CLASS] == ELFCLASS64;
+	shoff = is64 ? get_le(h + 0x28, 8) : get_le(h + 0x20, 4);
+	shentsize = get_le(h + (is64 ? 0x3a : 0x2e), 2);
+	shnum = get_le(h + (is64 ? 0x3c : 0x30), 2);
+	if(shoff + (uint64_t)shentsize * shnum > im->size) {
+		return 0;
+	}
+
+	im->sections = calloc(shnum, sizeof(*im->sections));
+	for(i = 0; i < shnum; i++) {
+		sh = h + shoff + i * shentsize;
+		if(get_le(sh + 4, 4) != SHT_PROGBITS ||
+		   !(get_le(sh + 8, is64 ? 8 : 4) & SHF_ALLOC)) {
+			continue;
+		}
+		im->sections[im->count].addr = get_le(sh + (is64 ? 0x10 : 0x0c), is64 ? 8 : 4);
+		im->sections[im->count].offset = get_le(sh + (is64 ? 0x18 : 0x10), is64 ? 8 : 4);
+		im->sections[im->count].size = get_le(sh + (is64 ? 0x20 : 0x14), is64 ? 8 : 4);
+		im->count++;
+	}
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+/* Returns the string at a target address, or NULL. */
+static const char *
+image_string(const struct image *im, uint64_t addr)
+{
+	const struct section *s;
+	const char *p;
+	int i;
+
+	for(i = 0; i < im->count; i++) {
+		s = &im->sections[i];
+		if(addr >= s->addr && addr < s->addr + s->size && s->offset + s->size <= im->size) {
+			p = (const char *)im->data + s->offset + (addr - s->addr);
+			if(memchr(p, '\0', s->addr + s->size - addr) != NULL) {
+				return p;
+			}
+		}
+	}
+	return NULL;
+}
+/*---------------------------------------------------------------------------*/
+/* Reads a varint. Returns its length, or 0 if it runs past end. */
+static int
+get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	int n = 0;
+
+	*v = 0;
+	while(p + n < end && n < 10) {
+		*v |= (uint64_t)(p[n] & 0x7f) << (7 * n);
+		if(!(p[n++] & 0x80)) {
+			return n;
+		}
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+/* Formats one record, consuming its arguments from p. */
+static void
+print_record(const char *fmt, int count, const uint8_t *p, const uint8_t *end)
+{
+	char spec[32], str[DLOG_STRING_MAX + 1];
+	const char *start;
+	uint64_t v;
+	int64_t arg;
+	size_t n;
+	int len;
+
+	while(*fmt != '\0') {
+		if(*fmt != '%') {
+			putchar(*fmt++);
+			continue;
+		}
+		if(fmt[1] == '%') {
+			putchar('%');
+			fmt += 2;
+			continue;
+		}
+
+		// copy flags, width and precision, drop length modifiers
+		start = fmt++;
+		while(*fmt != '\0' && strchr("-+ #0123456789.", *fmt) != NULL) {
+			fmt++;
+		}
+		n = fmt - start;
+		if(n > sizeof(spec) - 4) {
+			n = sizeof(spec) - 4;
+		}
+		memcpy(spec, start, n);
+		while(*fmt != '\0' && strchr("hlzjt", *fmt) != NULL) {
+			fmt++;
+		}
+		if(*fmt == '\0') {
+			break;
+		}
+
+		if(count-- <= 0) {
+			printf("<missing>");
+		} else if(*fmt == 's') {
+			len = p < end ? *p : 0;
+			if(p + 1 + len > end) {
+				return;
+			}
+			memcpy(str, p + 1, len);
+			str[len] = '\0';
+			p += 1 + len;
+			spec[n] = 's';
+			spec[n + 1] = '\0';
+			printf(spec, str);
+		} else {
+			len = get_varint(p, end, &v);
+			if(len == 0) {
+				return;
+			}
+			p += len;
+			arg = (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+			if(*fmt == 'c') {
+				spec[n] = 'c';
+				spec[n + 1] = '\0';
+				printf(spec, (int)arg);
+			} else if(strchr("diuxXo", *fmt) != NULL) {
+				spec[n] = 'l';
+				spec[n + 1] = 'l';
+				spec[n + 2] = *fmt;
+				spec[n + 3] = '\0';
+				printf(spec, (long long)arg);
+			} else {
+				printf("0x%llx", (unsigned long long)arg);
+			}
+		}
+		fmt++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_frame(void *ctx, uint8_t type, const uint8_t *payload, size_t len)
+{
+	const struct image *im = ctx;
+	const uint8_t *p, *end = payload + len;
+	const char *fmt;
+	uint64_t addr;
+	int n;
+
+	if(type != FRAME_TYPE_DLOG || len < 2) {
+		return;
+	}
+	if(get_le(payload, 2) > 0) {
+		printf("[%d records dropped]\n", (int)get_le(payload, 2));
+	}
+
+	for(p = payload + 2; p + 2 <= end && p + 1 + *p <= end; p += 1 + *p) {
+		n = get_varint(p + 2, p + 1 + *p, &addr);
+		if(n == 0) {
+			break;
+		}
+		fmt = image_string(im, addr);
+		if(fmt == NULL) {
+			printf("[unknown format at 0x%llx]\n", (unsigned long long)addr);
+			continue;
+		}
+		print_record(fmt, p[1], p + 2 + n, p + 1 + *p);
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	struct framedec dec;
+	struct image im;
+	uint8_t buf[256];
+	size_t n;
+	FILE *in = stdin;
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: dlogdump <firmware> [file]\n");
+		return 2;
+	}
+	memset(&im, 0, sizeof(im));
+	if(!load_image(&im, argv[1])) {
+		fprintf(stderr, "dlogdump: %s is not a little-endian ELF image\n", argv[1]);
+		return 1;
+	}
+	if(argc > 2 && (in = fopen(argv[2], "rb")) == NULL) {
+		perror(argv[2]);
+		return 1;
+	}
+
+	framedec_init(&dec);
+	while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		framedec_feed(&dec, buf, n, print_frame, &im);
+		fflush(stdout);
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,151 @@
+/*
+ * framedec.c
+ *
+ * See framedec.h.
+ */
+
+#include <string.h>
+
+#include "framedec.h"
+
+/*---------------------------------------------------------------------------*/
+/* Same as crc16_add() in Contiki's lib/crc16.c. */
+static uint16_t
+crc16_add(uint8_t b, uint16_t acc)
+{
+	acc ^= b;
+	acc = (acc >> 8) | (acc << 8);
+	acc ^= (acc & 0xff00) << 4;
+	acc ^= (acc >> 8) >> 4;
+	acc ^= (acc & 0xff00) >> 5;
+	return acc;
+}
+/*---------------------------------------------------------------------------*/
+uint16_t
+framedec_crc16(const uint8_t *data, size_t len, uint16_t acc)
+{
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		acc = crc16_add(data[i], acc);
+	}
+	return acc;
+}
+/*---------------------------------------------------------------------------*/
+void
+framedec_init(struct framedec *d)
+{
+	memset(d, 0, sizeof(*d));
+}
+/*---------------------------------------------------------------------------*/
+static void
+end_of_frame(struct framedec *d, framedec_callback callback, void *ctx)
+{
+	uint16_t crc;
+
+	if(d->len == 0 && !d->overflow) {
+		// back-to-back END bytes
+		return;
+	}
+
+	if(d->overflow || d->escaped || d->len < 3) {
+		d->errors++;
+		return;
+	}
+
+	crc = d->buf[d->len - 2] | (d->buf[d->len - 1] << 8);
+	if(framedec_crc16(d->buf, d->len - 2, 0) != crc) {
+		d->errors++;
+		return;
+	}
+
+	d->frames++;
+	callback(ctx, d->buf[0], d->buf + 1, d->len - 3);
+}
+/*---------------------------------------------------------------------------*/
+void
+framedec_feed(struct framedec *d, const uint8_t *data, size_t len,
+		framedec_callback callback, void *ctx)
+{
+	uint8_t c;
+	size_t i;
+
+	for(i = 0; i < len; i++) {
+		c = data[i];
+
+		if(c == FRAME_END) {
+			end_of_frame(d, callback, ctx);
+			d->len = 0;
+			d->escaped = 0;
+			d->overflow = 0;
+			continue;
+		}
+
+		if(d->escaped) {
+			d->escaped = 0;
+			if(c == FRAME_ESC_END) {
+				c = FRAME_END;
+			} else if(c == FRAME_ESC_ESC) {
+				c = FRAME_ESC;
+			} else {
+				// not a valid escape, the frame is dropped at the next END
+				d->overflow = 1;
+			}
+		} else if(c == FRAME_ESC) {
+			d->escaped = 1;
+			continue;
+		}
+
+		if(d->len == sizeof(d->buf)) {
+			d->overflow = 1;
+		} else {
+			d->buf[d->len++] = c;
+		}
+	}
+}
+/*---------------------------------------------------------------------------*/
+static uint32_t
+get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+/*---------------------------------------------------------------------------*/
+int
+framedec_readings(const uint8_t *payload, size_t len, uint32_t *time,
+		struct frame_reading *readings, int max)
+{
+	const uint8_t *p;
+	int count, i;
+
+	if(len < FRAME_READINGS_HEADER) {
+		return -1;
+	}
+	count = payload[4];
+	if(len != FRAME_READINGS_HEADER + (size_t)count * FRAME_READING_SIZE) {
+		return -1;
+	}
+
+	*time = get32(payload);
+
+	p = payload + FRAME_READINGS_HEADER;
+	for(i = 0; i < count && i < max; i++, p += FRAME_READING_SIZE) {
+		readings[i].source[0] = p[0];
+		readings[i].source[1] = p[1];
+		readings[i].type = p[2];
+		readings[i].value = (int16_t)(p[3] | (p[4] << 8));
+	}
+	return i;
+}
+/*---------------------------------------------------------------------------*/
+int
+framedec_log(const uint8_t *payload, size_t len, uint8_t source[2], uint32_t *offset)
+{
+	if(len < FRAME_LOG_HEADER) {
+		return -1;
+	}
+	source[0] = payload[0];
+	source[1] = payload[1];
+	*offset = get32(payload + 2);
+	return FRAME_LOG_HEADER;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,60 @@
+/*
+ * framedec.h
+ *
+ * Host-side decoder for the binary serial export of the basestation, see
+ * ../frame.h for the format. Bytes are fed in as they come off the serial
+ * line; every frame with a valid crc is handed to a callback. Text and
+ * noise between frames are dropped.
+ */
+
+#ifndef FRAMEDEC_H_
+#define FRAMEDEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../frame.h"
+
+struct framedec
+{
+	uint8_t buf[FRAME_MAX_SIZE];
+	size_t len;
+	int escaped;
+	int overflow;
+
+	unsigned long frames;	/* frames delivered */
+	unsigned long errors;	/* frames dropped for a bad crc, length or escape */
+};
+
+/* type is the frame type, payload excludes the type and the crc. */
+typedef void (*framedec_callback)(void *ctx, uint8_t type, const uint8_t *payload, size_t len);
+
+struct frame_reading
+{
+	uint8_t source[2];
+	uint8_t type;
+	int16_t value;
+};
+
+void framedec_init(struct framedec *d);
+
+void framedec_feed(struct framedec *d, const uint8_t *data, size_t len,
+		framedec_callback callback, void *ctx);
+
+uint16_t framedec_crc16(const uint8_t *data, size_t len, uint16_t acc);
+
+/*
+ * Parses the payload of a FRAME_TYPE_READINGS frame. Returns the number of
+ * readings stored in readings (at most max), or -1 if the payload is
+ * malformed. time receives the basestation time of the frame.
+ */
+int framedec_readings(const uint8_t *payload, size_t len, uint32_t *time,
+		struct frame_reading *readings, int max);
+
+/*
+ * Parses the header of a FRAME_TYPE_LOG frame. Returns the offset of the
+ * log data in payload, or -1 if the payload is malformed.
+ */
+int framedec_log(const uint8_t *payload, size_t len, uint8_t source[2], uint32_t *offset);
+
+#endif /* FRAMEDEC_H_ */
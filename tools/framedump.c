@@ -0,0 +1,103 @@
+/*
+ * framedump.c
+ *
+ * Prints the binary serial export of the basestation as text.
+ *
+ *   framedump [file]
+ *
+ * Reads from file (a serial device, a pty or a capture) or stdin.
+ */
+
+#include <stdio.h>
+
+#include "framedec.h"
+
+/*---------------------------------------------------------------------------*/
+static void
+print_frame(void *ctx, uint8_t type, const uint8_t *payload, size_t len)
+{
+	struct frame_reading readings[FRAME_READINGS_MAX];
+	uint8_t source[2];
+	uint32_t time, offset;
+	const uint8_t *p;
+	int i, n;
+
+	switch(type) {
+	case FRAME_TYPE_READINGS:
+		n = framedec_readings(payload, len, &time, readings, FRAME_READINGS_MAX);
+		for(i = 0; i < n; i++) {
+			printf("%lu %d.%d type %d value %d\n", (unsigned long)time,
+					readings[i].source[0], readings[i].source[1],
+					readings[i].type, readings[i].value);
+		}
+		break;
+	case FRAME_TYPE_LOG:
+		n = framedec_log(payload, len, source, &offset);
+		if(n >= 0) {
+			printf("log %d.%d offset %lu, %d bytes\n", source[0], source[1],
+					(unsigned long)offset, (int)len - n);
+		}
+		break;
+	case FRAME_TYPE_TOPOLOGY:
+		if(len < FRAME_TOPOLOGY_HEADER ||
+		   len != FRAME_TOPOLOGY_HEADER + payload[14] * FRAME_TOPOLOGY_LINK_SIZE) {
+			break;
+		}
+		printf("map %d.%d", payload[0], payload[1]);
+		if(payload[3] == 0xff) {
+			printf(" unreachable");
+		} else {
+			printf(" depth %d via %d.%d load %d cost %.2f bottleneck %d.%d->%d.%d etx %.2f",
+					payload[3], payload[4], payload[5], payload[6],
+					(payload[7] | payload[8] << 8) / 16.0,
+					payload[9], payload[10], payload[11], payload[12], payload[13] / 16.0);
+		}
+		printf("\n");
+		for(i = 0; i < payload[14]; i++) {
+			p = payload + FRAME_TOPOLOGY_HEADER + i * FRAME_TOPOLOGY_LINK_SIZE;
+			printf("  link %d.%d etx %.2f rssi %d\n", p[0], p[1], p[2] / 16.0, (int8_t)p[3]);
+		}
+		break;
+	case FRAME_TYPE_COUNTERS:
+		if(len < FRAME_COUNTERS_HEADER ||
+		   len != FRAME_COUNTERS_HEADER + payload[3] * payload[4] * 2) {
+			break;
+		}
+		for(i = 0; i < payload[3]; i++) {
+			p = payload + FRAME_COUNTERS_HEADER + i * payload[4] * 2;
+			printf("counters %d.%d module %d:", payload[0], payload[1], i);
+			for(n = 0; n < payload[4]; n++) {
+				printf(" %d", p[2 * n] | p[2 * n + 1] << 8);
+			}
+			printf("\n");
+		}
+		break;
+	default:
+		printf("frame type %d, %d bytes\n", type, (int)len);
+		break;
+	}
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	struct framedec dec;
+	uint8_t buf[256];
+	size_t n;
+	FILE *in = stdin;
+
+	if(argc > 1 && (in = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	framedec_init(&dec);
+	while((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+		framedec_feed(&dec, buf, n, print_frame, NULL);
+		fflush(stdout);
+	}
+
+	fprintf(stderr, "%lu frames, %lu dropped\n", dec.frames, dec.errors);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
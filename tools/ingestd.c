@@ -0,0 +1,338 @@
+/*
+ * ingestd.c
+ *
+ * Reads the binary serial export of the basestation and appends the
+ * readings to a tsstore (see tsstore.h). Log chunks fetched from the nodes
+ * are written to <store>/<node>/log.raw at their offset.
+ *
+ *   ingestd -s <store> -d <device> [-b <baud>]    serial port or pty
+ *   ingestd -s <store> -c <host>:<port>           Cooja serial socket
+ *   ingestd -s <store> -f <file> [-t <start>]     capture, - for stdin
+ *
+ * Readings are stamped with the basestation time of their frame, moved to
+ * host time (milliseconds since the epoch) by an offset. The offset is
+ * taken when the first frame arrives, again when the basestation clock
+ * starts over, and on a live source whenever the two clocks have drifted
+ * RESYNC_MS apart. A capture keeps its spacing; -t gives the host time of
+ * its first frame in seconds since the epoch, else it starts now. Serial
+ * ports and sockets are reopened when they go away; a file is read to its
+ * end.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "framedec.h"
+#include "tsstore.h"
+
+/* Tails are written to disk this often. */
+#define SYNC_INTERVAL_MS 5000
+
+/* A live source is put back on host time when it is off by this much. */
+#define RESYNC_MS 2000
+
+enum
+{
+	SOURCE_FILE,
+	SOURCE_DEVICE,
+	SOURCE_SOCKET
+};
+
+struct ingest
+{
+	struct tsstore *store;
+	const char *root;
+	unsigned long readings;
+	unsigned long log_bytes;
+
+	/* host time of basestation time 0, in milliseconds */
+	int64_t offset;
+	int64_t start;		/* -t, host time of the first frame, 0 for now */
+	uint32_t last_time;
+	int anchored;
+	int live;
+};
+
+static volatile sig_atomic_t stop;
+
+/*---------------------------------------------------------------------------*/
+static int64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+/*---------------------------------------------------------------------------*/
+static void
+on_signal(int sig)
+{
+	stop = 1;
+}
+/*---------------------------------------------------------------------------*/
+static speed_t
+baud_rate(int baud)
+{
+	switch(baud) {
+	case 9600: return B9600;
+	case 19200: return B19200;
+	case 38400: return B38400;
+	case 57600: return B57600;
+	case 230400: return B230400;
+	case 460800: return B460800;
+	default: return B115200;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_device(const char *path, int baud)
+{
+	struct termios tio;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOCTTY);
+	if(fd < 0) {
+		return -1;
+	}
+	// a pty accepts the settings as well, a plain file does not need them
+	if(tcgetattr(fd, &tio) == 0) {
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, baud_rate(baud));
+		cfsetospeed(&tio, baud_rate(baud));
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+	return fd;
+}
+/*---------------------------------------------------------------------------*/
+static int
+open_socket(const char *hostport)
+{
+	struct addrinfo hints, *res, *ai;
+	char host[256];
+	const char *port;
+	int fd = -1;
+
+	port = strrchr(hostport, ':');
+	if(port == NULL || port - hostport >= (long)sizeof(host)) {
+		return -1;
+	}
+	memcpy(host, hostport, port - hostport);
+	host[port - hostport] = '\0';
+	port++;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port, &hints, &res) != 0) {
+		return -1;
+	}
+	for(ai = res; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd < 0) {
+			continue;
+		}
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+/*---------------------------------------------------------------------------*/
+static void
+write_log(struct ingest *in, const uint8_t source[2], uint32_t offset,
+		const uint8_t *data, size_t len)
+{
+	char path[512];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%d.%d", in->root, source[0], source[1]);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/%d.%d/log.raw", in->root, source[0], source[1]);
+
+	fd = open(path, O_WRONLY | O_CREAT, 0644);
+	if(fd < 0) {
+		perror(path);
+		return;
+	}
+	if(pwrite(fd, data, len, offset) != (ssize_t)len) {
+		perror(path);
+	}
+	close(fd);
+	in->log_bytes += len;
+}
+/*---------------------------------------------------------------------------*/
+/* Host time of a frame sent at basestation time seconds. */
+static int64_t
+frame_time(struct ingest *in, uint32_t time)
+{
+	int64_t now = now_ms(), t;
+
+	if(!in->anchored || time < in->last_time) {
+		in->offset = (in->start != 0 && !in->anchored ? in->start : now) - (int64_t)time * 1000;
+		in->anchored = 1;
+	}
+	t = (int64_t)time * 1000 + in->offset;
+	if(in->live && (t - now > RESYNC_MS || now - t > RESYNC_MS)) {
+		in->offset = now - (int64_t)time * 1000;
+		t = now;
+	}
+	in->last_time = time;
+	return t;
+}
+/*---------------------------------------------------------------------------*/
+static void
+on_frame(void *ctx, uint8_t type, const uint8_t *payload, size_t len)
+{
+	struct ingest *in = ctx;
+	struct frame_reading readings[FRAME_READINGS_MAX];
+	uint8_t source[2];
+	uint32_t time, offset;
+	int64_t stamp;
+	int i, n;
+
+	switch(type) {
+	case FRAME_TYPE_READINGS:
+		n = framedec_readings(payload, len, &time, readings, FRAME_READINGS_MAX);
+		if(n <= 0) {
+			break;
+		}
+		stamp = frame_time(in, time);
+		for(i = 0; i < n; i++) {
+			if(!tsstore_append(in->store, readings[i].source[0] | (readings[i].source[1] << 8),
+					readings[i].type, stamp, readings[i].value)) {
+				fprintf(stderr, "ingestd: cannot append to the store: %s\n", strerror(errno));
+			}
+		}
+		in->readings += n;
+		break;
+	case FRAME_TYPE_LOG:
+		n = framedec_log(payload, len, source, &offset);
+		if(n >= 0) {
+			write_log(in, source, offset, payload + n, len - n);
+		}
+		break;
+	default:
+		break;
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: ingestd -s <store> (-d <device> [-b <baud>] | -c <host>:<port> | -f <file> [-t <start>]) [-v]\n");
+	exit(2);
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	struct ingest in;
+	struct framedec dec;
+	struct pollfd pfd;
+	const char *source = NULL;
+	int kind = SOURCE_FILE, baud = 115200, verbose = 0;
+	int64_t last_sync;
+	uint8_t buf[512];
+	ssize_t n;
+	int fd = -1, opt;
+
+	memset(&in, 0, sizeof(in));
+
+	while((opt = getopt(argc, argv, "s:d:b:c:f:t:v")) != -1) {
+		switch(opt) {
+		case 's': in.root = optarg; break;
+		case 'd': kind = SOURCE_DEVICE; source = optarg; break;
+		case 'b': baud = atoi(optarg); break;
+		case 'c': kind = SOURCE_SOCKET; source = optarg; break;
+		case 'f': kind = SOURCE_FILE; source = optarg; break;
+		case 't': in.start = strtoll(optarg, NULL, 10) * 1000; break;
+		case 'v': verbose = 1; break;
+		default: usage();
+		}
+	}
+	if(in.root == NULL || source == NULL) {
+		usage();
+	}
+	in.live = kind != SOURCE_FILE;
+
+	in.store = tsstore_open(in.root);
+	if(in.store == NULL) {
+		perror(in.root);
+		return 1;
+	}
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+
+	framedec_init(&dec);
+	last_sync = now_ms();
+
+	while(!stop) {
+		if(fd < 0) {
+			if(kind == SOURCE_SOCKET) {
+				fd = open_socket(source);
+			} else if(kind == SOURCE_DEVICE) {
+				fd = open_device(source, baud);
+			} else {
+				fd = strcmp(source, "-") == 0 ? 0 : open(source, O_RDONLY);
+			}
+			if(fd < 0) {
+				if(kind == SOURCE_FILE) {
+					perror(source);
+					break;
+				}
+				sleep(1);
+				continue;
+			}
+			framedec_init(&dec);
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if(poll(&pfd, 1, 1000) > 0) {
+			n = read(fd, buf, sizeof(buf));
+			if(n > 0) {
+				framedec_feed(&dec, buf, n, on_frame, &in);
+			} else if(n == 0 || errno != EINTR) {
+				close(fd);
+				fd = -1;
+				if(kind == SOURCE_FILE) {
+					break;
+				}
+				fprintf(stderr, "ingestd: %s went away, reconnecting\n", source);
+			}
+		}
+
+		if(now_ms() - last_sync >= SYNC_INTERVAL_MS) {
+			if(!tsstore_sync(in.store)) {
+				fprintf(stderr, "ingestd: cannot write the store: %s\n", strerror(errno));
+			}
+			last_sync = now_ms();
+			if(verbose) {
+				fprintf(stderr, "ingestd: %lu readings, %lu log bytes, %lu frames, %lu dropped\n",
+						in.readings, in.log_bytes, dec.frames, dec.errors);
+			}
+		}
+	}
+
+	tsstore_close(in.store);
+	fprintf(stderr, "ingestd: %lu readings, %lu log bytes, %lu frames, %lu dropped\n",
+			in.readings, in.log_bytes, dec.frames, dec.errors);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
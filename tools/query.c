@@ -0,0 +1,218 @@
+/*
+ * query.c
+ *
+ * See query.h.
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "query.h"
+
+struct downsample
+{
+	int64_t from, step;
+	size_t n;
+	struct aggregate *out;
+};
+
+/*---------------------------------------------------------------------------*/
+static int64_t
+floor_to(int64_t t, int64_t step)
+{
+	int64_t r = t % step;
+
+	return r < 0 ? t - r - step : t - r;
+}
+/*---------------------------------------------------------------------------*/
+static int64_t
+ceil_to(int64_t t, int64_t step)
+{
+	int64_t f = floor_to(t, step);
+
+	return f == t ? t : f + step;
+}
+/*---------------------------------------------------------------------------*/
+int
+query_range(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		tsstore_visit visit, void *ctx)
+{
+	if(from >= to) {
+		return 1;
+	}
+	return tsstore_scan(root, node, type, from, to - 1, visit, NULL, ctx);
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_point(void *ctx, int64_t time, int32_t value)
+{
+	aggregate_add(ctx, value);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_block(void *ctx, const struct tsblock_info *info)
+{
+	struct aggregate b = {info->count, info->min, info->max, info->sum};
+
+	aggregate_merge(ctx, &b);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_bucket(void *ctx, const struct rollup_bucket *b)
+{
+	aggregate_merge(ctx, &b->agg);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+aggregate_raw(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		struct aggregate *a)
+{
+	if(from < to) {
+		tsstore_scan(root, node, type, from, to - 1, add_point, add_block, a);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static void
+aggregate_rollup(const char *root, uint16_t node, uint8_t type, const char *ext,
+		int64_t from, int64_t to, struct aggregate *a)
+{
+	char path[512];
+
+	if(from < to) {
+		tsstore_path(path, sizeof(path), root, node, type, ext);
+		rollup_scan(path, from, to, add_bucket, a);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+query_aggregate(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		struct aggregate *a)
+{
+	int64_t m0 = ceil_to(from, ROLLUP_MINUTE), m1 = floor_to(to, ROLLUP_MINUTE);
+	int64_t h0 = ceil_to(from, ROLLUP_HOUR), h1 = floor_to(to, ROLLUP_HOUR);
+
+	if(m0 >= m1) {
+		aggregate_raw(root, node, type, from, to, a);
+		return;
+	}
+	if(h0 >= h1) {
+		h0 = h1 = m1;
+	}
+
+	// raw | minutes | hours | minutes | raw
+	aggregate_raw(root, node, type, from, m0, a);
+	aggregate_rollup(root, node, type, "r60", m0, h0, a);
+	aggregate_rollup(root, node, type, "r3600", h0, h1, a);
+	aggregate_rollup(root, node, type, "r60", h1, m1, a);
+	aggregate_raw(root, node, type, m1, to, a);
+}
+/*---------------------------------------------------------------------------*/
+static int
+downsample_point(void *ctx, int64_t time, int32_t value)
+{
+	struct downsample *d = ctx;
+
+	aggregate_add(&d->out[(time - d->from) / d->step], value);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int
+downsample_bucket(void *ctx, const struct rollup_bucket *b)
+{
+	struct downsample *d = ctx;
+
+	aggregate_merge(&d->out[(b->start - d->from) / d->step], &b->agg);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+query_downsample(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t step,
+		size_t n, struct aggregate *out)
+{
+	struct downsample d = {from, step, n, out};
+	int64_t to = from + step * (int64_t)n;
+	char path[512];
+
+	if(n == 0 || step <= 0) {
+		return;
+	}
+
+	if(from % ROLLUP_HOUR == 0 && step % ROLLUP_HOUR == 0) {
+		tsstore_path(path, sizeof(path), root, node, type, "r3600");
+	} else if(from % ROLLUP_MINUTE == 0 && step % ROLLUP_MINUTE == 0) {
+		tsstore_path(path, sizeof(path), root, node, type, "r60");
+	} else {
+		tsstore_scan(root, node, type, from, to - 1, downsample_point, NULL, &d);
+		return;
+	}
+	rollup_scan(path, from, to, downsample_bucket, &d);
+}
+/*---------------------------------------------------------------------------*/
+int
+query_nodes(const char *root, uint16_t *nodes, int max)
+{
+	struct dirent *e;
+	unsigned a, b;
+	char end;
+	DIR *dir;
+	int n = 0;
+
+	dir = opendir(root);
+	if(dir == NULL) {
+		return 0;
+	}
+	while(n < max && (e = readdir(dir)) != NULL) {
+		if(sscanf(e->d_name, "%u.%u%c", &a, &b, &end) == 2 && a < 256 && b < 256) {
+			nodes[n++] = a | (b << 8);
+		}
+	}
+	closedir(dir);
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+struct rebuild
+{
+	char minutes[512], hours[512];
+	struct rollup m, h;
+	int ok;
+};
+/*---------------------------------------------------------------------------*/
+static int
+rebuild_point(void *ctx, int64_t time, int32_t value)
+{
+	struct rebuild *r = ctx;
+
+	// completed buckets are written out whenever too many wait
+	if((!rollup_add(&r->m, time, value) &&
+	    (!rollup_sync(&r->m, r->minutes) || !rollup_add(&r->m, time, value))) ||
+	   (!rollup_add(&r->h, time, value) &&
+	    (!rollup_sync(&r->h, r->hours) || !rollup_add(&r->h, time, value)))) {
+		r->ok = 0;
+		return 1;
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+query_rebuild(const char *root, uint16_t node, uint8_t type)
+{
+	static struct rebuild r;
+
+	tsstore_path(r.minutes, sizeof(r.minutes), root, node, type, "r60");
+	tsstore_path(r.hours, sizeof(r.hours), root, node, type, "r3600");
+	remove(r.minutes);
+	remove(r.hours);
+	rollup_load(&r.m, r.minutes, ROLLUP_MINUTE);
+	rollup_load(&r.h, r.hours, ROLLUP_HOUR);
+	r.ok = 1;
+
+	if(!tsstore_scan(root, node, type, INT64_MIN, INT64_MAX, rebuild_point, NULL, &r)) {
+		return 0;
+	}
+	return r.ok && rollup_sync(&r.m, r.minutes) && rollup_sync(&r.h, r.hours);
+}
+/*---------------------------------------------------------------------------*/
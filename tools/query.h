@@ -0,0 +1,51 @@
+/*
+ * query.h
+ *
+ * Queries over a tsstore: raw range scans, aggregates over a node or a group
+ * of nodes, and downsampled series. Aggregates and downsampling answer as
+ * much as possible from the hour and minute rollups and only decode raw
+ * points at the unaligned edges of a range. All ranges are [from, to) in
+ * milliseconds.
+ */
+
+#ifndef QUERY_H_
+#define QUERY_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "rollup.h"
+#include "tsstore.h"
+
+/* Zones as the actuator derives them from the sensor address (SENSOR_ZONE). */
+#define QUERY_ZONES 4
+#define QUERY_ZONE(node) (((node) & 0xff) % QUERY_ZONES)
+
+#define QUERY_MAX_NODES 1024
+
+/* Visits the raw points of a series. Returns 0 if the series does not exist. */
+int query_range(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		tsstore_visit visit, void *ctx);
+
+/* Adds the points of a series in the range to a. */
+void query_aggregate(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		struct aggregate *a);
+
+/*
+ * Adds the points of a series to n buckets of step ms starting at from, so
+ * out[i] covers [from + i * step, from + (i + 1) * step). The rollups are
+ * used when from and step are whole minutes or hours.
+ */
+void query_downsample(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t step,
+		size_t n, struct aggregate *out);
+
+/* Lists the nodes in the store. Returns their number. */
+int query_nodes(const char *root, uint16_t *nodes, int max);
+
+/*
+ * Recomputes the rollups of a series from its raw points, e.g. for data
+ * stored before rollups existed. Must not run while the series is ingested.
+ */
+int query_rebuild(const char *root, uint16_t node, uint8_t type);
+
+#endif /* QUERY_H_ */
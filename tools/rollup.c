@@ -0,0 +1,223 @@
+/*
+ * rollup.c
+ *
+ * See rollup.h.
+ */
+
+#include <string.h>
+
+#include "rollup.h"
+
+/*---------------------------------------------------------------------------*/
+void
+aggregate_init(struct aggregate *a)
+{
+	a->count = 0;
+	a->min = INT32_MAX;
+	a->max = INT32_MIN;
+	a->sum = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+aggregate_add(struct aggregate *a, int32_t value)
+{
+	if(value < a->min) a->min = value;
+	if(value > a->max) a->max = value;
+	a->sum += value;
+	a->count++;
+}
+/*---------------------------------------------------------------------------*/
+void
+aggregate_merge(struct aggregate *a, const struct aggregate *b)
+{
+	if(b->count == 0) {
+		return;
+	}
+	if(b->min < a->min) a->min = b->min;
+	if(b->max > a->max) a->max = b->max;
+	a->sum += b->sum;
+	a->count += b->count;
+}
+/*---------------------------------------------------------------------------*/
+static void
+put_le(uint8_t *p, uint64_t v, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++) {
+		p[i] = v >> (8 * i);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+get_le(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = n - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+/*---------------------------------------------------------------------------*/
+static void
+encode(const struct rollup_bucket *b, uint8_t *p)
+{
+	put_le(p, b->start, 8);
+	put_le(p + 8, b->agg.count, 4);
+	put_le(p + 12, (uint32_t)b->agg.min, 4);
+	put_le(p + 16, (uint32_t)b->agg.max, 4);
+	put_le(p + 20, b->agg.sum, 8);
+}
+/*---------------------------------------------------------------------------*/
+static void
+decode(const uint8_t *p, struct rollup_bucket *b)
+{
+	b->start = (int64_t)get_le(p, 8);
+	b->agg.count = get_le(p + 8, 4);
+	b->agg.min = (int32_t)get_le(p + 12, 4);
+	b->agg.max = (int32_t)get_le(p + 16, 4);
+	b->agg.sum = (int64_t)get_le(p + 20, 8);
+}
+/*---------------------------------------------------------------------------*/
+static int64_t
+bucket_start(int64_t time, int64_t step)
+{
+	int64_t start = time - time % step;
+
+	return time < 0 && time % step != 0 ? start - step : start;
+}
+/*---------------------------------------------------------------------------*/
+void
+rollup_load(struct rollup *r, const char *path, int64_t step)
+{
+	uint8_t rec[ROLLUP_RECORD];
+	long size;
+	FILE *f;
+
+	memset(r, 0, sizeof(*r));
+	r->step = step;
+
+	f = fopen(path, "rb");
+	if(f == NULL) {
+		return;
+	}
+	// a record cut short by a crash is written over
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	r->offset = size - size % ROLLUP_RECORD;
+	if(r->offset >= ROLLUP_RECORD && fseek(f, r->offset - ROLLUP_RECORD, SEEK_SET) == 0 &&
+	   fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+		decode(rec, &r->cur);
+		r->have = 1;
+		r->offset -= ROLLUP_RECORD;
+	}
+	fclose(f);
+}
+/*---------------------------------------------------------------------------*/
+int
+rollup_sync(struct rollup *r, const char *path)
+{
+	uint8_t rec[ROLLUP_RECORD];
+	FILE *f;
+	int i, ok = 1;
+
+	if(!r->dirty && r->pending == 0) {
+		return 1;
+	}
+
+	f = fopen(path, "r+b");
+	if(f == NULL) {
+		f = fopen(path, "w+b");
+	}
+	if(f == NULL) {
+		return 0;
+	}
+	// the bucket being filled is always the last record, after the
+	// completed ones; a write cut short is repeated from the same offset
+	ok = fseek(f, r->offset, SEEK_SET) == 0;
+	for(i = 0; ok && i < r->pending; i++) {
+		encode(&r->done[i], rec);
+		ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+	}
+	if(ok && r->have) {
+		encode(&r->cur, rec);
+		ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+	}
+	ok = fclose(f) == 0 && ok;
+
+	if(ok) {
+		r->offset += (long)r->pending * ROLLUP_RECORD;
+		r->pending = 0;
+		r->dirty = 0;
+	}
+	return ok;
+}
+/*---------------------------------------------------------------------------*/
+int
+rollup_add(struct rollup *r, int64_t time, int32_t value)
+{
+	int64_t start = bucket_start(time, r->step);
+
+	if(r->have && start != r->cur.start) {
+		if(r->pending == ROLLUP_PENDING) {
+			return 0;
+		}
+		r->done[r->pending++] = r->cur;
+		r->have = 0;
+	}
+	if(!r->have) {
+		r->cur.start = start;
+		aggregate_init(&r->cur.agg);
+		r->have = 1;
+	}
+	aggregate_add(&r->cur.agg, value);
+	r->dirty = 1;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+rollup_scan(const char *path, int64_t from, int64_t to,
+		int (*visit)(void *ctx, const struct rollup_bucket *b), void *ctx)
+{
+	uint8_t rec[ROLLUP_RECORD];
+	struct rollup_bucket b;
+	long lo, hi, mid, n;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if(f == NULL) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	n = ftell(f) / ROLLUP_RECORD;
+
+	// first record starting at or after from
+	lo = 0;
+	hi = n;
+	while(lo < hi) {
+		mid = (lo + hi) / 2;
+		fseek(f, mid * ROLLUP_RECORD, SEEK_SET);
+		if(fread(rec, 1, sizeof(rec), f) != sizeof(rec)) {
+			break;
+		}
+		decode(rec, &b);
+		if(b.start < from) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	fseek(f, lo * ROLLUP_RECORD, SEEK_SET);
+	while(fread(rec, 1, sizeof(rec), f) == sizeof(rec)) {
+		decode(rec, &b);
+		if(b.start >= to || visit(ctx, &b)) {
+			break;
+		}
+	}
+	fclose(f);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
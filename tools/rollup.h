@@ -0,0 +1,80 @@
+/*
+ * rollup.h
+ *
+ * Pre-aggregated rollups of a series: one record per minute and one per hour
+ * with count, min, max and sum. They are kept up to date by tsstore while it
+ * ingests, and live next to the series as <type>.r60 and <type>.r3600.
+ * Records have a fixed size and are sorted by time, so a range is found with
+ * a binary search.
+ *
+ * Buckets are only written by rollup_sync, which tsstore calls after the
+ * tails, so a rollup never counts a point that is not on disk. A completed
+ * bucket is kept until a sync gets it out.
+ */
+
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define ROLLUP_MINUTE 60000
+#define ROLLUP_HOUR 3600000
+
+#define ROLLUP_RECORD 28
+
+/* Completed buckets kept for the next sync. */
+#define ROLLUP_PENDING 64
+
+struct aggregate
+{
+	uint64_t count;
+	int32_t min, max;
+	int64_t sum;
+};
+
+struct rollup_bucket
+{
+	int64_t start;		/* ms, a multiple of the step */
+	struct aggregate agg;
+};
+
+/* The bucket being filled, kept in memory by tsstore. */
+struct rollup
+{
+	int64_t step;
+	struct rollup_bucket cur;
+	int have;		/* cur holds data */
+	int dirty;		/* cur changed since it was written */
+	long offset;		/* file offset of the first bucket to write */
+	struct rollup_bucket done[ROLLUP_PENDING];	/* completed, not written yet */
+	int pending;
+};
+
+void aggregate_init(struct aggregate *a);
+void aggregate_add(struct aggregate *a, int32_t value);
+void aggregate_merge(struct aggregate *a, const struct aggregate *b);
+
+/* Picks up the last bucket of path, so ingestion can continue it. */
+void rollup_load(struct rollup *r, const char *path, int64_t step);
+
+/*
+ * Adds a point. Returns 0 if it starts a bucket while ROLLUP_PENDING
+ * completed ones wait; the rollup has to be synced first.
+ */
+int rollup_add(struct rollup *r, int64_t time, int32_t value);
+
+/*
+ * Writes the completed buckets and the one being filled. Returns 0 on an
+ * I/O error; they are written again by the next sync.
+ */
+int rollup_sync(struct rollup *r, const char *path);
+
+/*
+ * Visits the buckets of the rollup file path that start in [from, to).
+ * Returning non-zero from visit stops. Returns 0 if the file does not exist.
+ */
+int rollup_scan(const char *path, int64_t from, int64_t to,
+		int (*visit)(void *ctx, const struct rollup_bucket *b), void *ctx);
+
+#endif /* ROLLUP_H_ */
@@ -0,0 +1,238 @@
+/*
+ * tsquery.c
+ *
+ * Command line queries over a store written by ingestd.
+ *
+ *   tsquery -s <store> nodes
+ *   tsquery -s <store> range <node> <type> <from> <to>
+ *   tsquery -s <store> agg <nodes> <type> <from> <to>
+ *   tsquery -s <store> down <nodes> <type> <from> <to> <step>
+ *   tsquery -s <store> rebuild <node> <type>
+ *
+ * A node is written a.b. Where <nodes> is accepted, "zone:N" and "all"
+ * select every node of a zone or of the store. Times are milliseconds since
+ * the epoch, "now" or "now-<n>" with a unit of s, m, h or d; a step is a
+ * number with one of those units.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "query.h"
+
+/* Refuse downsampling into more buckets than this. */
+#define TSQUERY_MAX_BUCKETS 1000000
+
+/*---------------------------------------------------------------------------*/
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: tsquery -s <store> nodes\n"
+			"       tsquery -s <store> range <node> <type> <from> <to>\n"
+			"       tsquery -s <store> agg <node|zone:N|all> <type> <from> <to>\n"
+			"       tsquery -s <store> down <node|zone:N|all> <type> <from> <to> <step>\n"
+			"       tsquery -s <store> rebuild <node> <type>\n");
+	exit(2);
+}
+/*---------------------------------------------------------------------------*/
+static int64_t
+parse_duration(const char *s)
+{
+	char *end;
+	int64_t v = strtoll(s, &end, 10);
+
+	if(end == s) {
+		usage();
+	}
+	switch(*end) {
+	case '\0': return v;
+	case 's': return v * 1000;
+	case 'm': return v * ROLLUP_MINUTE;
+	case 'h': return v * ROLLUP_HOUR;
+	case 'd': return v * 24 * ROLLUP_HOUR;
+	default: usage();
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+static int64_t
+parse_time(const char *s)
+{
+	struct timeval tv;
+	int64_t now;
+
+	if(strncmp(s, "now", 3) != 0) {
+		return parse_duration(s);
+	}
+	gettimeofday(&tv, NULL);
+	now = (int64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+	if(s[3] == '-') {
+		return now - parse_duration(s + 4);
+	}
+	return s[3] == '\0' ? now : parse_duration(s);
+}
+/*---------------------------------------------------------------------------*/
+static uint16_t
+parse_node(const char *s)
+{
+	unsigned a, b;
+	char end;
+
+	if(sscanf(s, "%u.%u%c", &a, &b, &end) != 2 || a > 255 || b > 255) {
+		usage();
+	}
+	return a | (b << 8);
+}
+/*---------------------------------------------------------------------------*/
+/* Resolves a node, "zone:N" or "all" to a list of nodes. */
+static int
+select_nodes(const char *root, const char *s, uint16_t *nodes)
+{
+	uint16_t all[QUERY_MAX_NODES];
+	int i, n, count = 0, zone;
+
+	if(strcmp(s, "all") == 0) {
+		return query_nodes(root, nodes, QUERY_MAX_NODES);
+	}
+	if(strncmp(s, "zone:", 5) != 0) {
+		nodes[0] = parse_node(s);
+		return 1;
+	}
+
+	zone = atoi(s + 5);
+	n = query_nodes(root, all, QUERY_MAX_NODES);
+	for(i = 0; i < n; i++) {
+		if(QUERY_ZONE(all[i]) == zone) {
+			nodes[count++] = all[i];
+		}
+	}
+	return count;
+}
+/*---------------------------------------------------------------------------*/
+static void
+print_aggregate(const struct aggregate *a)
+{
+	if(a->count == 0) {
+		printf("count 0\n");
+		return;
+	}
+	printf("count %llu min %d max %d mean %.2f\n", (unsigned long long)a->count,
+			(int)a->min, (int)a->max, (double)a->sum / a->count);
+}
+/*---------------------------------------------------------------------------*/
+static int
+print_point(void *ctx, int64_t time, int32_t value)
+{
+	printf("%lld %d\n", (long long)time, (int)value);
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+int
+main(int argc, char **argv)
+{
+	static uint16_t nodes[QUERY_MAX_NODES];
+	struct aggregate a, *out;
+	const char *root = NULL, *cmd;
+	int64_t from, to, step;
+	size_t i, count;
+	uint8_t type;
+	int n, j, opt;
+
+	while((opt = getopt(argc, argv, "s:")) != -1) {
+		switch(opt) {
+		case 's': root = optarg; break;
+		default: usage();
+		}
+	}
+	if(root == NULL || optind >= argc) {
+		usage();
+	}
+	cmd = argv[optind];
+	argv += optind + 1;
+	argc -= optind + 1;
+
+	if(strcmp(cmd, "nodes") == 0) {
+		n = query_nodes(root, nodes, QUERY_MAX_NODES);
+		for(j = 0; j < n; j++) {
+			printf("%d.%d zone %d\n", nodes[j] & 0xff, nodes[j] >> 8, QUERY_ZONE(nodes[j]));
+		}
+		return 0;
+	}
+
+	if(strcmp(cmd, "rebuild") == 0) {
+		if(argc != 2) {
+			usage();
+		}
+		if(!query_rebuild(root, parse_node(argv[0]), atoi(argv[1]))) {
+			fprintf(stderr, "tsquery: cannot rebuild the rollups of %s type %s\n", argv[0], argv[1]);
+			return 1;
+		}
+		return 0;
+	}
+
+	if(argc < 4) {
+		usage();
+	}
+	type = atoi(argv[1]);
+	from = parse_time(argv[2]);
+	to = parse_time(argv[3]);
+
+	if(strcmp(cmd, "range") == 0 && argc == 4) {
+		if(!query_range(root, parse_node(argv[0]), type, from, to, print_point, NULL)) {
+			fprintf(stderr, "tsquery: no series %s type %d\n", argv[0], type);
+			return 1;
+		}
+		return 0;
+	}
+
+	n = select_nodes(root, argv[0], nodes);
+
+	if(strcmp(cmd, "agg") == 0 && argc == 4) {
+		aggregate_init(&a);
+		for(j = 0; j < n; j++) {
+			query_aggregate(root, nodes[j], type, from, to, &a);
+		}
+		print_aggregate(&a);
+		return 0;
+	}
+
+	if(strcmp(cmd, "down") == 0 && argc == 5) {
+		step = parse_duration(argv[4]);
+		if(step <= 0 || to <= from) {
+			usage();
+		}
+		// align to the step so whole rollup buckets fall into each one
+		from -= from % step;
+		count = (to - from + step - 1) / step;
+		if(count > TSQUERY_MAX_BUCKETS) {
+			fprintf(stderr, "tsquery: %lu buckets, use a larger step\n", (unsigned long)count);
+			return 1;
+		}
+		out = malloc(count * sizeof(*out));
+		if(out == NULL) {
+			perror("tsquery");
+			return 1;
+		}
+		for(i = 0; i < count; i++) {
+			aggregate_init(&out[i]);
+		}
+		for(j = 0; j < n; j++) {
+			query_downsample(root, nodes[j], type, from, step, count, out);
+		}
+		for(i = 0; i < count; i++) {
+			if(out[i].count > 0) {
+				printf("%lld ", (long long)(from + (int64_t)i * step));
+				print_aggregate(&out[i]);
+			}
+		}
+		free(out);
+		return 0;
+	}
+
+	usage();
+	return 2;
+}
+/*---------------------------------------------------------------------------*/
@@ -0,0 +1,676 @@
+/*
+ * tsstore.c
+ *
+ * See tsstore.h.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "tsstore.h"
+#include "rollup.h"
+
+#define TSBLOCK_MAGIC 0x31425354	/* "TSB1" */
+#define TSBLOCK_HEADER 44
+
+/* Largest encoding of one point: 4 + 32 bits of time and 2 + 10 + 32 bits of value. */
+#define TSBLOCK_POINT_BITS 80
+
+#define SERIES_BUCKETS 256
+
+struct series
+{
+	struct series *next;
+	uint16_t node;
+	uint8_t type;
+	int dirty;
+	struct tsblock block;
+	struct rollup minutes, hours;
+};
+
+struct tsstore
+{
+	char *root;
+	struct series *buckets[SERIES_BUCKETS];
+};
+
+/*---------------------------------------------------------------------------*/
+static void
+put_le(uint8_t *p, uint64_t v, int n)
+{
+	int i;
+
+	for(i = 0; i < n; i++) {
+		p[i] = v >> (8 * i);
+	}
+}
+/*---------------------------------------------------------------------------*/
+static uint64_t
+get_le(const uint8_t *p, int n)
+{
+	uint64_t v = 0;
+	int i;
+
+	for(i = n - 1; i >= 0; i--) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsblock_init(struct tsblock *b)
+{
+	memset(b, 0, sizeof(*b));
+	bitwriter_init(&b->w, b->data, sizeof(b->data));
+	b->lead = -1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+clz32(uint32_t x)
+{
+	int n = 0;
+
+	while(!(x & 0x80000000u)) {
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+static int
+ctz32(uint32_t x)
+{
+	int n = 0;
+
+	while(!(x & 1)) {
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsblock_append(struct tsblock *b, int64_t time, int32_t value)
+{
+	struct bitwriter *w = &b->w;
+	int64_t delta, dod;
+	uint32_t x;
+	int lead, trail;
+
+	if(b->count == 0) {
+		b->first_time = b->last_time = time;
+		b->first_value = b->last_value = value;
+		b->min = b->max = value;
+		b->sum = value;
+		b->count = 1;
+		return 1;
+	}
+
+	delta = time - b->last_time;
+	dod = delta - b->last_delta;
+	if(dod < INT32_MIN || dod > INT32_MAX || b->count == UINT16_MAX ||
+	   w->bits + TSBLOCK_POINT_BITS > w->size * 8) {
+		return 0;
+	}
+
+	if(dod == 0) {
+		bitwriter_put(w, 0, 1);
+	} else if(dod >= -63 && dod <= 64) {
+		bitwriter_put(w, 0x2, 2);
+		bitwriter_put(w, dod + 63, 7);
+	} else if(dod >= -255 && dod <= 256) {
+		bitwriter_put(w, 0x6, 3);
+		bitwriter_put(w, dod + 255, 9);
+	} else if(dod >= -2047 && dod <= 2048) {
+		bitwriter_put(w, 0xe, 4);
+		bitwriter_put(w, dod + 2047, 12);
+	} else {
+		bitwriter_put(w, 0xf, 4);
+		bitwriter_put(w, (uint32_t)dod, 32);
+	}
+
+	x = (uint32_t)value ^ (uint32_t)b->last_value;
+	if(x == 0) {
+		bitwriter_put(w, 0, 1);
+	} else {
+		lead = clz32(x);
+		trail = ctz32(x);
+		if(b->lead >= 0 && lead >= b->lead && trail >= b->trail) {
+			// fits into the previous window
+			bitwriter_put(w, 0x2, 2);
+			bitwriter_put(w, x >> b->trail, 32 - b->lead - b->trail);
+		} else {
+			bitwriter_put(w, 0x3, 2);
+			bitwriter_put(w, lead, 5);
+			bitwriter_put(w, 32 - lead - trail - 1, 5);
+			bitwriter_put(w, x >> trail, 32 - lead - trail);
+			b->lead = lead;
+			b->trail = trail;
+		}
+	}
+
+	b->last_delta = delta;
+	b->last_time = time;
+	b->last_value = value;
+	if(value < b->min) b->min = value;
+	if(value > b->max) b->max = value;
+	b->sum += value;
+	b->count++;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static void
+encode_header(const struct tsblock *b, uint8_t *h)
+{
+	put_le(h, TSBLOCK_MAGIC, 4);
+	put_le(h + 4, b->count, 2);
+	put_le(h + 6, bitwriter_bytes(&b->w), 2);
+	put_le(h + 8, b->first_time, 8);
+	put_le(h + 16, b->last_time, 8);
+	put_le(h + 24, (uint32_t)b->first_value, 4);
+	put_le(h + 28, (uint32_t)b->min, 4);
+	put_le(h + 32, (uint32_t)b->max, 4);
+	put_le(h + 36, b->sum, 8);
+}
+/*---------------------------------------------------------------------------*/
+struct raw_block
+{
+	struct tsblock_info info;
+	int32_t first_value;
+	uint16_t bytes;
+	uint8_t data[TSBLOCK_BYTES];
+};
+/*---------------------------------------------------------------------------*/
+/* Reads the next block of f. Returns 1 on success, 0 at the end, -1 on a corrupt file. */
+static int
+read_block(FILE *f, struct raw_block *r, int with_data)
+{
+	uint8_t h[TSBLOCK_HEADER];
+
+	if(fread(h, 1, sizeof(h), f) != sizeof(h)) {
+		return 0;
+	}
+	if(get_le(h, 4) != TSBLOCK_MAGIC) {
+		return -1;
+	}
+
+	r->info.count = get_le(h + 4, 2);
+	r->bytes = get_le(h + 6, 2);
+	r->info.first_time = (int64_t)get_le(h + 8, 8);
+	r->info.last_time = (int64_t)get_le(h + 16, 8);
+	r->first_value = (int32_t)get_le(h + 24, 4);
+	r->info.min = (int32_t)get_le(h + 28, 4);
+	r->info.max = (int32_t)get_le(h + 32, 4);
+	r->info.sum = (int64_t)get_le(h + 36, 8);
+
+	if(r->bytes > TSBLOCK_BYTES) {
+		return -1;
+	}
+	if(!with_data) {
+		return fseek(f, r->bytes, SEEK_CUR) == 0 ? 1 : -1;
+	}
+	return fread(r->data, 1, r->bytes, f) == r->bytes ? 1 : -1;
+}
+/*---------------------------------------------------------------------------*/
+/* Decodes the points of a block. Returns non-zero if visit asked to stop. */
+static int
+decode_block(const struct raw_block *r, int64_t from, int64_t to,
+		tsstore_visit visit, void *ctx)
+{
+	struct bitreader rd;
+	int64_t time = r->info.first_time, delta = 0, dod;
+	uint32_t value = r->first_value;
+	int lead = 0, trail = 0, len;
+	uint64_t v;
+	uint16_t i;
+
+	bitreader_init(&rd, r->data, r->bytes);
+
+	for(i = 0; i < r->info.count; i++) {
+		if(i > 0) {
+			if(!bitreader_get(&rd, 1, &v)) return 0;
+			if(v == 0) {
+				dod = 0;
+			} else {
+				bitreader_get(&rd, 1, &v);
+				if(v == 0) {
+					bitreader_get(&rd, 7, &v);
+					dod = (int64_t)v - 63;
+				} else {
+					bitreader_get(&rd, 1, &v);
+					if(v == 0) {
+						bitreader_get(&rd, 9, &v);
+						dod = (int64_t)v - 255;
+					} else {
+						bitreader_get(&rd, 1, &v);
+						if(v == 0) {
+							bitreader_get(&rd, 12, &v);
+							dod = (int64_t)v - 2047;
+						} else {
+							bitreader_get(&rd, 32, &v);
+							dod = (int32_t)(uint32_t)v;
+						}
+					}
+				}
+			}
+			delta += dod;
+			time += delta;
+
+			if(!bitreader_get(&rd, 1, &v)) return 0;
+			if(v == 1) {
+				bitreader_get(&rd, 1, &v);
+				if(v == 1) {
+					bitreader_get(&rd, 5, &v);
+					lead = v;
+					bitreader_get(&rd, 5, &v);
+					trail = 32 - lead - ((int)v + 1);
+				}
+				len = 32 - lead - trail;
+				if(!bitreader_get(&rd, len, &v)) return 0;
+				value ^= (uint32_t)v << trail;
+			}
+		}
+
+		if(time > to) {
+			return 1;
+		}
+		if(time >= from && visit(ctx, time, (int32_t)value)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsstore_path(char *path, size_t size, const char *root, uint16_t node, uint8_t type, const char *ext)
+{
+	snprintf(path, size, "%s/%d.%d/%d.%s", root, node & 0xff, node >> 8, type, ext);
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_block(FILE *f, const struct tsblock *b)
+{
+	uint8_t h[TSBLOCK_HEADER];
+
+	encode_header(b, h);
+	return fwrite(h, 1, sizeof(h), f) == sizeof(h) &&
+		fwrite(b->data, 1, bitwriter_bytes(&b->w), f) == bitwriter_bytes(&b->w);
+}
+/*---------------------------------------------------------------------------*/
+static int
+append_point(void *ctx, int64_t time, int32_t value)
+{
+	return !tsblock_append(ctx, time, value);
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * A tail sealed just before a stop starts the last block of ts as well. It
+ * usually holds fewer points than were sealed, so only the times are
+ * compared: the next block starts at the last time of the sealed one at the
+ * earliest.
+ */
+static int
+sealed_tail(const struct tsblock_info *last, const struct tsblock_info *tail)
+{
+	return last->count != 0 &&
+			(tail->first_time == last->first_time || tail->first_time < last->last_time);
+}
+/*---------------------------------------------------------------------------*/
+/* Rebuilds the open block of a series from its tail file. */
+static void
+load_tail(struct tsstore *s, struct series *se)
+{
+	static struct raw_block tail, last;
+	char path[512];
+	FILE *f;
+	int have_last = 0;
+
+	tsblock_init(&se->block);
+
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "tail");
+	f = fopen(path, "rb");
+	if(f == NULL) {
+		return;
+	}
+	if(read_block(f, &tail, 1) != 1) {
+		fclose(f);
+		return;
+	}
+	fclose(f);
+
+	// the tail may already have been sealed when we stopped in between
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "ts");
+	f = fopen(path, "rb");
+	if(f != NULL) {
+		while(read_block(f, &last, 0) == 1) {
+			have_last = 1;
+		}
+		fclose(f);
+	}
+	if(have_last && sealed_tail(&last.info, &tail.info)) {
+		return;
+	}
+
+	decode_block(&tail, INT64_MIN, INT64_MAX, append_point, &se->block);
+}
+/*---------------------------------------------------------------------------*/
+static int
+write_tail(struct tsstore *s, struct series *se)
+{
+	char path[512], tmp[520];
+	FILE *f;
+	int ok;
+
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "tail");
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+	f = fopen(tmp, "wb");
+	if(f == NULL) {
+		return 0;
+	}
+	ok = write_block(f, &se->block);
+	ok = fclose(f) == 0 && ok;
+	if(!ok || rename(tmp, path) != 0) {
+		return 0;
+	}
+	se->dirty = 0;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+seal(struct tsstore *s, struct series *se)
+{
+	char path[512];
+	FILE *f;
+	int ok;
+
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "ts");
+	f = fopen(path, "ab");
+	if(f == NULL) {
+		return 0;
+	}
+	ok = write_block(f, &se->block);
+	ok = fclose(f) == 0 && ok;
+	if(!ok) {
+		return 0;
+	}
+
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "tail");
+	remove(path);
+	tsblock_init(&se->block);
+	se->dirty = 0;
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+static int
+sync_rollups(struct tsstore *s, struct series *se)
+{
+	char path[512];
+	int ok;
+
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "r60");
+	ok = rollup_sync(&se->minutes, path);
+	tsstore_path(path, sizeof(path), s->root, se->node, se->type, "r3600");
+	return rollup_sync(&se->hours, path) && ok;
+}
+/*---------------------------------------------------------------------------*/
+/* The rollups only follow the tail, so they never count a point that was lost. */
+static int
+sync_series(struct tsstore *s, struct series *se)
+{
+	if(se->dirty && !write_tail(s, se)) {
+		return 0;
+	}
+	return sync_rollups(s, se);
+}
+/*---------------------------------------------------------------------------*/
+static int
+add_rollup(struct tsstore *s, struct series *se, struct rollup *r, int64_t time, int32_t value)
+{
+	if(rollup_add(r, time, value)) {
+		return 1;
+	}
+	// too many completed buckets wait, write them out now
+	return sync_series(s, se) && rollup_add(r, time, value);
+}
+/*---------------------------------------------------------------------------*/
+struct refill
+{
+	struct tsstore *s;
+	struct series *se;
+	int64_t from[2];
+};
+/*---------------------------------------------------------------------------*/
+static int
+refill_point(void *ctx, int64_t time, int32_t value)
+{
+	struct refill *f = ctx;
+	struct rollup *r[2] = {&f->se->minutes, &f->se->hours};
+	int i;
+
+	for(i = 0; i < 2; i++) {
+		if(time < f->from[i]) {
+			continue;
+		}
+		// the last record is counted again from the first of its points
+		if(f->from[i] != INT64_MIN && time < f->from[i] + r[i]->step && !r[i]->dirty) {
+			aggregate_init(&r[i]->cur.agg);
+		}
+		if(!add_rollup(f->s, f->se, r[i], time, value)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Brings the rollups of a series up to its points. Blocks are sealed and
+ * tails written ahead of the rollups, so after a crash the last buckets may
+ * miss points; they are counted again from the series and written with
+ * the next sync.
+ */
+static void
+refill_rollups(struct tsstore *s, struct series *se)
+{
+	static struct refill f;
+
+	f.s = s;
+	f.se = se;
+	f.from[0] = se->minutes.have ? se->minutes.cur.start : INT64_MIN;
+	f.from[1] = se->hours.have ? se->hours.cur.start : INT64_MIN;
+	tsstore_scan(s->root, se->node, se->type, f.from[0] < f.from[1] ? f.from[0] : f.from[1],
+			INT64_MAX, refill_point, NULL, &f);
+}
+/*---------------------------------------------------------------------------*/
+static struct series *
+find_series(struct tsstore *s, uint16_t node, uint8_t type)
+{
+	unsigned bucket = (node * 31 + type) % SERIES_BUCKETS;
+	struct series *se;
+	char path[512];
+
+	for(se = s->buckets[bucket]; se != NULL; se = se->next) {
+		if(se->node == node && se->type == type) {
+			return se;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/%d.%d", s->root, node & 0xff, node >> 8);
+	if(mkdir(path, 0755) != 0 && errno != EEXIST) {
+		return NULL;
+	}
+
+	se = calloc(1, sizeof(*se));
+	if(se == NULL) {
+		return NULL;
+	}
+	se->node = node;
+	se->type = type;
+	load_tail(s, se);
+
+	tsstore_path(path, sizeof(path), s->root, node, type, "r60");
+	rollup_load(&se->minutes, path, ROLLUP_MINUTE);
+	tsstore_path(path, sizeof(path), s->root, node, type, "r3600");
+	rollup_load(&se->hours, path, ROLLUP_HOUR);
+	refill_rollups(s, se);
+
+	se->next = s->buckets[bucket];
+	s->buckets[bucket] = se;
+	return se;
+}
+/*---------------------------------------------------------------------------*/
+struct tsstore *
+tsstore_open(const char *root)
+{
+	struct tsstore *s;
+
+	if(mkdir(root, 0755) != 0 && errno != EEXIST) {
+		return NULL;
+	}
+	s = calloc(1, sizeof(*s));
+	if(s == NULL) {
+		return NULL;
+	}
+	s->root = strdup(root);
+	return s;
+}
+/*---------------------------------------------------------------------------*/
+void
+tsstore_close(struct tsstore *s)
+{
+	struct series *se, *next;
+	int i;
+
+	tsstore_sync(s);
+	for(i = 0; i < SERIES_BUCKETS; i++) {
+		for(se = s->buckets[i]; se != NULL; se = next) {
+			next = se->next;
+			free(se);
+		}
+	}
+	free(s->root);
+	free(s);
+}
+/*---------------------------------------------------------------------------*/
+int
+tsstore_append(struct tsstore *s, uint16_t node, uint8_t type, int64_t time, int32_t value)
+{
+	struct series *se = find_series(s, node, type);
+	int ok;
+
+	if(se == NULL) {
+		return 0;
+	}
+	if(se->block.count > 0 && time < se->block.last_time) {
+		time = se->block.last_time;
+	}
+
+	if(!tsblock_append(&se->block, time, value)) {
+		if(!seal(s, se)) {
+			return 0;
+		}
+		tsblock_append(&se->block, time, value);
+	}
+	se->dirty = 1;
+	ok = add_rollup(s, se, &se->minutes, time, value);
+	return add_rollup(s, se, &se->hours, time, value) && ok;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsstore_sync(struct tsstore *s)
+{
+	struct series *se;
+	int i, ok = 1;
+
+	for(i = 0; i < SERIES_BUCKETS; i++) {
+		for(se = s->buckets[i]; se != NULL; se = se->next) {
+			if(!sync_series(s, se)) {
+				ok = 0;
+			}
+		}
+	}
+	return ok;
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Returns 1 to go on, 0 if the scan was stopped. A tail already sealed as
+ * last is skipped, and last is left with the header of the last block read.
+ */
+static int
+scan_file(const char *path, int64_t from, int64_t to, struct tsblock_info *last,
+		tsstore_visit visit, tsstore_visit_block block, void *ctx)
+{
+	struct tsblock_info skip = *last;
+
+	static struct raw_block r;
+	long pos;
+	FILE *f;
+	int ret = 1;
+
+	f = fopen(path, "rb");
+	if(f == NULL) {
+		return 1;
+	}
+
+	for(;;) {
+		pos = ftell(f);
+		if(read_block(f, &r, 0) != 1) {
+			break;
+		}
+		*last = r.info;
+		if(sealed_tail(&skip, &r.info) || r.info.last_time < from) {
+			continue;
+		}
+		if(r.info.first_time > to) {
+			ret = 0;
+			break;
+		}
+		if(block != NULL && r.info.first_time >= from && r.info.last_time <= to &&
+		   block(ctx, &r.info)) {
+			continue;
+		}
+
+		// only now the encoded points are needed
+		fseek(f, pos, SEEK_SET);
+		if(read_block(f, &r, 1) != 1) {
+			break;
+		}
+		if(decode_block(&r, from, to, visit, ctx)) {
+			ret = 0;
+			break;
+		}
+	}
+	fclose(f);
+	return ret;
+}
+/*---------------------------------------------------------------------------*/
+int
+tsstore_scan(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		tsstore_visit visit, tsstore_visit_block block, void *ctx)
+{
+	char path[512];
+	struct tsblock_info last;
+	struct stat st;
+	int found = 0;
+
+	memset(&last, 0, sizeof(last));
+	tsstore_path(path, sizeof(path), root, node, type, "ts");
+	if(stat(path, &st) == 0) {
+		found = 1;
+		if(!scan_file(path, from, to, &last, visit, block, ctx)) {
+			return 1;
+		}
+	}
+
+	tsstore_path(path, sizeof(path), root, node, type, "tail");
+	if(stat(path, &st) == 0) {
+		found = 1;
+		// the tail is skipped if it was sealed into ts before a stop
+		scan_file(path, from, to, &last, visit, block, ctx);
+	}
+	return found;
+}
+/*---------------------------------------------------------------------------*/
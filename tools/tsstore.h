@@ -0,0 +1,96 @@
+/*
+ * tsstore.h
+ *
+ * Compressed time-series store for ingested readings. Every node has its own
+ * directory under the store root (the shard), with one series per reading
+ * type. A series is a file of sealed blocks plus a tail file holding the
+ * block that is still being filled.
+ *
+ * Inside a block, timestamps are stored as delta-of-delta and values as
+ * the XOR with the previous value, both with variable-length bit codes,
+ * the way Facebook's Gorilla does it. Regular readings of a slowly changing
+ * value take a couple of bits each. Every block header carries count, time
+ * range, min, max and sum, so scans can skip or summarise whole blocks.
+ *
+ * Appending also keeps the minute and hour rollups of the series up to date
+ * (see rollup.h), which are written out together with the tails.
+ */
+
+#ifndef TSSTORE_H_
+#define TSSTORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bitstream.h"
+
+/* Encoded bytes per block, excluding the header. */
+#define TSBLOCK_BYTES 2048
+
+struct tsblock
+{
+	uint8_t data[TSBLOCK_BYTES];
+	struct bitwriter w;
+
+	uint16_t count;
+	int64_t first_time, last_time, last_delta;
+	int32_t first_value, last_value, min, max;
+	int64_t sum;
+
+	/* the XOR window of the previous value, lead < 0 if there is none */
+	int lead, trail;
+};
+
+/* Summary of a block, as stored in its header. */
+struct tsblock_info
+{
+	uint16_t count;
+	int64_t first_time, last_time;
+	int32_t min, max;
+	int64_t sum;
+};
+
+struct tsstore;
+
+/* Called for every point of a scan, in time order. Returning non-zero stops the scan. */
+typedef int (*tsstore_visit)(void *ctx, int64_t time, int32_t value);
+
+/*
+ * Called for every block of a scan. Returning non-zero means the summary in
+ * info was used and the points of the block are not needed.
+ */
+typedef int (*tsstore_visit_block)(void *ctx, const struct tsblock_info *info);
+
+void tsblock_init(struct tsblock *b);
+
+/* Returns 0 if the point does not fit and the block has to be sealed first. */
+int tsblock_append(struct tsblock *b, int64_t time, int32_t value);
+
+/* Opens the store under root for writing, creating it if needed. */
+struct tsstore *tsstore_open(const char *root);
+
+/* Writes all tails and frees the store. */
+void tsstore_close(struct tsstore *s);
+
+/*
+ * Appends a point. node is the Rime address, u8[0] in the low byte. Points
+ * of a series have to come in time order; older ones are moved up to the
+ * last time. Returns 0 on an I/O error.
+ */
+int tsstore_append(struct tsstore *s, uint16_t node, uint8_t type, int64_t time, int32_t value);
+
+/* Writes the tails and rollups of all series changed since the last sync. */
+int tsstore_sync(struct tsstore *s);
+
+/* Builds the path of the file ext ("ts", "tail", "r60", ...) of a series. */
+void tsstore_path(char *path, size_t size, const char *root, uint16_t node, uint8_t type, const char *ext);
+
+/*
+ * Visits the points of a series in [from, to]. If block is not NULL it is
+ * offered every block that lies completely inside the range first. Returns
+ * 0 if the series does not exist.
+ */
+int tsstore_scan(const char *root, uint16_t node, uint8_t type, int64_t from, int64_t to,
+		tsstore_visit visit, tsstore_visit_block block, void *ctx);
+
+#endif /* TSSTORE_H_ */
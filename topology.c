@@ -0,0 +1,255 @@
+/*
+ * topology.c
+ *
+ * See topology.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+#include "net/rime/mesh.h"
+#include "lib/list.h"
+#include "lib/memb.h"
+#include "random.h"
+
+#include "topology.h"
+#include "counters.h"
+
+/* Transmissions charged for a runicast that was never acknowledged, at least. */
+#define TOPOLOGY_ETX_FAILED 8
+
+/* Sends and failures of a link are halved once this many sends are counted. */
+#define TOPOLOGY_SENDS_WINDOW 32
+
+/*
+ * Per priority class, the residual loss a send may be left with, in
+ * 1/256, and the most retransmissions it gets. The last class also
+ * covers anything less urgent.
+ */
+static const uint8_t budget_loss[] = {2, 8, 32};
+static const uint8_t budget_max[] = {15, 12, 8};
+#define BUDGET_CLASSES (sizeof(budget_loss) / sizeof(budget_loss[0]))
+
+struct link
+{
+	struct link *next;
+	linkaddr_t addr;
+	uint8_t etx;
+	int8_t rssi;
+	uint8_t age;
+	uint8_t sends;
+	uint8_t failures;
+};
+
+MEMB(links_memb, struct link, TOPOLOGY_LINKS);
+LIST(links);
+
+static struct mesh_conn mesh;
+static struct ctimer report_timer;
+static const struct topology_callbacks *callbacks;
+static uint8_t seqno;
+
+/*---------------------------------------------------------------------------*/
+static struct link *
+find(const linkaddr_t *addr)
+{
+	struct link *l, *weakest = NULL;
+
+	for(l = list_head(links); l != NULL; l = list_item_next(l)) {
+		if(linkaddr_cmp(&l->addr, addr)) {
+			return l;
+		}
+		if(weakest == NULL || l->rssi < weakest->rssi) {
+			weakest = l;
+		}
+	}
+
+	l = memb_alloc(&links_memb);
+	if(l == NULL) {
+		// make room by dropping the weakest link we know
+		COUNTERS_INC(COUNTERS_NEIGHBORS, COUNTER_POOL_FULL);
+		l = weakest;
+		list_remove(links, l);
+	}
+	linkaddr_copy(&l->addr, addr);
+	l->etx = 0;
+	l->rssi = TOPOLOGY_RSSI_NONE;
+	l->age = 0;
+	l->sends = 0;
+	l->failures = 0;
+	list_add(links, l);
+	return l;
+}
+/*---------------------------------------------------------------------------*/
+void
+topology_heard(const linkaddr_t *from)
+{
+	struct link *l = find(from);
+	int8_t rssi = (int8_t)packetbuf_attr(PACKETBUF_ATTR_RSSI);
+
+	// alpha 1/4, starting from the first sample
+	l->rssi = l->rssi == TOPOLOGY_RSSI_NONE ? rssi : (3 * l->rssi + rssi) / 4;
+	l->age = 0;
+}
+/*---------------------------------------------------------------------------*/
+void
+topology_sent(const linkaddr_t *to, uint8_t transmissions, int acked)
+{
+	struct link *l = find(to);
+	uint16_t etx;
+
+	if(!acked) {
+		// a failure with a large budget says more than one with a small one
+		transmissions = transmissions * 2 > TOPOLOGY_ETX_FAILED ? transmissions * 2 : TOPOLOGY_ETX_FAILED;
+		l->failures++;
+	}
+	etx = transmissions * TOPOLOGY_ETX_UNIT;
+	if(l->etx != 0) {
+		etx = (3 * l->etx + etx) / 4;
+	}
+	l->etx = etx > 255 ? 255 : etx;
+
+	if(++l->sends >= TOPOLOGY_SENDS_WINDOW) {
+		l->sends /= 2;
+		l->failures /= 2;
+	}
+}
+/*---------------------------------------------------------------------------*/
+uint8_t
+topology_budget(const linkaddr_t *to, uint8_t priority, uint8_t fallback)
+{
+	struct link *l;
+	uint16_t loss, residual = 256;
+	uint8_t transmissions = 0;
+
+	if(priority >= BUDGET_CLASSES) {
+		priority = BUDGET_CLASSES - 1;
+	}
+	for(l = list_head(links); l != NULL; l = list_item_next(l)) {
+		if(linkaddr_cmp(&l->addr, to)) {
+			break;
+		}
+	}
+	if(l == NULL || l->etx == 0) {
+		return fallback;
+	}
+
+	// a transmission gets through with probability 1 / ETX
+	loss = l->etx <= TOPOLOGY_ETX_UNIT ? 0 : 256 - 256 * TOPOLOGY_ETX_UNIT / l->etx;
+	while(residual > budget_loss[priority] && transmissions <= budget_max[priority]) {
+		residual = residual * loss / 256;
+		transmissions++;
+	}
+
+	// one retransmission is always allowed for a lost ack, and one more
+	// while more than one send in eight fails
+	if(transmissions < 2) {
+		transmissions = 2;
+	}
+	if(l->failures * 8 > l->sends) {
+		transmissions++;
+	}
+	return transmissions - 1 < budget_max[priority] ? transmissions - 1 : budget_max[priority];
+}
+/*---------------------------------------------------------------------------*/
+int
+topology_snapshot(struct topology_link *out, uint8_t max)
+{
+	struct link *l;
+	uint8_t count = 0;
+
+	for(l = list_head(links); l != NULL && count < max; l = list_item_next(l)) {
+		out[count].addr[0] = l->addr.u8[0];
+		out[count].addr[1] = l->addr.u8[1];
+		out[count].etx = l->etx;
+		out[count].rssi = l->rssi;
+		count++;
+	}
+	return count;
+}
+/*---------------------------------------------------------------------------*/
+static void
+send_report(void *ptr)
+{
+	struct link *l, *next;
+	uint8_t *buf;
+	linkaddr_t sink;
+
+	ctimer_set(&report_timer, TOPOLOGY_INTERVAL / 2 + random_rand() % TOPOLOGY_INTERVAL,
+			send_report, NULL);
+
+	for(l = list_head(links); l != NULL; l = next) {
+		next = list_item_next(l);
+		if(++l->age > TOPOLOGY_MAX_AGE) {
+			list_remove(links, l);
+			memb_free(&links_memb, l);
+		}
+	}
+
+	packetbuf_clear();
+	buf = packetbuf_dataptr();
+	buf[0] = seqno++;
+	buf[1] = topology_snapshot((struct topology_link *)(buf + TOPOLOGY_REPORT_HEADER), TOPOLOGY_LINKS);
+	packetbuf_set_datalen(TOPOLOGY_REPORT_HEADER + buf[1] * sizeof(struct topology_link));
+
+	sink.u8[0] = TOPOLOGY_SINK_0;
+	sink.u8[1] = TOPOLOGY_SINK_1;
+	mesh_send(&mesh, &sink);
+}
+/*---------------------------------------------------------------------------*/
+static void
+recv(struct mesh_conn *c, const linkaddr_t *from, uint8_t hops)
+{
+	uint8_t *buf = packetbuf_dataptr();
+	uint8_t count;
+
+	topology_heard(packetbuf_addr(PACKETBUF_ADDR_SENDER));
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_RX);
+
+	if(callbacks == NULL || packetbuf_datalen() < TOPOLOGY_REPORT_HEADER) {
+		return;
+	}
+	count = buf[1];
+	if(packetbuf_datalen() < TOPOLOGY_REPORT_HEADER + count * sizeof(struct topology_link)) {
+		return;
+	}
+	callbacks->report(from, hops, (struct topology_link *)(buf + TOPOLOGY_REPORT_HEADER), count);
+}
+/*---------------------------------------------------------------------------*/
+static void
+sent(struct mesh_conn *c)
+{
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_TX);
+}
+/*---------------------------------------------------------------------------*/
+static void
+timedout(struct mesh_conn *c)
+{
+	// the next report goes out anyway
+	COUNTERS_INC(COUNTERS_TOPOLOGY, COUNTER_TIMEOUTS);
+}
+/*---------------------------------------------------------------------------*/
+static const struct mesh_callbacks mesh_callbacks = {recv, sent, timedout};
+/*---------------------------------------------------------------------------*/
+void
+topology_open(const struct topology_callbacks *cb)
+{
+	callbacks = cb;
+	memb_init(&links_memb);
+	list_init(links);
+	mesh_open(&mesh, TOPOLOGY_CHANNEL, &mesh_callbacks);
+
+	if(callbacks == NULL) {
+		ctimer_set(&report_timer, TOPOLOGY_INTERVAL / 2 + random_rand() % TOPOLOGY_INTERVAL,
+				send_report, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+topology_close(void)
+{
+	ctimer_stop(&report_timer);
+	mesh_close(&mesh);
+}
+/*---------------------------------------------------------------------------*/
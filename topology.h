@@ -0,0 +1,84 @@
+/*
+ * topology.h
+ *
+ * Link estimation and topology reports. Every node keeps a small table of
+ * the neighbors it talks to, with a moving average of the RSSI of what it
+ * hears from them and of the transmissions runicast needs to reach them
+ * (ETX). Every TOPOLOGY_INTERVAL it sends that table, a few bytes per link,
+ * over mesh to the sink, where netmap.h turns the reports into a map.
+ */
+
+#ifndef TOPOLOGY_H_
+#define TOPOLOGY_H_
+
+#include "contiki.h"
+#include "net/rime/rime.h"
+
+/* mesh uses this channel and the two after it */
+#define TOPOLOGY_CHANNEL 150
+
+#ifndef TOPOLOGY_INTERVAL
+#define TOPOLOGY_INTERVAL (CLOCK_SECOND * 120)
+#endif
+
+/* Address of the basestation that collects the reports. */
+#ifndef TOPOLOGY_SINK_0
+#define TOPOLOGY_SINK_0 1
+#define TOPOLOGY_SINK_1 0
+#endif
+
+/* Links kept and reported per node. */
+#define TOPOLOGY_LINKS 12
+
+/* A link not heard from for this many intervals is forgotten. */
+#define TOPOLOGY_MAX_AGE 3
+
+/* ETX in sixteenths; 0 means no unicast went over the link yet. */
+#define TOPOLOGY_ETX_UNIT 16
+
+/* RSSI of a link nothing was received over yet. */
+#define TOPOLOGY_RSSI_NONE (-128)
+
+/* A link as it is reported. */
+struct topology_link
+{
+	uint8_t addr[2];
+	uint8_t etx;
+	int8_t rssi;
+};
+
+/* Report: seqno (1) | count (1) | count links */
+#define TOPOLOGY_REPORT_HEADER 2
+
+struct topology_callbacks
+{
+	/* A report arrived at the sink over hops hops. */
+	void (*report)(const linkaddr_t *from, uint8_t hops,
+			const struct topology_link *links, uint8_t count);
+};
+
+/* Opens the reporting; the sink passes callbacks, everybody else NULL. */
+void topology_open(const struct topology_callbacks *callbacks);
+void topology_close(void);
+
+/* Something was received from a neighbor; call from receive callbacks. */
+void topology_heard(const linkaddr_t *from);
+
+/*
+ * A runicast to a neighbor finished after transmissions transmissions, or
+ * failed if acked is 0.
+ */
+void topology_sent(const linkaddr_t *to, uint8_t transmissions, int acked);
+
+/*
+ * Retransmissions for a runicast to a neighbor, from the ETX of the link:
+ * enough for the residual loss allowed for priority (0 the most urgent,
+ * see mycommon.h), and one more while sends over the link keep failing.
+ * Over a link without an estimate it is fallback.
+ */
+uint8_t topology_budget(const linkaddr_t *to, uint8_t priority, uint8_t fallback);
+
+/* Copies up to max links of the table to out. Returns their number. */
+int topology_snapshot(struct topology_link *out, uint8_t max);
+
+#endif /* TOPOLOGY_H_ */
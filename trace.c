@@ -0,0 +1,170 @@
+/*
+ * trace.c
+ *
+ * See trace.h.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "contiki.h"
+
+#include "trace.h"
+
+#define TRACE_OTHER 0xffff
+
+struct histogram
+{
+	uint16_t bins[TRACE_BINS];
+	clock_time_t max;
+};
+
+struct origin
+{
+	uint16_t node;
+	struct histogram h;
+};
+
+static struct origin origins[TRACE_NODES];
+static uint8_t origin_count;
+
+/* Indexed by the hop count, the last one counts all longer paths. */
+static struct histogram by_hops[TRACE_HOPS_MAX + 1];
+
+/*---------------------------------------------------------------------------*/
+static uint8_t
+encode(clock_time_t ticks)
+{
+	clock_time_t coarse;
+
+	if(ticks < TRACE_FINE_MAX * TRACE_FINE) {
+		return ticks / TRACE_FINE;
+	}
+	coarse = (ticks - TRACE_FINE_MAX * TRACE_FINE) / TRACE_COARSE;
+	return coarse < 255 - TRACE_FINE_MAX ? TRACE_FINE_MAX + coarse : 255;
+}
+/*---------------------------------------------------------------------------*/
+static clock_time_t
+decode(uint8_t b)
+{
+	if(b < TRACE_FINE_MAX) {
+		return (clock_time_t)b * TRACE_FINE;
+	}
+	return (clock_time_t)TRACE_FINE_MAX * TRACE_FINE + (clock_time_t)(b - TRACE_FINE_MAX) * TRACE_COARSE;
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_start(struct trace *t)
+{
+	memset(t, 0, sizeof(*t));
+	t->origin = clock_time();
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_depart(struct trace *t, clock_time_t arrived)
+{
+	clock_time_t total;
+	uint8_t i;
+
+	if(t->hops < TRACE_HOPS_MAX) {
+		t->residence[t->hops++] = encode(clock_time() - arrived);
+		return;
+	}
+	// no room for another hop, the last one grows
+	i = TRACE_HOPS_MAX - 1;
+	total = decode(t->residence[i]) + (clock_time() - arrived);
+	t->residence[i] = encode(total);
+	if(t->hops < 255) {
+		t->hops++;
+	}
+}
+/*---------------------------------------------------------------------------*/
+clock_time_t
+trace_latency(const struct trace *t)
+{
+	clock_time_t total = 0;
+	uint8_t i;
+
+	for(i = 0; i < t->hops && i < TRACE_HOPS_MAX; i++) {
+		total += decode(t->residence[i]);
+	}
+	return total;
+}
+/*---------------------------------------------------------------------------*/
+static void
+add(struct histogram *h, clock_time_t latency)
+{
+	clock_time_t units = latency / TRACE_FINE;
+	uint8_t bin = 0;
+
+	while(units >= 2 && bin < TRACE_BINS - 1) {
+		units >>= 1;
+		bin++;
+	}
+	h->bins[bin]++;
+	if(latency > h->max) {
+		h->max = latency;
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_record(uint16_t origin, const struct trace *t)
+{
+	clock_time_t latency = trace_latency(t);
+	uint8_t i;
+
+	for(i = 0; i < origin_count; i++) {
+		if(origins[i].node == origin) {
+			break;
+		}
+	}
+	if(i == origin_count) {
+		if(origin_count < TRACE_NODES) {
+			origin_count++;
+			origins[i].node = origin_count < TRACE_NODES ? origin : TRACE_OTHER;
+		} else {
+			i = TRACE_NODES - 1;
+		}
+	}
+	add(&origins[i].h, latency);
+	add(&by_hops[t->hops < TRACE_HOPS_MAX ? t->hops : TRACE_HOPS_MAX], latency);
+}
+/*---------------------------------------------------------------------------*/
+static void
+print(const struct histogram *h)
+{
+	uint8_t i;
+
+	for(i = 0; i < TRACE_BINS; i++) {
+		printf(" %u", h->bins[i]);
+	}
+	printf(", max %lu ms\n", (unsigned long)h->max * 1000 / CLOCK_SECOND);
+}
+/*---------------------------------------------------------------------------*/
+void
+trace_report(int reset)
+{
+	uint8_t i;
+
+	printf("Latency buckets from %lu ms, doubling\n",
+			(unsigned long)2 * TRACE_FINE * 1000 / CLOCK_SECOND);
+	for(i = 0; i < origin_count; i++) {
+		if(origins[i].node == TRACE_OTHER) {
+			printf("Latency from others:");
+		} else {
+			printf("Latency from %u:", origins[i].node);
+		}
+		print(&origins[i].h);
+	}
+	for(i = 1; i <= TRACE_HOPS_MAX; i++) {
+		printf("Latency at hop count %u%s:", i, i == TRACE_HOPS_MAX ? "+" : "");
+		print(&by_hops[i]);
+	}
+
+	if(reset) {
+		memset(origins, 0, sizeof(origins));
+		origin_count = 0;
+		memset(by_hops, 0, sizeof(by_hops));
+	}
+}
+/*---------------------------------------------------------------------------*/
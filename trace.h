@@ -0,0 +1,60 @@
+/*
+ * trace.h
+ *
+ * End-to-end latency tracing. A reading can carry a trace: the time it was
+ * sampled on the clock of its origin, and for every hop the time it spent
+ * there, from arriving (or being sampled) to being handed to the radio.
+ * The basestation adds up the residence times of a trace and keeps
+ * latency histograms per origin and per hop count.
+ *
+ * The clocks of the nodes are not synchronised, so the latency is the sum
+ * of the residence times. The time on the air between two hops, runicast
+ * retransmissions included, is not part of it.
+ *
+ * Residence times take a byte each: up to TRACE_FINE_MAX in steps of
+ * TRACE_FINE, above that in steps of TRACE_COARSE. Beyond
+ * TRACE_HOPS_MAX hops the last one absorbs the rest.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "contiki.h"
+
+#define TRACE_HOPS_MAX 7
+
+#define TRACE_FINE (CLOCK_SECOND / 32)
+#define TRACE_FINE_MAX 128
+#define TRACE_COARSE (CLOCK_SECOND / 4)
+
+/* Latency histogram buckets: [0, 2), [2, 4), [4, 8), ... units of TRACE_FINE. */
+#define TRACE_BINS 10
+
+/* Origins with a histogram of their own; the rest share the last one. */
+#ifndef TRACE_NODES
+#define TRACE_NODES 16
+#endif
+
+struct trace
+{
+	uint16_t origin;	/* clock_time() of the origin at sampling */
+	uint8_t hops;
+	uint8_t residence[TRACE_HOPS_MAX];
+};
+
+/* Starts a trace for a reading sampled now. */
+void trace_start(struct trace *t);
+
+/* Records the hop about to send the reading, which got there at arrived. */
+void trace_depart(struct trace *t, clock_time_t arrived);
+
+/* Sum of the residence times, in clock ticks. */
+clock_time_t trace_latency(const struct trace *t);
+
+/* Basestation: adds a trace that arrived from origin to the histograms. */
+void trace_record(uint16_t origin, const struct trace *t);
+
+/* Basestation: prints the histograms, and clears them if reset is set. */
+void trace_report(int reset);
+
+#endif /* TRACE_H_ */
@@ -0,0 +1,200 @@
+/*
+ * warmstart.c
+ *
+ * See warmstart.h.
+ */
+
+#include <string.h>
+
+#include "contiki.h"
+#include "cfs/cfs.h"
+#include "cfs/cfs-coffee.h"
+#include "lib/crc16.h"
+
+#include "warmstart.h"
+#include "dlog.h"
+
+/*
+ * Closes every record. Coffee takes the last byte that is not zero for
+ * the end of a file, so a record must not end in one.
+ */
+#define WARMSTART_END 0x5a
+
+struct record
+{
+	uint16_t seqno;
+	uint16_t len;
+	uint16_t crc;		/* of the len bytes after the record header */
+};
+
+static const struct warmstart_callbacks *callbacks;
+static struct ctimer save_timer;
+static uint8_t buf[WARMSTART_MAX];
+
+/* The last record written, or read at boot. */
+static struct record last;
+static uint8_t have_last;
+
+/* The file appended to and the bytes in it. */
+static uint8_t current;
+static uint16_t fill;
+
+/*---------------------------------------------------------------------------*/
+static const char *
+file_name(uint8_t i)
+{
+	return i ? "warm.1" : "warm.0";
+}
+/*---------------------------------------------------------------------------*/
+/*
+ * Walks the records of file i up to the first one that is not whole.
+ * Returns the offset of the last good one, or -1. size is set to where
+ * the good records end, or to WARMSTART_FILE_SIZE if something follows
+ * them, so nothing is appended behind a torn record.
+ */
+static int
+scan(uint8_t i, struct record *newest, uint16_t *size)
+{
+	struct record r;
+	uint16_t pos = 0;
+	uint8_t end;
+	int fd, found = -1;
+
+	*size = 0;
+	fd = cfs_open(file_name(i), CFS_READ);
+	if(fd < 0) {
+		return -1;
+	}
+	while(cfs_read(fd, &r, sizeof(r)) == sizeof(r)) {
+		if(r.len == 0 || r.len > WARMSTART_MAX ||
+				cfs_read(fd, buf, r.len) != r.len || crc16_data(buf, r.len, 0) != r.crc ||
+				cfs_read(fd, &end, 1) != 1 || end != WARMSTART_END) {
+			break;
+		}
+		found = pos;
+		*newest = r;
+		pos += sizeof(r) + r.len + 1;
+	}
+	*size = cfs_seek(fd, 0, CFS_SEEK_END) > pos ? WARMSTART_FILE_SIZE : pos;
+	cfs_close(fd);
+	return found;
+}
+/*---------------------------------------------------------------------------*/
+static void
+start_file(uint8_t i)
+{
+	const char *name = file_name(i);
+
+	cfs_remove(name);
+	cfs_coffee_reserve(name, WARMSTART_FILE_SIZE);
+	current = i;
+	fill = 0;
+}
+/*---------------------------------------------------------------------------*/
+static void
+save(void *ptr)
+{
+	struct record r;
+	uint8_t end = WARMSTART_END;
+	int len, fd;
+
+	len = callbacks->save(buf, sizeof(buf));
+	if(len <= 0) {
+		return;
+	}
+	r.len = len;
+	r.crc = crc16_data(buf, len, 0);
+	if(have_last && r.len == last.len && r.crc == last.crc) {
+		return;
+	}
+	r.seqno = have_last ? last.seqno + 1 : 0;
+
+	// the other file is only started over once this one is full, so the
+	// newest checkpoint survives a reset in between
+	if(fill + sizeof(r) + len + 1 > WARMSTART_FILE_SIZE) {
+		start_file(!current);
+	}
+	fd = cfs_open(file_name(current), CFS_WRITE | CFS_APPEND);
+	if(fd < 0) {
+		DLOG_WARN("warmstart: cannot open %s\n", file_name(current));
+		return;
+	}
+	if(cfs_write(fd, &r, sizeof(r)) != sizeof(r) || cfs_write(fd, buf, len) != len ||
+			cfs_write(fd, &end, 1) != 1) {
+		DLOG_WARN("warmstart: checkpoint %u not written\n", r.seqno);
+		// the rest of the file is not to be trusted, move on to the other one
+		fill = WARMSTART_FILE_SIZE;
+		cfs_close(fd);
+		return;
+	}
+	cfs_close(fd);
+	fill += sizeof(r) + len + 1;
+	last = r;
+	have_last = 1;
+}
+/*---------------------------------------------------------------------------*/
+int
+warmstart_open(const struct warmstart_callbacks *cb)
+{
+	struct record r[2];
+	uint16_t size[2];
+	int offset[2], fd;
+	uint8_t i;
+
+	callbacks = cb;
+	offset[0] = scan(0, &r[0], &size[0]);
+	offset[1] = scan(1, &r[1], &size[1]);
+
+	if(offset[0] < 0 && offset[1] < 0) {
+		// nothing to resume; the first checkpoint starts a file
+		have_last = 0;
+		current = 0;
+		fill = WARMSTART_FILE_SIZE;
+		return 0;
+	}
+	if(offset[0] < 0 || (offset[1] >= 0 && (int16_t)(r[1].seqno - r[0].seqno) > 0)) {
+		i = 1;
+	} else {
+		i = 0;
+	}
+
+	current = i;
+	fill = size[i];
+	last = r[i];
+	have_last = 1;
+
+	fd = cfs_open(file_name(i), CFS_READ);
+	if(fd < 0) {
+		return 0;
+	}
+	cfs_seek(fd, offset[i] + sizeof(struct record), CFS_SEEK_SET);
+	if(cfs_read(fd, buf, last.len) != last.len) {
+		cfs_close(fd);
+		return 0;
+	}
+	cfs_close(fd);
+
+	DLOG_INFO("warmstart: resuming from checkpoint %u, %u bytes\n", last.seqno, last.len);
+	callbacks->load(buf, last.len);
+	return 1;
+}
+/*---------------------------------------------------------------------------*/
+void
+warmstart_touch(void)
+{
+	if(callbacks != NULL && ctimer_expired(&save_timer)) {
+		ctimer_set(&save_timer, WARMSTART_DELAY, save, NULL);
+	}
+}
+/*---------------------------------------------------------------------------*/
+void
+warmstart_clear(void)
+{
+	ctimer_stop(&save_timer);
+	cfs_remove(file_name(0));
+	cfs_remove(file_name(1));
+	have_last = 0;
+	current = 0;
+	fill = WARMSTART_FILE_SIZE;
+}
+/*---------------------------------------------------------------------------*/
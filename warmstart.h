@@ -0,0 +1,55 @@
+/*
+ * warmstart.h
+ *
+ * Checkpoint of the state a node needs to pick up where it was after a
+ * reset: its actuator, slot and configuration on a sensor, the neighbor
+ * table on an actuator. The owner serialises its state through callbacks;
+ * the last good checkpoint is handed back on the next boot.
+ *
+ * Checkpoints are appended to two alternating Coffee files reserved at
+ * WARMSTART_FILE_SIZE, so flash is written in order and a sector is only
+ * erased when a file is started over. Each record carries a sequence
+ * number and a crc, and a record cut short by a brownout is skipped. To
+ * spare the flash further, changes are coalesced for WARMSTART_DELAY and a
+ * checkpoint equal to the last one is not written.
+ */
+
+#ifndef WARMSTART_H_
+#define WARMSTART_H_
+
+#include "contiki.h"
+
+/* Largest checkpoint. */
+#define WARMSTART_MAX 448
+
+#ifndef WARMSTART_FILE_SIZE
+#define WARMSTART_FILE_SIZE 4096
+#endif
+
+/* A change is written at most this long after it was made. */
+#ifndef WARMSTART_DELAY
+#define WARMSTART_DELAY (CLOCK_SECOND * 20)
+#endif
+
+struct warmstart_callbacks
+{
+	/* Writes the state to buf, at most max bytes. Returns its length. */
+	int (*save)(uint8_t *buf, int max);
+
+	/* Restores the state of the last checkpoint. */
+	void (*load)(const uint8_t *buf, int len);
+};
+
+/*
+ * Reads the last checkpoint and passes it to callbacks->load. Returns 1 if
+ * there was one.
+ */
+int warmstart_open(const struct warmstart_callbacks *callbacks);
+
+/* The state changed; it is checkpointed within WARMSTART_DELAY. */
+void warmstart_touch(void);
+
+/* Forgets the checkpoints, so the next boot starts cold. */
+void warmstart_clear(void);
+
+#endif /* WARMSTART_H_ */
@@ -57,6 +57,39 @@ timedout_runicast(struct runicast_conn *c, const linkaddr_t *to, uint8_t retrans
 }
 
 
+// Lowest slot no neighbor holds.
+static uint8_t
+free_slot(void)
+{
+	struct neighbor *n;
+	uint8_t slot;
+
+	for(slot = 0; slot < MAX_NEIGHBORS - 1; slot++) {
+		for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
+			if(n->slot == slot) {
+				break;
+			}
+		}
+		if(n == NULL) {
+			break;
+		}
+	}
+	return slot;
+}
+
+
+// The sensor missed its lease; its entry and slot go to the next one.
+static void
+lease_expired(void *ptr)
+{
+	struct neighbor *n = ptr;
+
+	printf("Sensor %d went quiet, freeing slot %d\n", n->addr.u16, n->slot);
+	list_remove(neighbors_list, n);
+	memb_free(&neighbors_memb, n);
+}
+
+
 static void
 recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqno)
 {
@@ -66,7 +99,6 @@ recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqn
 
 	m = packetbuf_dataptr();
 
-	int node_id = 0;
 	/* Check if we already know this neighbor. */
 	for(n = list_head(neighbors_list); n != NULL; n = list_item_next(n)) {
 		/* We break out of the loop if the address of the neighbor matches
@@ -75,27 +107,8 @@ recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqn
 		if(linkaddr_cmp(&n->addr, from)) {
 		  break;
 		}
-		node_id++;
-
 	}
 
-	// i-th neighbor should transmit at clock_time() + k * INTERVAL + i * (INTERVAL / MAX_SENSORS)
-
-	// received = clock_seconds();
-	// expected = k * TIME_INTERVAL + node_id * TIME_INTERVAL / MAX_NEIGHBORS; // for some k
-	// late = received - expected;
-	// early = expected - received;
-	// next = TIME_INTERVAL + early;
-	//
-	int next_time = TIME_INTERVAL - (clock_seconds() % TIME_INTERVAL - node_id * TIME_INTERVAL / MAX_NEIGHBORS);
-
-	// if the next transmission time is too soon, delay it by 1 TIME_INTERVAL.
-
-	if(next_time < TIME_INTERVAL / 2) next_time += TIME_INTERVAL;
-
-	printf("Sensor %d should send again in %d seconds\n", from->u16, next_time);
-
-
 	/* If n is NULL, this neighbor was not found in our list, and we
 	 allocate a new struct neighbor from the neighbors_memb memory
 	 pool. */
@@ -109,11 +122,33 @@ recv_runicast_data(struct runicast_conn *c, const linkaddr_t *from, uint8_t seqn
 
 		/* Initialize the fields. */
 		linkaddr_copy(&n->addr, from);
+		n->slot = free_slot();
 
 		/* Place the neighbor on the neighbor list. */
 		list_add(neighbors_list, n);
 	}
 
+	// every report renews the lease
+	ctimer_set(&n->lease, CLOCK_SECOND * TIME_INTERVAL * NEIGHBOR_LEASE_MISSES, lease_expired, n);
+
+	int node_id = n->slot;
+
+	// i-th neighbor should transmit at clock_time() + k * INTERVAL + i * (INTERVAL / MAX_SENSORS)
+
+	// received = clock_seconds();
+	// expected = k * TIME_INTERVAL + node_id * TIME_INTERVAL / MAX_NEIGHBORS; // for some k
+	// late = received - expected;
+	// early = expected - received;
+	// next = TIME_INTERVAL + early;
+	//
+	int next_time = TIME_INTERVAL - (clock_seconds() % TIME_INTERVAL - node_id * TIME_INTERVAL / MAX_NEIGHBORS);
+
+	// if the next transmission time is too soon, delay it by 1 TIME_INTERVAL.
+
+	if(next_time < TIME_INTERVAL / 2) next_time += TIME_INTERVAL;
+
+	printf("Sensor %d should send again in %d seconds\n", from->u16, next_time);
+
 	struct runicast_message msg;
 
 	printf("Sending back to %d the time it should wait before transmitting again.\n", from->u16);
@@ -30,6 +30,9 @@
 #define MAX_NEIGHBORS 60
 #define TIME_INTERVAL 60
 
+/* Intervals without a report after which the actuator forgets a sensor. */
+#define NEIGHBOR_LEASE_MISSES 3
+
 /* These two defines are used for computing the moving average for the
    broadcast sequence number gaps. */
 #define SEQNO_EWMA_UNITY 0x100
@@ -107,6 +110,13 @@ struct neighbor {
 
   /* The ->addr field holds the Rime address of the neighbor. */
   linkaddr_t addr;
+
+  /* The ->slot field holds the slot the neighbor was given. */
+  uint8_t slot;
+
+  /* The ->lease timer expires when the neighbor has not reported for
+     NEIGHBOR_LEASE_MISSES intervals. */
+  struct ctimer lease;
 };
 
 